@@ -83,18 +83,27 @@ public:
   bool
   isOpen () const;
 
+  int
+  getFd () const { return fd_; }
+
   size_t
   available ();
 
   bool
   waitReadable (uint32_t timeout);
 
+  void
+  cancelRead ();
+
   void
   waitByteTimes (size_t count);
 
   size_t
   read (uint8_t *buf, size_t size = 1);
 
+  size_t
+  readSome (uint8_t *buf, size_t size);
+
   size_t
   write (const uint8_t *data, size_t length);
 
@@ -208,6 +217,13 @@ private:
   stopbits_t stopbits_;       // Stop Bits
   flowcontrol_t flowcontrol_; // Flow Control
 
+  // Wakes up a blocked read: eventfd on Linux (both ends are the same fd),
+  // a non-blocking pipe elsewhere
+  int cancel_fd_[2];
+  bool cancelled_;            // Set by waitReadable when woken up by cancelRead
+
+  void drainCancel ();
+
   // Mutex used to lock the read functions
   pthread_mutex_t read_mutex;
   // Mutex used to lock the write functions
@@ -78,12 +78,18 @@ public:
   bool
   waitReadable (uint32_t timeout);
 
+  void
+  cancelRead ();
+
   void
   waitByteTimes (size_t count);
 
   size_t
   read (uint8_t *buf, size_t size = 1);
 
+  size_t
+  readSome (uint8_t *buf, size_t size);
+
   size_t
   write (const uint8_t *data, size_t length);
 
@@ -0,0 +1,200 @@
+/*!
+ * \file serial/reactor.h
+ *
+ * \section DESCRIPTION
+ *
+ * This provides a reactor serving any number of open serial ports from one
+ * thread. The ports are multiplexed with epoll on Linux, with poll on the
+ * other unix systems or when epoll is not available. The data received is
+ * stored in a ring buffer for each port and a callback is called on the
+ * reactor thread when new data is there.
+ *
+ * Not available on Windows.
+ */
+
+#if !defined(_WIN32)
+
+#ifndef SERIAL_REACTOR_H
+#define SERIAL_REACTOR_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "serial/serial.h"
+
+namespace serial {
+
+class Reactor {
+public:
+  /*! Handle of a port added to the reactor. */
+  typedef int PortId;
+
+  /*! Called on the reactor thread when new data is in the port buffer, read
+   * it with read or readline. It is called for each chunk read from the
+   * port, up to 4096 bytes. */
+  typedef std::function<void (PortId id)> ReadCallback;
+
+  /*! Called on the reactor thread when the port fails (e.g. the device is
+   * unplugged), the port is removed from the reactor before the call. */
+  typedef std::function<void (PortId id, const std::string &error)>
+    ErrorCallback;
+
+  /*! Called periodically on the reactor thread, see setTick. */
+  typedef std::function<void ()> TickCallback;
+
+  /*!
+   * Creates the reactor and starts its thread.
+   *
+   * \param buffer_size Size of the ring buffer of each port, when it is full
+   *        the oldest data are dropped.
+   *
+   * \throw serial::IOException
+   */
+  explicit Reactor (size_t buffer_size = 65536);
+
+  /*! Stops the thread, the ports are not closed. */
+  virtual ~Reactor ();
+
+  /*!
+   * Serve an open port. From now on the port must not be read with the
+   * Serial functions, the data already in its receive buffer are moved to
+   * the ring buffer. Writes are not affected.
+   *
+   * \param port Open port, it must stay open until remove.
+   * \param on_read Called when new data is received.
+   * \param on_error Optional, called when the port fails.
+   *
+   * \return The handle of the port.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::IOException
+   */
+  PortId
+  add (Serial &port, ReadCallback on_read,
+       ErrorCallback on_error = ErrorCallback ());
+
+  /*!
+   * Stop serving a port, the data not read are lost. When called outside of
+   * the reactor thread no callback for the port is running when it returns.
+   *
+   * \return false if the port was not there.
+   */
+  bool
+  remove (PortId id);
+
+  /*! Number of bytes in the port buffer, 0 for unknown ports. */
+  size_t
+  available (PortId id);
+
+  /*! Read up to size bytes from the port buffer, it never blocks. */
+  size_t
+  read (PortId id, uint8_t *buffer, size_t size);
+
+  /*!
+   * Read a line from the port buffer, it never blocks.
+   *
+   * \return The length of the line with the eol, 0 if there is no complete
+   *         line yet. A line longer than size is returned in pieces of size
+   *         bytes.
+   */
+  size_t
+  readline (PortId id, std::string &line, size_t size = 65536,
+            const std::string &eol = "\n");
+
+  /*!
+   * Call a function on the reactor thread about every period, also when no
+   * data are received, e.g. to expire timeouts without another thread.
+   *
+   * \param period_ms Period in milliseconds, 0 stops the calls.
+   * \param tick The function, it replaces the previous one. When called
+   *        outside of the reactor thread the previous one is not running
+   *        when setTick returns.
+   */
+  void
+  setTick (uint32_t period_ms, TickCallback tick);
+
+  /*! Number of bytes dropped because the port buffer was full. */
+  size_t
+  dropped (PortId id);
+
+  /*! True if the ports are multiplexed with epoll, false with poll. */
+  bool
+  usesEpoll () const { return epoll_fd_ != -1; }
+
+  /*! True when called from the reactor thread, i.e. from a callback. */
+  bool
+  inReactorThread () const;
+
+private:
+  // Disable copy constructors
+  Reactor (const Reactor&);
+  Reactor& operator= (const Reactor&);
+
+  // One port, the buffer is only touched with its mutex
+  struct Port {
+    PortId id;
+    int fd;
+    ReadCallback on_read;
+    ErrorCallback on_error;
+    std::mutex mutex;
+    std::vector<uint8_t> buffer;  // ring buffer
+    size_t head;                  // first byte
+    size_t count;                 // bytes in the buffer
+    size_t dropped;
+  };
+  typedef std::shared_ptr<Port> PortPtr;
+
+  void
+  run ();
+
+  void
+  wake ();
+
+  // Read everything available and call on_read, false if the port failed
+  bool
+  receive (Port &port, std::string &error);
+
+  void
+  fail (const PortPtr &port, const std::string &error);
+
+  PortPtr
+  find (PortId id);
+
+  static void
+  push (Port &port, const uint8_t *data, size_t size);
+
+  size_t buffer_size_;
+  int epoll_fd_;                  // -1 when poll is used
+  int wake_fd_[2];                // eventfd on Linux (both ends are the same fd), pipe elsewhere
+
+  std::mutex mutex_;              // protects ports_, next_id_ and the tick
+  std::map<PortId, PortPtr> ports_;
+  PortId next_id_;
+  TickCallback tick_;
+  uint32_t tick_period_ms_;
+
+  // waits for the end of the cycle running now, see remove
+  void
+  waitCycle ();
+
+  // remove and setTick wait for the end of the cycle running the callbacks
+  std::mutex cycle_mutex_;
+  std::condition_variable cycle_condition_;
+  unsigned long long cycle_;
+
+  std::atomic<bool> stop_;
+  std::thread thread_;
+};
+
+} // namespace serial
+
+#endif // SERIAL_REACTOR_H
+
+#endif // !defined(_WIN32)
@@ -211,7 +211,11 @@ public:
   bool
   isOpen () const;
 
-  /*! Closes the serial port. */
+  /*! Closes the serial port.
+   *
+   * A read blocked in another thread is cancelled first, see cancelRead, and
+   * the port is closed when that read has returned.
+   */
   void
   close ();
 
@@ -226,6 +230,20 @@ public:
   bool
   waitReadable ();
 
+  /*! Wake up a read or waitReadable blocked in another thread, it returns
+   * at once with the data received so far, as on a timeout.
+   *
+   * On unix the cancel is kept until a wait consumes it, so when no read is
+   * blocked the next wait returns at once. On Windows only a read in
+   * progress is cancelled.
+   *
+   * It does not take the read lock, so it can be called while reading.
+   *
+   * \throw serial::IOException
+   */
+  void
+  cancelRead ();
+
   /*! Block for a period of time corresponding to the transmission time of
    * count characters at present serial settings. This may be used in con-
    * junction with waitReadable to read larger blocks of data from the
@@ -336,6 +354,30 @@ public:
   std::string
   readline (size_t size = 65536, std::string eol = "\n");
 
+  /*! Reads in a line without copying it out of the receive buffer.
+   *
+   * Incoming data is read in large chunks into a receive buffer owned by
+   * the port, complete lines are then handed out from that buffer. On return
+   * line points to the first byte of the line inside the receive buffer,
+   * the pointer stays valid until the next read, readline or flush call.
+   *
+   * If no complete line arrives before the read timeout expires, the
+   * partial data is returned (as for the other readline overloads).
+   *
+   * \param line A reference to a pointer that is set to the line.
+   * \param size A maximum length of a line, defaults to 65536 (2^16)
+   * \param eol A string to match against for the EOL.
+   *
+   * \return A size_t representing the number of bytes of the line,
+   * including the EOL.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::SerialException
+   */
+  size_t
+  readline (const char *&line, size_t size = 65536,
+            const std::string &eol = "\n");
+
   /*! Reads in multiple lines until the serial port times out.
    *
    * This requires a timeout > 0 before it can be run. It will read until a
@@ -656,6 +698,9 @@ private:
   class SerialImpl;
   SerialImpl *pimpl_;
 
+  // The reactor reads the port directly, see serial/reactor.h
+  friend class Reactor;
+
   // Scoped Lock Classes
   class ScopedReadLock;
   class ScopedWriteLock;
@@ -667,6 +712,18 @@ private:
   size_t
   write_ (const uint8_t *data, size_t length);
 
+  // Readline common function, the line is left in the receive buffer
+  size_t
+  readline_ (const char *&line, size_t size, const std::string &eol);
+  // Read a chunk from the port into the receive buffer
+  size_t
+  fillBuffer_ ();
+
+  // Receive buffer, pending data is in [rx_begin_, rx_end_)
+  std::vector<uint8_t> rx_buffer_;
+  size_t rx_begin_;
+  size_t rx_end_;
+
 };
 
 class SerialException : public std::exception
@@ -0,0 +1,473 @@
+#if !defined(_WIN32)
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <algorithm>
+#include <chrono>
+
+#if defined(__linux__)
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+#endif
+
+#include "serial/reactor.h"
+#include "serial/impl/unix.h"
+
+using std::string;
+using serial::Reactor;
+using serial::Serial;
+using serial::IOException;
+using serial::PortNotOpenedException;
+
+static const int max_events = 64;
+
+Reactor::Reactor (size_t buffer_size)
+  : buffer_size_ (std::max (buffer_size, static_cast<size_t> (1))),
+    epoll_fd_ (-1), next_id_ (1), tick_period_ms_ (0), cycle_ (0),
+    stop_ (false)
+{
+#if defined(__linux__)
+  wake_fd_[0] = wake_fd_[1] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_[0] == -1) {
+    THROW (IOException, errno);
+  }
+  // poll is used if epoll is not there
+  epoll_fd_ = epoll_create1 (EPOLL_CLOEXEC);
+  if (epoll_fd_ != -1) {
+    epoll_event event;
+    memset (&event, 0, sizeof (event));
+    event.events = EPOLLIN;
+    event.data.u64 = 0; // 0 is the wake up, the ports start from 1
+    if (epoll_ctl (epoll_fd_, EPOLL_CTL_ADD, wake_fd_[0], &event) == -1) {
+      ::close (epoll_fd_);
+      epoll_fd_ = -1;
+    }
+  }
+#else
+  if (pipe (wake_fd_) == -1) {
+    THROW (IOException, errno);
+  }
+  for (int i = 0; i < 2; ++i) {
+    fcntl (wake_fd_[i], F_SETFL, fcntl (wake_fd_[i], F_GETFL) | O_NONBLOCK);
+    fcntl (wake_fd_[i], F_SETFD, FD_CLOEXEC);
+  }
+#endif
+  thread_ = std::thread (&Reactor::run, this);
+}
+
+Reactor::~Reactor ()
+{
+  stop_ = true;
+  wake ();
+  if (thread_.joinable ()) {
+    thread_.join ();
+  }
+  if (epoll_fd_ != -1) {
+    ::close (epoll_fd_);
+  }
+  ::close (wake_fd_[0]);
+  if (wake_fd_[1] != wake_fd_[0]) {
+    ::close (wake_fd_[1]);
+  }
+}
+
+Reactor::PortId
+Reactor::add (Serial &port, ReadCallback on_read, ErrorCallback on_error)
+{
+  PortPtr entry (new Port);
+  entry->on_read = on_read;
+  entry->on_error = on_error;
+  entry->buffer.resize (buffer_size_);
+  entry->head = 0;
+  entry->count = 0;
+  entry->dropped = 0;
+  // the data already received by the port are not lost
+  port.pimpl_->readLock ();
+  if (!port.pimpl_->isOpen ()) {
+    port.pimpl_->readUnlock ();
+    throw PortNotOpenedException ("Reactor::add");
+  }
+  entry->fd = port.pimpl_->getFd ();
+  push (*entry, port.rx_buffer_.data () + port.rx_begin_,
+        port.rx_end_ - port.rx_begin_);
+  port.rx_begin_ = port.rx_end_ = 0;
+  port.pimpl_->readUnlock ();
+
+  std::lock_guard<std::mutex> lock (mutex_);
+  entry->id = next_id_++;
+#if defined(__linux__)
+  if (epoll_fd_ != -1) {
+    epoll_event event;
+    memset (&event, 0, sizeof (event));
+    event.events = EPOLLIN;
+    event.data.u64 = static_cast<uint64_t> (entry->id);
+    if (epoll_ctl (epoll_fd_, EPOLL_CTL_ADD, entry->fd, &event) == -1) {
+      THROW (IOException, errno);
+    }
+  }
+#endif
+  ports_[entry->id] = entry;
+  if (epoll_fd_ == -1) {
+    wake (); // the poll set is rebuilt
+  }
+  return entry->id;
+}
+
+bool
+Reactor::remove (PortId id)
+{
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    std::map<PortId, PortPtr>::iterator it = ports_.find (id);
+    if (it == ports_.end ()) {
+      return false;
+    }
+#if defined(__linux__)
+    if (epoll_fd_ != -1) {
+      // it fails if the port was closed already, the fd left the set anyway
+      epoll_ctl (epoll_fd_, EPOLL_CTL_DEL, it->second->fd, NULL);
+    }
+#endif
+    ports_.erase (it);
+  }
+  // the callbacks look up the port for each event, so after the cycle
+  // running now no callback can see it
+  waitCycle ();
+  return true;
+}
+
+void
+Reactor::setTick (uint32_t period_ms, TickCallback tick)
+{
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    tick_ = tick;
+    tick_period_ms_ = tick ? period_ms : 0;
+  }
+  // the wait timeout changes
+  waitCycle ();
+}
+
+void
+Reactor::waitCycle ()
+{
+  if (inReactorThread ()) {
+    wake ();
+    return;
+  }
+  std::unique_lock<std::mutex> lock (cycle_mutex_);
+  const unsigned long long cycle = cycle_;
+  wake ();
+  while (cycle_ == cycle && !stop_) {
+    cycle_condition_.wait (lock);
+  }
+}
+
+size_t
+Reactor::available (PortId id)
+{
+  PortPtr port = find (id);
+  if (!port) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock (port->mutex);
+  return port->count;
+}
+
+size_t
+Reactor::read (PortId id, uint8_t *buffer, size_t size)
+{
+  PortPtr port = find (id);
+  if (!port) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock (port->mutex);
+  size_t n = std::min (size, port->count);
+  size_t capacity = port->buffer.size ();
+  size_t first = std::min (n, capacity - port->head);
+  memcpy (buffer, port->buffer.data () + port->head, first);
+  memcpy (buffer + first, port->buffer.data (), n - first);
+  port->head = (port->head + n) % capacity;
+  port->count -= n;
+  return n;
+}
+
+size_t
+Reactor::readline (PortId id, string &line, size_t size, const string &eol)
+{
+  line.clear ();
+  PortPtr port = find (id);
+  if (!port || eol.empty ()) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock (port->mutex);
+  size_t capacity = port->buffer.size ();
+  size_t limit = std::min (size, port->count);
+  size_t eol_len = eol.length ();
+  size_t matched = 0;
+  size_t length = 0;
+  for (size_t i = 0; i < limit; ++i) {
+    uint8_t c = port->buffer[(port->head + i) % capacity];
+    // the eol strings used are "\n" and "\r\n", no need for a full search
+    matched = (c == static_cast<uint8_t> (eol[matched])) ? matched + 1 :
+              (c == static_cast<uint8_t> (eol[0])) ? 1 : 0;
+    if (matched == eol_len) {
+      length = i + 1;
+      break;
+    }
+  }
+  if (length == 0) {
+    if (limit < size) {
+      return 0; // no complete line yet
+    }
+    length = size;
+  }
+  line.resize (length);
+  size_t first = std::min (length, capacity - port->head);
+  memcpy (&line[0], port->buffer.data () + port->head, first);
+  memcpy (&line[0] + first, port->buffer.data (), length - first);
+  port->head = (port->head + length) % capacity;
+  port->count -= length;
+  return length;
+}
+
+size_t
+Reactor::dropped (PortId id)
+{
+  PortPtr port = find (id);
+  if (!port) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock (port->mutex);
+  return port->dropped;
+}
+
+bool
+Reactor::inReactorThread () const
+{
+  return std::this_thread::get_id () == thread_.get_id ();
+}
+
+void
+Reactor::wake ()
+{
+#if defined(__linux__)
+  uint64_t one = 1;
+#else
+  char one = 1;
+#endif
+  // EAGAIN means that a wake up is already pending
+  ssize_t r = ::write (wake_fd_[1], &one, sizeof (one));
+  (void) r;
+}
+
+Reactor::PortPtr
+Reactor::find (PortId id)
+{
+  std::lock_guard<std::mutex> lock (mutex_);
+  std::map<PortId, PortPtr>::iterator it = ports_.find (id);
+  return it == ports_.end () ? PortPtr () : it->second;
+}
+
+void
+Reactor::push (Port &port, const uint8_t *data, size_t size)
+{
+  size_t capacity = port.buffer.size ();
+  if (size > capacity) {
+    // only the newest data fit
+    port.dropped += size - capacity;
+    data += size - capacity;
+    size = capacity;
+  }
+  size_t space = capacity - port.count;
+  if (size > space) {
+    // drop the oldest data
+    port.head = (port.head + size - space) % capacity;
+    port.count -= size - space;
+    port.dropped += size - space;
+  }
+  size_t tail = (port.head + port.count) % capacity;
+  size_t first = std::min (size, capacity - tail);
+  memcpy (port.buffer.data () + tail, data, first);
+  memcpy (port.buffer.data (), data + first, size - first);
+  port.count += size;
+}
+
+bool
+Reactor::receive (Port &port, string &error)
+{
+  // the callback is called after each chunk, so a burst larger than the
+  // buffer is not dropped if the callback reads the data
+  uint8_t chunk[4096];
+  size_t chunk_size = std::min (sizeof (chunk), port.buffer.size ());
+  size_t received = 0;
+  while (true) {
+    ssize_t n = ::read (port.fd, chunk, chunk_size);
+    if (n > 0) {
+      {
+        std::lock_guard<std::mutex> lock (port.mutex);
+        push (port, chunk, static_cast<size_t> (n));
+      }
+      received += static_cast<size_t> (n);
+      if (port.on_read) {
+        port.on_read (port.id);
+        if (find (port.id).get () != &port) {
+          break; // removed by the callback
+        }
+      }
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break; // everything read
+    }
+    if (n == 0 && received > 0) {
+      break; // the end of the data, not a disconnection
+    }
+    // Disconnected devices, at least on Linux, show the behavior that
+    // they are always ready to read immediately but reading returns nothing.
+    error = (n == 0) ? "device reports readiness to read but returned no "
+                       "data (device disconnected?)" : strerror (errno);
+    return false;
+  }
+  return true;
+}
+
+void
+Reactor::fail (const PortPtr &port, const string &error)
+{
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    std::map<PortId, PortPtr>::iterator it = ports_.find (port->id);
+    if (it == ports_.end () || it->second != port) {
+      return; // removed in the meantime
+    }
+#if defined(__linux__)
+    if (epoll_fd_ != -1) {
+      epoll_ctl (epoll_fd_, EPOLL_CTL_DEL, port->fd, NULL);
+    }
+#endif
+    ports_.erase (it);
+  }
+  if (port->on_error) {
+    port->on_error (port->id, error);
+  }
+}
+
+void
+Reactor::run ()
+{
+  typedef std::chrono::steady_clock clock;
+  std::vector<PortId> ready;
+  std::vector<pollfd> poll_fds;
+  std::vector<PortId> poll_ids;
+  ready.reserve (max_events);
+  clock::time_point next_tick = clock::now ();
+
+  while (!stop_) {
+    ready.clear ();
+    bool woken = false;
+    TickCallback tick;
+    uint32_t tick_period_ms = 0;
+    int timeout_ms = -1;
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      if (tick_period_ms_ > 0) {
+        tick = tick_;
+        tick_period_ms = tick_period_ms_;
+        const clock::time_point now = clock::now ();
+        if (next_tick > now + std::chrono::milliseconds (tick_period_ms)) {
+          next_tick = now + std::chrono::milliseconds (tick_period_ms);
+        }
+        // rounded up, so the wait does not end just before the tick
+        timeout_ms = next_tick <= now ? 0 : static_cast<int> (
+          (std::chrono::duration_cast<std::chrono::microseconds> (
+            next_tick - now).count () + 999) / 1000);
+      }
+    }
+#if defined(__linux__)
+    if (epoll_fd_ != -1) {
+      epoll_event events[max_events];
+      int n = epoll_wait (epoll_fd_, events, max_events, timeout_ms);
+      if (n < 0 && errno != EINTR) {
+        break;
+      }
+      for (int i = 0; i < n; ++i) {
+        if (events[i].data.u64 == 0) {
+          woken = true;
+        } else {
+          ready.push_back (static_cast<PortId> (events[i].data.u64));
+        }
+      }
+    } else
+#endif
+    {
+      // the poll set is rebuilt on each cycle from the ports
+      poll_fds.clear ();
+      poll_ids.clear ();
+      pollfd wake_poll = { wake_fd_[0], POLLIN, 0 };
+      poll_fds.push_back (wake_poll);
+      {
+        std::lock_guard<std::mutex> lock (mutex_);
+        for (std::map<PortId, PortPtr>::iterator it = ports_.begin ();
+             it != ports_.end (); ++it) {
+          pollfd port_poll = { it->second->fd, POLLIN, 0 };
+          poll_fds.push_back (port_poll);
+          poll_ids.push_back (it->first);
+        }
+      }
+      int n = poll (poll_fds.data (), poll_fds.size (), timeout_ms);
+      if (n < 0 && errno != EINTR) {
+        break;
+      }
+      woken = n > 0 && poll_fds[0].revents != 0;
+      for (size_t i = 1; n > 0 && i < poll_fds.size (); ++i) {
+        if (poll_fds[i].revents != 0) {
+          ready.push_back (poll_ids[i - 1]);
+        }
+      }
+    }
+
+    if (woken) {
+      char buf[64];
+      while (::read (wake_fd_[0], buf, sizeof (buf)) > 0) {}
+    }
+
+    for (size_t i = 0; i < ready.size () && !stop_; ++i) {
+      // removed ports are not found, so no callback after remove
+      PortPtr port = find (ready[i]);
+      if (!port) {
+        continue;
+      }
+      string error;
+      if (!receive (*port, error)) {
+        fail (port, error);
+      }
+    }
+
+    if (tick && clock::now () >= next_tick && !stop_) {
+      next_tick = clock::now () + std::chrono::milliseconds (tick_period_ms);
+      tick ();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock (cycle_mutex_);
+      ++cycle_;
+    }
+    cycle_condition_.notify_all ();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock (cycle_mutex_);
+    stop_ = true;
+    ++cycle_;
+  }
+  cycle_condition_.notify_all ();
+}
+
+#endif // !defined(_WIN32)
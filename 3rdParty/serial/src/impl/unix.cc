@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sstream>
+#include <algorithm>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
@@ -21,6 +22,7 @@
 
 #if defined(__linux__)
 # include <linux/serial.h>
+# include <sys/eventfd.h>
 #endif
 
 #include <sys/select.h>
@@ -111,10 +113,25 @@ Serial::SerialImpl::SerialImpl (const string &port, unsigned long baudrate,
                                 flowcontrol_t flowcontrol)
   : port_ (port), fd_ (-1), is_open_ (false), xonxoff_ (false), rtscts_ (false),
     baudrate_ (baudrate), parity_ (parity),
-    bytesize_ (bytesize), stopbits_ (stopbits), flowcontrol_ (flowcontrol)
+    bytesize_ (bytesize), stopbits_ (stopbits), flowcontrol_ (flowcontrol),
+    cancelled_ (false)
 {
   pthread_mutex_init(&this->read_mutex, NULL);
   pthread_mutex_init(&this->write_mutex, NULL);
+#if defined(__linux__)
+  cancel_fd_[0] = cancel_fd_[1] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (cancel_fd_[0] == -1) {
+    THROW (IOException, errno);
+  }
+#else
+  if (pipe (cancel_fd_) == -1) {
+    THROW (IOException, errno);
+  }
+  for (int i = 0; i < 2; ++i) {
+    fcntl (cancel_fd_[i], F_SETFL, fcntl (cancel_fd_[i], F_GETFL) | O_NONBLOCK);
+    fcntl (cancel_fd_[i], F_SETFD, FD_CLOEXEC);
+  }
+#endif
   if (port_.empty () == false)
     open ();
 }
@@ -122,6 +139,10 @@ Serial::SerialImpl::SerialImpl (const string &port, unsigned long baudrate,
 Serial::SerialImpl::~SerialImpl ()
 {
   close();
+  ::close (cancel_fd_[0]);
+  if (cancel_fd_[1] != cancel_fd_[0]) {
+    ::close (cancel_fd_[1]);
+  }
   pthread_mutex_destroy(&this->read_mutex);
   pthread_mutex_destroy(&this->write_mutex);
 }
@@ -153,6 +174,7 @@ Serial::SerialImpl::open ()
   }
 
   reconfigurePort();
+  drainCancel ();
   is_open_ = true;
 }
 
@@ -469,6 +491,7 @@ Serial::SerialImpl::close ()
     }
     is_open_ = false;
   }
+  drainCancel ();
 }
 
 bool
@@ -494,12 +517,15 @@ Serial::SerialImpl::available ()
 bool
 Serial::SerialImpl::waitReadable (uint32_t timeout)
 {
-  // Setup a select call to block for serial data or a timeout
+  // Setup a select call to block for serial data, a cancel or a timeout
+  cancelled_ = false;
   fd_set readfds;
   FD_ZERO (&readfds);
   FD_SET (fd_, &readfds);
+  FD_SET (cancel_fd_[0], &readfds);
   timespec timeout_ts (timespec_from_ms (timeout));
-  int r = pselect (fd_ + 1, &readfds, NULL, NULL, &timeout_ts, NULL);
+  int r = pselect (std::max (fd_, cancel_fd_[0]) + 1, &readfds, NULL, NULL,
+                   &timeout_ts, NULL);
 
   if (r < 0) {
     // Select was interrupted
@@ -513,6 +539,12 @@ Serial::SerialImpl::waitReadable (uint32_t timeout)
   if (r == 0) {
     return false;
   }
+  // Woken up by cancelRead, the cancel is consumed here
+  if (FD_ISSET (cancel_fd_[0], &readfds)) {
+    drainCancel ();
+    cancelled_ = true;
+    return false;
+  }
   // This shouldn't happen, if r > 0 our fd has to be in the list!
   if (!FD_ISSET (fd_, &readfds)) {
     THROW (IOException, "select reports ready to read, but our fd isn't"
@@ -522,6 +554,31 @@ Serial::SerialImpl::waitReadable (uint32_t timeout)
   return true;
 }
 
+void
+Serial::SerialImpl::cancelRead ()
+{
+  // Only async-signal-safe calls, the cancel stays pending until a wait
+  // consumes it, so a cancel just before the wait is not lost
+#if defined(__linux__)
+  uint64_t one = 1;
+  ssize_t r = ::write (cancel_fd_[1], &one, sizeof (one));
+#else
+  char one = 1;
+  ssize_t r = ::write (cancel_fd_[1], &one, sizeof (one));
+#endif
+  // EAGAIN means that a cancel is already pending
+  if (r == -1 && errno != EAGAIN) {
+    THROW (IOException, errno);
+  }
+}
+
+void
+Serial::SerialImpl::drainCancel ()
+{
+  char buf[64];
+  while (::read (cancel_fd_[0], buf, sizeof (buf)) > 0) {}
+}
+
 void
 Serial::SerialImpl::waitByteTimes (size_t count)
 {
@@ -601,11 +658,42 @@ Serial::SerialImpl::read (uint8_t *buf, size_t size)
                                "read, this shouldn't happen, might be "
                                "a logical error!");
       }
+    } else if (cancelled_) {
+      // Return what we have so far
+      break;
     }
   }
   return bytes_read;
 }
 
+size_t
+Serial::SerialImpl::readSome (uint8_t *buf, size_t size)
+{
+  // If the port is not open, throw
+  if (!is_open_) {
+    throw PortNotOpenedException ("Serial::readSome");
+  }
+  // Take whatever is already available without blocking
+  ssize_t bytes_read = ::read (fd_, buf, size);
+  if (bytes_read > 0) {
+    return static_cast<size_t> (bytes_read);
+  }
+  // Nothing there yet, wait for the first byte up to the read timeout
+  if (timeout_.read_timeout_constant == 0 ||
+      !waitReadable (timeout_.read_timeout_constant)) {
+    return 0;
+  }
+  bytes_read = ::read (fd_, buf, size);
+  if (bytes_read < 1) {
+    // Disconnected devices, at least on Linux, show the
+    // behavior that they are always ready to read immediately
+    // but reading returns nothing.
+    throw SerialException ("device reports readiness to read but "
+                           "returned no data (device disconnected?)");
+  }
+  return static_cast<size_t> (bytes_read);
+}
+
 size_t
 Serial::SerialImpl::write (const uint8_t *data, size_t length)
 {
@@ -321,6 +321,15 @@ Serial::SerialImpl::waitReadable (uint32_t /*timeout*/)
   return false;
 }
 
+void
+Serial::SerialImpl::cancelRead ()
+{
+  // Only a ReadFile in progress is cancelled, it returns what it has so far
+  if (is_open_ && fd_ != INVALID_HANDLE_VALUE) {
+    CancelIoEx(fd_, NULL);
+  }
+}
+
 void
 Serial::SerialImpl::waitByteTimes (size_t /*count*/)
 {
@@ -333,8 +342,11 @@ Serial::SerialImpl::read (uint8_t *buf, size_t size)
   if (!is_open_) {
     throw PortNotOpenedException ("Serial::read");
   }
-  DWORD bytes_read;
+  DWORD bytes_read = 0;
   if (!ReadFile(fd_, buf, static_cast<DWORD>(size), &bytes_read, NULL)) {
+    if (GetLastError() == ERROR_OPERATION_ABORTED) {
+      return (size_t) (bytes_read); // cancelRead
+    }
     stringstream ss;
     ss << "Error while reading from the serial port: " << GetLastError();
     THROW (IOException, ss.str().c_str());
@@ -342,6 +354,34 @@ Serial::SerialImpl::read (uint8_t *buf, size_t size)
   return (size_t) (bytes_read);
 }
 
+size_t
+Serial::SerialImpl::readSome (uint8_t *buf, size_t size)
+{
+  if (!is_open_) {
+    throw PortNotOpenedException ("Serial::readSome");
+  }
+  size_t bytes_available = available ();
+  if (bytes_available == 0) {
+    // Nothing there yet, wait for the first byte within the read timeouts
+    size_t bytes_read = read (buf, 1);
+    if (bytes_read == 0 || size == 1) {
+      return bytes_read;
+    }
+    bytes_available = available ();
+    if (bytes_available > size - 1) {
+      bytes_available = size - 1;
+    }
+    if (bytes_available > 0) {
+      bytes_read += read (buf + 1, bytes_available);
+    }
+    return bytes_read;
+  }
+  if (bytes_available > size) {
+    bytes_available = size;
+  }
+  return read (buf, bytes_available);
+}
+
 size_t
 Serial::SerialImpl::write (const uint8_t *data, size_t length)
 {
@@ -1,14 +1,6 @@
 /* Copyright 2012 William Woodall and John Harrison */
 #include <algorithm>
 
-#if !defined(_WIN32) && !defined(__OpenBSD__) && !defined(__FreeBSD__)
-# include <alloca.h>
-#endif
-
-#if defined (__MINGW32__)
-# define alloca __builtin_alloca
-#endif
-
 #include "serial/serial.h"
 
 #ifdef _WIN32
@@ -32,6 +24,9 @@ using serial::parity_t;
 using serial::stopbits_t;
 using serial::flowcontrol_t;
 
+// Size of the chunks read from the port into the receive buffer
+static const size_t rx_chunk_size = 4096;
+
 class Serial::ScopedReadLock {
 public:
   ScopedReadLock(SerialImpl *pimpl) : pimpl_(pimpl) {
@@ -67,7 +62,8 @@ Serial::Serial (const string &port, uint32_t baudrate, serial::Timeout timeout,
                 bytesize_t bytesize, parity_t parity, stopbits_t stopbits,
                 flowcontrol_t flowcontrol)
  : pimpl_(new SerialImpl (port, baudrate, bytesize, parity,
-                                           stopbits, flowcontrol))
+                                           stopbits, flowcontrol)),
+   rx_buffer_(rx_chunk_size), rx_begin_(0), rx_end_(0)
 {
   pimpl_->setTimeout(timeout);
 }
@@ -80,12 +76,17 @@ Serial::~Serial ()
 void
 Serial::open ()
 {
+  ScopedReadLock lock(this->pimpl_);
+  rx_begin_ = rx_end_ = 0; // drop anything left from a previous session
   pimpl_->open ();
 }
 
 void
 Serial::close ()
 {
+  // a blocked reader must let go of the port before it is closed
+  pimpl_->cancelRead ();
+  ScopedReadLock lock(this->pimpl_);
   pimpl_->close ();
 }
 
@@ -98,7 +99,7 @@ Serial::isOpen () const
 size_t
 Serial::available ()
 {
-  return pimpl_->available ();
+  return (rx_end_ - rx_begin_) + pimpl_->available ();
 }
 
 bool
@@ -108,6 +109,12 @@ Serial::waitReadable ()
   return pimpl_->waitReadable(timeout.read_timeout_constant);
 }
 
+void
+Serial::cancelRead ()
+{
+  pimpl_->cancelRead ();
+}
+
 void
 Serial::waitByteTimes (size_t count)
 {
@@ -117,14 +124,46 @@ Serial::waitByteTimes (size_t count)
 size_t
 Serial::read_ (uint8_t *buffer, size_t size)
 {
-  return this->pimpl_->read (buffer, size);
+  // Hand out what is left in the receive buffer first
+  size_t buffered = min (size, rx_end_ - rx_begin_);
+  if (buffered > 0) {
+    memcpy (buffer, rx_buffer_.data () + rx_begin_, buffered);
+    rx_begin_ += buffered;
+    if (buffered == size) {
+      return size;
+    }
+  }
+  return buffered + this->pimpl_->read (buffer + buffered, size - buffered);
+}
+
+size_t
+Serial::fillBuffer_ ()
+{
+  size_t pending = rx_end_ - rx_begin_;
+  if (rx_buffer_.size () - rx_end_ < rx_chunk_size) {
+    // Move the partial line to the front, this only copies the bytes
+    // of the line which is still incomplete
+    if (rx_begin_ > 0) {
+      memmove (rx_buffer_.data (), rx_buffer_.data () + rx_begin_, pending);
+      rx_begin_ = 0;
+      rx_end_ = pending;
+    }
+    // Grow only if a single line does not fit in the buffer
+    if (rx_buffer_.size () - rx_end_ < rx_chunk_size) {
+      rx_buffer_.resize (rx_end_ + rx_chunk_size);
+    }
+  }
+  size_t bytes_read = this->pimpl_->readSome (rx_buffer_.data () + rx_end_,
+                                              rx_buffer_.size () - rx_end_);
+  rx_end_ += bytes_read;
+  return bytes_read;
 }
 
 size_t
 Serial::read (uint8_t *buffer, size_t size)
 {
   ScopedReadLock lock(this->pimpl_);
-  return this->pimpl_->read (buffer, size);
+  return this->read_ (buffer, size);
 }
 
 size_t
@@ -132,7 +171,7 @@ Serial::read (std::vector<uint8_t> &buffer, size_t size)
 {
   ScopedReadLock lock(this->pimpl_);
   uint8_t *buffer_ = new uint8_t[size];
-  size_t bytes_read = this->pimpl_->read (buffer_, size);
+  size_t bytes_read = this->read_ (buffer_, size);
   buffer.insert (buffer.end (), buffer_, buffer_+bytes_read);
   delete[] buffer_;
   return bytes_read;
@@ -143,7 +182,7 @@ Serial::read (std::string &buffer, size_t size)
 {
   ScopedReadLock lock(this->pimpl_);
   uint8_t *buffer_ = new uint8_t[size];
-  size_t bytes_read = this->pimpl_->read (buffer_, size);
+  size_t bytes_read = this->read_ (buffer_, size);
   buffer.append (reinterpret_cast<const char*>(buffer_), bytes_read);
   delete[] buffer_;
   return bytes_read;
@@ -158,29 +197,63 @@ Serial::read (size_t size)
 }
 
 size_t
-Serial::readline (string &buffer, size_t size, string eol)
+Serial::readline_ (const char *&line, size_t size, const string &eol)
 {
-  ScopedReadLock lock(this->pimpl_);
   size_t eol_len = eol.length ();
-  uint8_t *buffer_ = static_cast<uint8_t*>
-                              (alloca (size * sizeof (uint8_t)));
-  size_t read_so_far = 0;
+  size_t scanned = 0; // pending bytes already searched for the EOL
   while (true)
   {
-    size_t bytes_read = this->read_ (buffer_ + read_so_far, 1);
-    read_so_far += bytes_read;
-    if (bytes_read == 0) {
-      break; // Timeout occured on reading 1 byte
+    size_t pending = rx_end_ - rx_begin_;
+    const uint8_t *data = rx_buffer_.data () + rx_begin_;
+    size_t limit = min (pending, size);
+    if (eol_len > 0 && limit >= eol_len) {
+      const uint8_t *first = data + scanned;
+      const uint8_t *last = data + limit;
+      const uint8_t *found;
+      if (eol_len == 1) {
+        found = static_cast<const uint8_t*>
+                  (memchr (first, eol[0], last - first));
+        if (found == NULL) found = last;
+      } else {
+        found = std::search (first, last, eol.begin (), eol.end ());
+      }
+      if (found != last) {
+        size_t line_len = (found - data) + eol_len;
+        line = reinterpret_cast<const char*> (data);
+        rx_begin_ += line_len;
+        return line_len; // EOL found
+      }
+      // the EOL may straddle the end of what we have so far
+      scanned = limit - eol_len + 1;
     }
-    if (string (reinterpret_cast<const char*>
-         (buffer_ + read_so_far - eol_len), eol_len) == eol) {
-      break; // EOL found
+    if (pending >= size) {
+      line = reinterpret_cast<const char*> (data);
+      rx_begin_ += size;
+      return size; // Reached the maximum read length
     }
-    if (read_so_far == size) {
-      break; // Reached the maximum read length
+    if (fillBuffer_ () == 0) {
+      // Timeout occurred, hand out the partial line
+      line = reinterpret_cast<const char*> (rx_buffer_.data () + rx_begin_);
+      rx_begin_ += pending;
+      return pending;
     }
   }
-  buffer.append(reinterpret_cast<const char*> (buffer_), read_so_far);
+}
+
+size_t
+Serial::readline (const char *&line, size_t size, const string &eol)
+{
+  ScopedReadLock lock(this->pimpl_);
+  return this->readline_ (line, size, eol);
+}
+
+size_t
+Serial::readline (string &buffer, size_t size, string eol)
+{
+  ScopedReadLock lock(this->pimpl_);
+  const char *line;
+  size_t read_so_far = this->readline_ (line, size, eol);
+  buffer.append(line, read_so_far);
   return read_so_far;
 }
 
@@ -198,36 +271,18 @@ Serial::readlines(size_t size, string eol)
 	ScopedReadLock lock(this->pimpl_);
 	std::vector<std::string> lines;
 	size_t eol_len = eol.length();
-	uint8_t *buffer_ = static_cast<uint8_t*>
-		(alloca(size * sizeof(uint8_t)));
 	size_t read_so_far = 0;
-	size_t start_of_line = 0;
 	while (read_so_far < size) {
-		size_t bytes_read = this->read_(buffer_ + read_so_far, 1);
-		read_so_far += bytes_read;
-		if (bytes_read == 0) {
-			if (start_of_line != read_so_far) {
-				lines.push_back(
-					string(reinterpret_cast<const char*> (buffer_ + start_of_line),
-						read_so_far - start_of_line));
-			}
-			break; // Timeout occured on reading 1 byte
-		}
-		if (string(reinterpret_cast<const char*>
-			(buffer_ + read_so_far - eol_len), eol_len) == eol) {
-			// EOL found
-			lines.push_back(
-				string(reinterpret_cast<const char*> (buffer_ + start_of_line),
-					read_so_far - start_of_line));
-			start_of_line = read_so_far;
+		const char *line;
+		size_t line_len = this->readline_(line, size - read_so_far, eol);
+		if (line_len == 0) {
+			break; // Timeout occured with no data
 		}
-		if (read_so_far == size) {
-			if (start_of_line != read_so_far) {
-				lines.push_back(
-					string(reinterpret_cast<const char*> (buffer_ + start_of_line),
-						read_so_far - start_of_line));
-			}
-			break; // Reached the maximum read length
+		lines.push_back(string(line, line_len));
+		read_so_far += line_len;
+		if (line_len < eol_len ||
+			memcmp(line + line_len - eol_len, eol.data(), eol_len) != 0) {
+			break; // Timeout occured or maximum read length in the middle of a line
 		}
 	}
 	return lines;
@@ -360,6 +415,7 @@ void Serial::flush ()
 void Serial::flushInput ()
 {
   ScopedReadLock lock(this->pimpl_);
+  rx_begin_ = rx_end_ = 0;
   pimpl_->flushInput ();
 }
 
@@ -169,6 +169,18 @@ Labonatip_GUI::Labonatip_GUI(QMainWindow *parent) :
 	  SLOT(updateGUI()));
   m_update_GUI->start();
 
+  // when the PPC1 is running, the GUI is updated as new samples arrive, 
+  // and the timer is slowed down to a fallback in case the stream stalls (see disCon)
+  // the callback runs in the PPC1 thread, only one update at a time is queued in the GUI thread
+  m_gui_update_pending = false;
+  m_ppc1_subscription = m_ppc1->subscribe(
+	  fluicell::PPC1dataStructures::PPC1_event::newSample | 
+	  fluicell::PPC1dataStructures::PPC1_event::exception,
+	  [this](const fluicell::PPC1dataStructures::PPC1_event &_event) {
+	  if (!m_gui_update_pending.exchange(true))
+		  QMetaObject::invokeMethod(this, "updateGUI", Qt::QueuedConnection);
+  });
+
   connect(m_update_waste,
 	  SIGNAL(timeout()), this,
 	  SLOT(updateWaste()));
@@ -1549,6 +1561,8 @@ bool Labonatip_GUI::openXml(QString _filename, QTreeWidget* _widget)
 }
 Labonatip_GUI::~Labonatip_GUI()
 {
+  // no more GUI updates from the PPC1 thread while the members are deleted
+  m_ppc1->unsubscribe(m_ppc1_subscription);
   delete qout;
   delete qerr;
   delete m_comSettings;
@@ -14,6 +14,7 @@
 // standard libraries
 #include <iostream>
 #include <string>
+#include <atomic>
 
 // autogenerated form header
 #include "ui_Lab-on-a-tip.h"
@@ -1057,6 +1058,8 @@ private:
 
   // for serial communication with PPC1 API
   fluicell::PPC1api *m_ppc1;  //!< object for the PPC1api connection
+  int m_ppc1_subscription;    //!< subscription to the PPC1 new samples, they trigger the GUI update
+  std::atomic<bool> m_gui_update_pending;  //!< true if an updateGUI is already queued, avoid flooding the event loop
   std::vector<fluicell::PPC1dataStructures::command> *m_protocol;   //!< this is the current protocol to run
 
   bool m_pipette_active;    //!< true when the pipette is active and communicating, false otherwise
@@ -30,9 +30,10 @@ void Labonatip_GUI::updatePonSetPoint(double _pon_set_point)
 	ui->label_PonPressure->setText(QString(
 		QString::number(int(_pon_set_point)) + " mbar    "));
 
-	// if the pipette is active we send the set point to the device
+	// if the pipette is active we send the set point to the device,
+	// only the newest value is sent while the slider is moving
 	if (m_pipette_active) {
-		m_ppc1->setPressureChannelD(_pon_set_point);
+		m_ppc1->setChannelCoalesced(fluicell::PPC1dataStructures::PPC1_data::channel_D, _pon_set_point);
 	}
 
 	// update the slider for the GUI
@@ -70,7 +71,7 @@ void Labonatip_GUI::updatePoffSetPoint(double _poff_set_point)
 
 	// if the pipette is active we send the set point to the device
 	if (m_pipette_active) {
-		m_ppc1->setPressureChannelC(_poff_set_point);
+		m_ppc1->setChannelCoalesced(fluicell::PPC1dataStructures::PPC1_data::channel_C, _poff_set_point);
 	}
 
 	// update the slider for the GUI
@@ -105,7 +106,7 @@ void Labonatip_GUI::updateVrecircSetPoint(double _v_recirc_set_point)
 
 	// if the pipette is active we send the set point to the device
 	if (m_pipette_active) {
-		m_ppc1->setVacuumChannelA(-_v_recirc_set_point);
+		m_ppc1->setChannelCoalesced(fluicell::PPC1dataStructures::PPC1_data::channel_A, -_v_recirc_set_point);
 	}
 
 	// update the slider for the GUI
@@ -140,7 +141,7 @@ void Labonatip_GUI::updateVswitchSetPoint(double _v_switch_set_point)
 
 	// if the pipette is active we send the set point to the device
 	if (m_pipette_active) {
-		m_ppc1->setVacuumChannelB(-_v_switch_set_point);
+		m_ppc1->setChannelCoalesced(fluicell::PPC1dataStructures::PPC1_data::channel_B, -_v_switch_set_point);
 	}
 
 	// update the slider for the GUI
@@ -579,72 +579,20 @@ void Labonatip_GUI::changeVacuumPercentageBy(double _perc)
 
 void Labonatip_GUI::buildDPmap()
 {
-
-	// the row is: pon poff vs vr zs fs
-	// zs = zone size
-	// fs = flow speed
-	typedef std::vector<double> DP_row;
-	typedef std::vector<DP_row> DP_table;
-
-	DP_table table;
-
-	QFile tableFile("./table.txt");
-	QTextStream stream(&tableFile);
-	QString header;
-	header = "pon poff vs vr zs fs\n";
-	if (tableFile.open(QIODevice::WriteOnly))
-	{
-	stream << header;
-
-	//for (int pon_idx = 0; pon_idx < MAX_CHAN_D; pon_idx++)
-	for (int pon_idx = 170; pon_idx < 220; pon_idx++)
-	{
-		updatePonSetPoint(pon_idx);
-
-		//for (int poff_idx = 0; poff_idx < MAX_CHAN_C; poff_idx++)
-		for (int poff_idx = 15; poff_idx < 30; poff_idx++)
-		{
-			updatePoffSetPoint(poff_idx);
-
-			//for (int vs_idx = 0; vs_idx > MIN_CHAN_B; vs_idx--)
-			for (int vs_idx = -100; vs_idx > -130; vs_idx--)
-			{
-				updateVswitchSetPoint(-vs_idx);
-
-				//for (int vr_idx = 0; vr_idx > MIN_CHAN_A; vr_idx--)
-				for (int vr_idx = -100; vr_idx > -130; vr_idx--)
-				{
-					updateVrecircSetPoint(-vr_idx);
-
-					//updateFlowControlPercentages();
-
-					DP_row new_row;
-					new_row.push_back(pon_idx);
-					new_row.push_back(poff_idx);
-					new_row.push_back(vs_idx);
-					new_row.push_back(vr_idx);
-					new_row.push_back(m_ds_perc);
-					new_row.push_back(m_fs_perc);
-
-					table.push_back(new_row);
-
-					if (m_ds_perc > 0 && m_ds_perc < 500 &&
-						m_fs_perc > 0 && m_fs_perc < 500)
-					{
-						stream << pon_idx << " "
-							<< poff_idx << " "
-							<< vs_idx << " "
-							<< vr_idx << " "
-							<< m_ds_perc << " "
-							<< m_fs_perc << " " << endl;
-					}
-					//QThread::msleep(100);
-				}
-			}
-		}
-
-	}
-
+	// the map is built by the API with the flow model of the current tip, 
+	// for each point (pon poff vs vr) the file contains zone size and flow speed
+	fluicell::PPC1dataStructures::operatingMapRange range;
+	range.setAxis(range.pon, 170.0, 219.0, 1.0);
+	range.setAxis(range.poff, 15.0, 29.0, 1.0);
+	range.setAxis(range.v_switch, -129.0, -100.0, 1.0);
+	range.setAxis(range.v_recirc, -129.0, -100.0, 1.0);
+
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	bool success = m_ppc1->buildOperatingMap(range, "./table.bin");
+	QApplication::restoreOverrideCursor();
+	if (!success) {
+		QMessageBox::information(this, m_str_warning,
+			m_str_operation_cannot_be_done);
 	}
 }
 
@@ -277,6 +277,7 @@ void Labonatip_GUI::runProtocol() {
 			&Labonatip_macroRunner::changeVacuumSIG, this,
 			&Labonatip_GUI::changeVacuumPercentageBy);
 
+		m_macroRunner_thread->resetKill();
 		m_macroRunner_thread->start();
 
 		ui->groupBox_deliveryZone->setEnabled(false);
@@ -52,7 +52,7 @@ void Labonatip_macroRunner::switchLanguage(QString _translation_file)
 	}
 }
 
-void Labonatip_macroRunner::simulateCommand(fluicell::PPC1dataStructures::command _cmd)
+void Labonatip_macroRunner::simulateCommand(const fluicell::PPC1dataStructures::command &_cmd)
 {
 
 	int ist = _cmd.getInstruction();
@@ -103,8 +103,7 @@ void Labonatip_macroRunner::simulateCommand(fluicell::PPC1dataStructures::comman
 		return;
 	}
 	case pCmd::wait: {//sleep
-		int val = static_cast<int>(_cmd.getValue());
-		simulateWait(val);
+		// waits are part of the scheduler time line
 		return;
 	}
 	case pCmd::ask_msg: {//ask_msg
@@ -112,7 +111,8 @@ void Labonatip_macroRunner::simulateCommand(fluicell::PPC1dataStructures::comman
 		emit sendAskMessage(msg); // send ask message event
 		m_ask_ok = false;
 		while (!m_ask_ok) {  // wait until the signal ok is pressed on the GUI
-			msleep(500);
+			if (!m_stop_token.sleepFor(std::chrono::milliseconds(100)))
+				return;
 		}
 		return;
 	}
@@ -171,179 +171,128 @@ void Labonatip_macroRunner::simulateCommand(fluicell::PPC1dataStructures::comman
 }
 
 
-void Labonatip_macroRunner::simulateWait(int _sleep_for)
-{
-	const qint64 kInterval = 1000;
-	qint64 mtime = QDateTime::currentMSecsSinceEpoch();
-	for (int j = 0; j < _sleep_for; j++) {
-		// visualize step time left 
-		m_time_left_for_step = _sleep_for - j;
-		mtime += kInterval;
-		qint64 sleepFor = mtime - QDateTime::currentMSecsSinceEpoch();
-		if (sleepFor < 0) {
-			sleepFor = kInterval - ((-sleepFor) % kInterval);
-		}
-		msleep(sleepFor);// (m_macro->at(i).Duration);					
-		m_time_elapsed = m_time_elapsed + 1.0;
-		double status = 100.0 * m_time_elapsed / m_protocol_duration;
-
-		// send the time status to the GUI
-		emit timeStatus(status);
-
-		// stop the wait function in case of thread termination handler
-		if (!m_threadTerminationHandler) {
-			//QString result = m_str_stopped;
-			emit resultReady(m_str_stopped);
-			return;
-		}
-	}
-
-}
-
-
 void Labonatip_macroRunner::run() 
 {
 	std::cout << HERE << std::endl;
 	
 	QString result;
-	m_threadTerminationHandler = true;
 
-	//main thread
-	try
+	// the ppc1api and protocol must be initialized 
+	if (!m_ppc1 || !m_protocol)
 	{
-		// the ppc1api and protocol must be initialized 
-		if (m_ppc1 && m_protocol)
-		{
-			std::cout << HERE  << " protocol size " << m_protocol->size() << std::endl;
-
-			// compute the duration of the macro
-			m_protocol_duration = m_ppc1->protocolDuration(*m_protocol);
-			m_time_elapsed = 0.0;
-
-			// for all the commands in the protocol
-			for (size_t i = 0; i < m_protocol->size(); i++)
-			{
-				// if we get the terminationHandler the thread is stopped
-				if (!m_threadTerminationHandler) {
-					result = m_str_stopped; 
-					emit resultReady(result);
-					return;
-				}
-
-				if (m_simulation_only)
-				{
-					// in simulation we set the status message
-					QString message = QString::fromStdString(m_protocol->at(i).getStatusMessage());
-					message.append(" >>> command :  ");
-					message.append(QString::fromStdString(m_protocol->at(i).getCommandAsString()));
-					message.append(" value ");
-					message.append(QString::number(m_protocol->at(i).getValue()));
-					message.append(" status message ");
-					message.append(QString::fromStdString(m_protocol->at(i).getStatusMessage()));
-					emit sendStatusMessage(message);
-
-					// the command is simulated
-					simulateCommand(m_protocol->at(i));
-
-				}// end simulation only
-				else {
-					// if we are not in simulation and the ppc1 is running 
-					// the commands will be sent to the ppc1 api
-					if (m_ppc1->isRunning()) {
-						
-						// at GUI level only ask_msg and wait are handled
-						if (m_protocol->at(i).getInstruction() ==
-							pCmd::ask_msg) {
-							QString msg = QString::fromStdString(m_protocol->at(i).getStatusMessage());
-
-							emit sendAskMessage(msg); // send ask message event
-							m_ask_ok = false;
-							while (!m_ask_ok) {  // wait until the signal ok is pressed on the GUI
-								msleep(500);
-							}
-						}
-
-						// If the command is to wait, we do it here
-						if (m_protocol->at(i).getInstruction() == pCmd::wait) 
-						{	
-							int val = static_cast<int>(m_protocol->at(i).getValue());
-							simulateWait(val);							
-						}//TODO: the waitSync works properly in the ppc1api, however, when the command is run
-						 //      the ppc1api stops waiting for the signal and the GUI looks freezing without any message
-						//if (m_protocol->at(i).getInstruction() == // If the command is to wait, we do it here
-						//	pCmd::waitSync) {
-
-						//	emit sendAskMessage("wait sync will run now another message will appear when the sync signal is detected");
-						//	if (!m_ppc1->runCommand(m_protocol->at(i))) // otherwise we run the actual command on the PPC1 
-						//	{
-						//		cerr << HERE 
-						//			<< " ---- error --- MESSAGE:"
-						//			<< " error in ppc1api PPC1api::runCommand" << endl;
-						//	}
-						//	emit sendAskMessage("sync arrived");
-						//}
-						else {
-							if (!m_ppc1->runCommand(m_protocol->at(i))) // otherwise we run the actual command on the PPC1 
-							{
-								std::cerr << HERE << " ---- error --- MESSAGE:"
-									<< " error in ppc1api PPC1api::runCommand" << std::endl;
-							}
-						}
-					}
-					else {
-						std::cerr << HERE << "  ---- error --- MESSAGE:"
-							 << " ppc1 is NOT running " << std::endl;
-
-						result = m_str_not_connected; 
-						emit resultReady(result);
-						return;
-					}
-				}
-			}//end for protocol
+		std::cerr << HERE << "  ---- error --- MESSAGE: null pointer " << std::endl;
+		result = m_str_failed; 
+		emit resultReady(result);
+		return;
+	}
+	if (!m_simulation_only && !m_ppc1->isRunning()) {
+		std::cerr << HERE << "  ---- error --- MESSAGE:"
+			<< " ppc1 is NOT running " << std::endl;
+		result = m_str_not_connected; 
+		emit resultReady(result);
+		return;
+	}
+
+	std::cout << HERE  << " protocol size " << m_protocol->size() << std::endl;
+
+	// compute the duration of the macro
+	m_protocol_duration = m_ppc1->protocolDuration(*m_protocol);
+	m_time_elapsed = 0.0;
+
+	// the scheduler runs the commands on absolute deadlines, the waits are part 
+	// of the time line, so the protocol ends on time however long it is
+	std::atomic<bool> failed(false);
+	fluicell::protocolScheduler scheduler;
+	scheduler.start(*m_protocol, 
+		[this, &failed](const fluicell::PPC1dataStructures::command &_cmd) -> bool {
+		try {
+			return runCommand(_cmd);
 		}
-		else {
-			std::cerr << HERE << "  ---- error --- MESSAGE: null pointer " << std::endl;
-			result = m_str_failed; 
+		catch (std::exception &e) {
+			std::cerr << HERE << " Exception : " << e.what() << std::endl;
+			failed = true;
+			return false;
+		}
+	}, fluicell::protocolScheduler::stepCallback(), m_stop_token);
 
+	// the time status is sent to the GUI while the protocol runs 
+	while (scheduler.isRunning())
+	{
+		m_stop_token.sleepFor(std::chrono::milliseconds(100));  // wakes up at once on kill
+		m_time_left_for_step = static_cast<int>(std::ceil(scheduler.getTimeLeftForStep()));
+		m_time_elapsed = scheduler.getElapsed();
+		if (m_protocol_duration > 0.0)
+			emit timeStatus(100.0 * m_time_elapsed / m_protocol_duration);
+
+		// if we get the terminationHandler the thread is stopped
+		if (!m_threadTerminationHandler) {
+			result = m_str_stopped;
+		}
+		else if (failed) {
+			result = m_str_failed;
+		}
+		else if (!m_simulation_only && !m_ppc1->isRunning()) {
+			std::cerr << HERE << "  ---- error --- MESSAGE:"
+				<< " ppc1 is NOT running " << std::endl;
+			result = m_str_not_connected;
+		}
+		if (!result.isEmpty()) {
+			scheduler.stop();
+			scheduler.wait();
 			emit resultReady(result);
 			return;
 		}
-		result = m_str_success; 
-		emit resultReady(result);
+	}
+	scheduler.wait();
 
-		return;
+	std::cout << HERE << " protocol completed, maximum lateness " 
+		<< scheduler.getMaxLateness() << " ms" << std::endl;
 
-	}
-	catch(serial::IOException &e)
+	result = failed ? m_str_failed : m_str_success;
+	emit resultReady(result);
+}
+
+
+bool Labonatip_macroRunner::runCommand(const fluicell::PPC1dataStructures::command &_cmd)
+{
+	if (m_simulation_only)
 	{
-		std::cerr << HERE << " IOException : " << e.what() << std::endl;
-		//m_ppc1->disconnectCOM();
-		result = m_str_failed; 
-		emit resultReady(result);
-		return;
+		// in simulation we set the status message
+		QString message = QString::fromStdString(_cmd.getStatusMessage());
+		message.append(" >>> command :  ");
+		message.append(QString::fromStdString(_cmd.getCommandAsString()));
+		message.append(" value ");
+		message.append(QString::number(_cmd.getValue()));
+		message.append(" status message ");
+		message.append(QString::fromStdString(_cmd.getStatusMessage()));
+		emit sendStatusMessage(message);
+
+		// the command is simulated
+		simulateCommand(_cmd);
+		return true;
 	}
-	catch (serial::PortNotOpenedException &e)
-	{
-		std::cerr << HERE << " PortNotOpenedException : " << e.what() << std::endl;
-		//m_PPC1_serial->close();
-		result = m_str_failed; 
-		emit resultReady(result);
-		return;
+
+	// at GUI level only ask_msg is handled
+	if (_cmd.getInstruction() == pCmd::ask_msg) {
+		QString msg = QString::fromStdString(_cmd.getStatusMessage());
+
+		emit sendAskMessage(msg); // send ask message event
+		m_ask_ok = false;
+		while (!m_ask_ok) {  // wait until the signal ok is pressed on the GUI
+			if (!m_stop_token.sleepFor(std::chrono::milliseconds(100)))
+				return false;
+		}
+		return true;
 	}
-	catch (serial::SerialException &e)
+
+	// otherwise we run the actual command on the PPC1, the stop token ends the waits at once
+	if (m_stop_token.stopRequested())
+		return false;
+	if (!m_ppc1->runCommand(_cmd, m_stop_token)) 
 	{
-		std::cerr << HERE << " SerialException : " << e.what() << std::endl;
-		//m_PPC1_serial->close();
-		result = m_str_failed; 
-		emit resultReady(result);
-		return;
+		std::cerr << HERE << " ---- error --- MESSAGE:"
+			<< " error in ppc1api PPC1api::runCommand" << std::endl;
+		return false;
 	}
-	catch (std::exception &e) {
-		std::cerr << HERE << " Unhandled Exception: " << e.what() << std::endl;
-		//m_PPC1_serial->close();
-		result = m_str_failed; 
-		emit resultReady(result);
-		return;
-	}
-	
-}
\ No newline at end of file
+	return true;
+}
@@ -14,6 +14,8 @@
 // standard libraries
 #include <iostream>
 #include <string>
+#include <atomic>
+#include <cmath>
 
 // Qt
 #include <QMainWindow>
@@ -27,6 +29,7 @@
 
 // PPC1api 
 #include <fluicell/ppc1api/ppc1api.h>
+#include <fluicell/ppc1api/ppc1api_scheduler.h>
 
 class Labonatip_macroRunner : public  QThread
 {
@@ -44,9 +47,20 @@ public:
 	
 	void setProtocol(std::vector<fluicell::PPC1dataStructures::command> *_protocol) { m_protocol = _protocol; };
 
+	/** \brief Clear the kill of the last run, called by the GUI thread before start
+	*
+	*   run never replaces the token, so a kill right after start is not lost
+	**/
+	void resetKill() {
+		m_threadTerminationHandler = true;
+		m_stop_token = fluicell::stopToken();  // a new token for each run
+	}
+
 	void killMacro(bool _kill) {
-		m_ppc1->resetSycnSignals(true);  // makes sure that the waitSync command stops
-		m_threadTerminationHandler = !_kill; }
+		m_threadTerminationHandler = !_kill; 
+		if (_kill)
+			m_stop_token.requestStop();  // wakes up the scheduler and the command running
+	}
 
 	void setSimulationFlag(bool _sim_flag){ m_simulation_only = _sim_flag; }
 
@@ -83,14 +97,15 @@ signals:
 private: 
 	
 	void initCustomStrings();
-	void simulateCommand(fluicell::PPC1dataStructures::command _cmd);
-	void simulateWait(int _sleep_for);
+	void simulateCommand(const fluicell::PPC1dataStructures::command &_cmd);
+	bool runCommand(const fluicell::PPC1dataStructures::command &_cmd);  //!< run one step, called by the scheduler thread
 	
 
 	fluicell::PPC1api *m_ppc1;                            //!< pointer to the device to run the protocol 
 	std::vector<fluicell::PPC1dataStructures::command> *m_protocol;  //!< protocol to run
 	bool m_simulation_only;                               //!< true if simulation, false use the PPC1
 	bool m_threadTerminationHandler;                      //!< true to terminate the macro
+	fluicell::stopToken m_stop_token;                     //!< stop request of the protocol running, see killMacro
 	bool m_ask_ok;                                        //!< false when a message dialog is out, true to continue
 	int m_time_left_for_step;                             //!< time left for the current step
 	double m_protocol_duration;
@@ -354,6 +354,8 @@ bool Labonatip_GUI::disCon(bool _connect)
 				if (m_ppc1->isRunning()) {  // if running, everything is fine
 					m_pipette_active = true;
 					ui->actionConnectDisconnect->setChecked(true);
+					// the GUI is now updated by the PPC1 samples, the timer only refreshes it if the stream stalls
+					m_update_GUI->setInterval(m_base_time_step);
 					m_update_GUI->start();
 					this->setStatusLed(true);
 					ui->status_PPC1_label->setText(m_str_PPC1_status_con);
@@ -418,6 +420,9 @@ bool Labonatip_GUI::disCon(bool _connect)
 				ui->status_PPC1_label->setText(m_str_PPC1_status_discon);
 				ui->actionConnectDisconnect->setText(m_str_connect);
 				m_pipette_active = false;
+				// no more samples from the PPC1, back to the fast timer
+				m_update_GUI->setInterval(10);
+				m_update_GUI->start();
 				ui->actionSimulation->setEnabled(true);
 				ui->groupBox_action->setEnabled(false);
 				ui->groupBox_deliveryZone->setEnabled(false);
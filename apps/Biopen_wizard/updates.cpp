@@ -16,6 +16,8 @@
 
 void Labonatip_GUI::updateGUI() {
 
+	m_gui_update_pending = false;
+
 	if (isExceptionTriggered()) return;
 
 	// all the following update functions are for GUI only, 
@@ -44,29 +46,32 @@ void Labonatip_GUI::updatePressureVacuum()
 
 		// if we are here it means that we have no exception 
 
+		// all the values shown come from the same frame
+		const fluicell::PPC1dataStructures::PPC1_sample sample = m_ppc1->getLastSample();
+
 		// for all pressures/vacuum, 
 		// get the sensor reading ( rounded to second decimal?)
-		int sensor_reading = (int)(m_ppc1->getVswitchReading());
+		int sensor_reading = (int)(sample.channels[1].sensor_reading);
 		// update status, label and bar
-		m_pipette_status->v_switch_set_point = -m_ppc1->getVswitchSetPoint();
+		m_pipette_status->v_switch_set_point = -sample.channels[1].set_point;
 		ui->label_switchPressure->setText(QString(QString::number(sensor_reading) +
 			", " + QString::number(int(-m_pipette_status->v_switch_set_point)) + " mbar    "));
 		ui->progressBar_switch->setValue(-sensor_reading);
 
-		sensor_reading = (int)(m_ppc1->getVrecircReading());
-		m_pipette_status->v_recirc_set_point = -m_ppc1->getVrecircSetPoint();
+		sensor_reading = (int)(sample.channels[0].sensor_reading);
+		m_pipette_status->v_recirc_set_point = -sample.channels[0].set_point;
 		ui->label_recircPressure->setText(QString(QString::number(sensor_reading) +
 			", " + QString::number(int(-m_pipette_status->v_recirc_set_point)) + " mbar    "));
 		ui->progressBar_recirc->setValue(-sensor_reading);
 
-		sensor_reading = (int)(m_ppc1->getPoffReading());
-		m_pipette_status->poff_set_point = m_ppc1->getPoffSetPoint();
+		sensor_reading = (int)(sample.channels[2].sensor_reading);
+		m_pipette_status->poff_set_point = sample.channels[2].set_point;
 		ui->label_PoffPressure->setText(QString(QString::number(sensor_reading) +
 			", " + QString::number(int(m_pipette_status->poff_set_point)) + " mbar    "));
 		ui->progressBar_pressure_p_off->setValue(sensor_reading);
 
-		sensor_reading = (int)(m_ppc1->getPonReading());
-		m_pipette_status->pon_set_point = m_ppc1->getPonSetPoint();
+		sensor_reading = (int)(sample.channels[3].sensor_reading);
+		m_pipette_status->pon_set_point = sample.channels[3].set_point;
 		ui->label_PonPressure->setText(QString(QString::number(sensor_reading) +
 			", " + QString::number(int(m_pipette_status->pon_set_point)) + " mbar    "));
 		ui->progressBar_pressure_p_on->setValue(sensor_reading);
@@ -369,8 +374,11 @@ void Labonatip_GUI::updatePPC1Leds()
 
 		if (m_ppc1->isRunning())
 		{
+			// all the values come from the same frame
+			const fluicell::PPC1dataStructures::PPC1_sample sample = m_ppc1->getLastSample();
+
 			// the first is the communication state in the main GUI
-			if (m_ppc1->getCommunicationState() == true) {
+			if (sample.data_corrupted == false) {
 				//this->setStatusLed(true);
 				//TODO: here the led are redrawn constantly causing a waste of performance
 				//this->setLedColor(ui->status_PPC1_led, led_green);
@@ -390,13 +398,13 @@ void Labonatip_GUI::updatePPC1Leds()
 			}
 
 			// update LED for Pon
-			if (m_ppc1->getPonState() == 0) {
+			if (sample.channels[3].state == 0) {
 				
 				pon_bar_led->setColor(QFled::ColorType::green);
 				//this->setLedColor(ui->label_led_pon, led_green);
 				//ui->label_led_pon->setPixmap(*led_green);
-				if (std::abs(m_ppc1->getPonReading() - m_ppc1->getPonSetPoint()) >
-					0.1 * m_ppc1->getPonSetPoint() + 3)
+				if (std::abs(sample.channels[3].sensor_reading - sample.channels[3].set_point) >
+					0.1 * sample.channels[3].set_point + 3)
 				{
 					pon_bar_led->setColor(QFled::ColorType::orange);
 					//this->setLedColor(ui->label_led_pon, led_orange);
@@ -410,12 +418,12 @@ void Labonatip_GUI::updatePPC1Leds()
 			}
 
 			// update LED for Poff
-			if (m_ppc1->getPoffState() == 0) {
+			if (sample.channels[2].state == 0) {
 				poff_bar_led->setColor(QFled::ColorType::green);
 				//this->setLedColor(ui->label_led_poff, led_green);
 				//ui->label_led_poff->setPixmap(*led_green);
-				if (std::abs(m_ppc1->getPoffReading() - m_ppc1->getPoffSetPoint()) >
-					0.1*m_ppc1->getPoffSetPoint() + 3)
+				if (std::abs(sample.channels[2].sensor_reading - sample.channels[2].set_point) >
+					0.1*sample.channels[2].set_point + 3)
 				{
 					poff_bar_led->setColor(QFled::ColorType::orange);
 					//this->setLedColor(ui->label_led_poff, led_orange);
@@ -429,12 +437,12 @@ void Labonatip_GUI::updatePPC1Leds()
 			}
 
 			// update LED for Vswitch
-			if (m_ppc1->getVswitchState() == 0) {
+			if (sample.channels[1].state == 0) {
 				vs_bar_led->setColor(QFled::ColorType::green);
 				//this->setLedColor(ui->label_led_vs, led_green);
 				//ui->label_led_vs->setPixmap(*led_green);
-				if (std::abs(m_ppc1->getVswitchReading() - m_ppc1->getVswitchSetPoint()) >
-					-0.1*m_ppc1->getVswitchSetPoint() + 3)
+				if (std::abs(sample.channels[1].sensor_reading - sample.channels[1].set_point) >
+					-0.1*sample.channels[1].set_point + 3)
 				{
 					vs_bar_led->setColor(QFled::ColorType::orange);
 					//this->setLedColor(ui->label_led_vs, led_orange);
@@ -448,14 +456,14 @@ void Labonatip_GUI::updatePPC1Leds()
 			}
 
 			// update LED for Vrecirc
-			if (m_ppc1->getVrecircState() == 0) {
+			if (sample.channels[0].state == 0) {
 				vr_bar_led->setColor(QFled::ColorType::green);
 				//this->setLedColor(ui->label_led_vr, led_green);
 				//ui->label_led_vr->setPixmap(*led_green);
-				double as = m_ppc1->getVrecircReading();
-				double ad = m_ppc1->getVrecircSetPoint();
-				if (std::abs(m_ppc1->getVrecircReading() - m_ppc1->getVrecircSetPoint()) >
-					-0.1*m_ppc1->getVrecircSetPoint() + 3)
+				double as = sample.channels[0].sensor_reading;
+				double ad = sample.channels[0].set_point;
+				if (std::abs(sample.channels[0].sensor_reading - sample.channels[0].set_point) >
+					-0.1*sample.channels[0].set_point + 3)
 				{
 					vr_bar_led->setColor(QFled::ColorType::orange);
 					//this->setLedColor(ui->label_led_vr, led_orange);
@@ -519,23 +527,24 @@ void Labonatip_GUI::updateFlows()
 	// otherwise the flows will be calculated according to the current values
 	if (!m_simulationOnly)
 	{ 
-		const fluicell::PPC1dataStructures::PPC1_status *status = m_ppc1->getPipetteStatus();
-		m_pipette_status->outflow_on = status->outflow_on;
-		m_pipette_status->outflow_off = status->outflow_off;
-		m_pipette_status->outflow_tot = status->outflow_tot;
-		m_pipette_status->inflow_recirculation = status->inflow_recirculation;
-		m_pipette_status->inflow_switch = status->inflow_switch;
-		m_pipette_status->in_out_ratio_on = status->in_out_ratio_on;
-		m_pipette_status->in_out_ratio_off = status->in_out_ratio_off;
-		m_pipette_status->in_out_ratio_tot = status->in_out_ratio_tot;
-		m_pipette_status->flow_well1 = status->flow_rate_1;
-		m_pipette_status->flow_well2 = status->flow_rate_2;
-		m_pipette_status->flow_well3 = status->flow_rate_3;
-		m_pipette_status->flow_well4 = status->flow_rate_4;
-		m_pipette_status->flow_well5 = status->flow_rate_5;
-		m_pipette_status->flow_well6 = status->flow_rate_6;
-		m_pipette_status->flow_well7 = status->flow_rate_7;
-		m_pipette_status->flow_well8 = status->flow_rate_8;
+		typedef fluicell::PPC1dataStructures::PPC1_status ppc1Status;
+		const ppc1Status status = m_ppc1->getPipetteStatus();
+		m_pipette_status->outflow_on = status.flows[ppc1Status::outflow_on];
+		m_pipette_status->outflow_off = status.flows[ppc1Status::outflow_off];
+		m_pipette_status->outflow_tot = status.flows[ppc1Status::outflow_tot];
+		m_pipette_status->inflow_recirculation = status.flows[ppc1Status::inflow_recirculation];
+		m_pipette_status->inflow_switch = status.flows[ppc1Status::inflow_switch];
+		m_pipette_status->in_out_ratio_on = status.flows[ppc1Status::in_out_ratio_on];
+		m_pipette_status->in_out_ratio_off = status.flows[ppc1Status::in_out_ratio_off];
+		m_pipette_status->in_out_ratio_tot = status.flows[ppc1Status::in_out_ratio_tot];
+		m_pipette_status->flow_well1 = status.getFlowRate(1);
+		m_pipette_status->flow_well2 = status.getFlowRate(2);
+		m_pipette_status->flow_well3 = status.getFlowRate(3);
+		m_pipette_status->flow_well4 = status.getFlowRate(4);
+		m_pipette_status->flow_well5 = status.getFlowRate(5);
+		m_pipette_status->flow_well6 = status.getFlowRate(6);
+		m_pipette_status->flow_well7 = status.getFlowRate(7);
+		m_pipette_status->flow_well8 = status.getFlowRate(8);
 	}
 	else {
 		// calculate inflow
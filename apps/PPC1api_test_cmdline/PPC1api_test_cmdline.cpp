@@ -68,13 +68,11 @@ int	main (int argc, char** argv)
 	std::cout<<"\n >>>  PCC1api_test_cmdline 2017  <<< \n\n"<<std::endl;
 
 
-	// test for the string
+	/* this is a test for data lines and broken messages
 	string data;
-	vector<double> line;
-	vector<double> line_2;
-
+	std::array<double, 4> line;
+	std::array<double, 4> line_2;
 
-	/* this is a test for data lines and broken messages
 	data = "A|-0.000000|0.114514|0.000000|0\n";
 
 	my_ppc1->decodeChannelLine(data, line);
@@ -88,7 +86,6 @@ int	main (int argc, char** argv)
 	data.clear();
 
 	data = "A|-0.200000|12.114514|0.003000|0\n";
-	line.clear();
 
 	my_ppc1->decodeChannelLine(data, line);
 
@@ -36,11 +36,27 @@
 #include <ctime>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <array>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <future>
 
 // third party serial library
 #include <serial/serial.h>
+#if !defined(_WIN32)
+#include <serial/reactor.h>
+#endif
 
 #include "ppc1api_data_structures.h"
+#include "ppc1api_ring_buffer.h"
+#include "ppc1api_seqlock.h"
+#include "ppc1api_filter.h"
+#include "ppc1api_command_batch.h"
+#include "ppc1api_stop_token.h"
 
 /**  \brief Define the Fluicell namespace, all the classes will be in here
   *  
@@ -125,6 +141,7 @@ namespace fluicell
 	*       -   to stop the thread :     my_ppc1->stop();
 	*	    -   disconnect the device :  my_ppc1->disconnectCOM();
 	*
+	*  Several devices can share one I/O thread, see PPC1manager
 	*
 	* <b>Changes history</b>
 	*		- MAY/2017: Creation (MB).
@@ -132,8 +149,41 @@ namespace fluicell
 	*/
 	class PPC1api 
 	{
+		friend class PPC1manager;  // drives the devices on a shared reactor
 
 	public:
+
+		typedef std::array<fluicell::readingFilter::settings, 4> filterSettings;  //!< filter settings for the channels A, B, C, D
+
+		/** \brief Ring buffer of the samples received from the PPC1, see createSampleReader
+		*/
+		typedef fluicell::ringBuffer<fluicell::PPC1dataStructures::PPC1_sample, 1024> sampleBuffer;
+
+		/** \brief Cursor of a reader of the samples buffer
+		*/
+		typedef sampleBuffer::reader sampleReader;
+
+		/** \brief Function called on events, see subscribe
+		*/
+		typedef std::function<void(const fluicell::PPC1dataStructures::PPC1_event &)> eventCallback;
+
+		/** \brief Where the event callbacks are executed
+		*/
+		enum dispatchMode {
+			dispatchDirect = 0,   //!< in the PPC1api thread as soon as the event happens
+			dispatchQueued = 1    //!< in the thread calling dispatchEvents
+		};
+
+		/** \brief Function called when a queued write is done, true if the data were written
+		*/
+		typedef std::function<void(bool)> writeCallback;
+
+		/** \brief Lanes of the writer thread, see sendDataAsync
+		*/
+		enum writePriority {
+			normalPriority = 0,   //!< commands in order of arrival
+			safetyPriority = 1    //!< written before any normal command, used to stop the PPC1
+		};
 	
 		/** \brief Constructor, initialize objects and parameters using default values
 		*        
@@ -155,6 +205,90 @@ namespace fluicell
 		*/
 		void threadSerial();
 
+		/** \brief Decode one complete line of the data stream, called by the I/O thread
+		*/
+		void processLine(const std::string &_data);
+
+		/** \brief Hand a line over to getDeviceID, called by the I/O thread
+		*
+		*  \return false if getDeviceID is not waiting for the reply
+		*/
+		bool replyDeviceID(const std::string &_data);
+
+		/** \brief Add a piece of line read from the port to m_line_buffer
+		*
+		*  @param _piece  data up to the first \n included, at most m_max_line_length - m_line_buffer.size() bytes
+		*  @param _size   size of the piece
+		*  @param _out_data  the complete line
+		*
+		*  \return true if a line is complete, false if more data are needed or the line was dropped
+		*/
+		bool appendLinePiece(const char *_piece, size_t _size, std::string &_out_data);
+
+		/** \brief End the stream on a serial error, the port is closed and the subscribers notified
+		*/
+		void stopOnException(const std::string &_message);
+
+		/** \brief Stop the serial thread and wait for it, nothing is sent to the PPC1
+		*
+		*  It is a no-op if the thread is not there, the lock on m_thread_mutex must be held
+		*/
+		void joinThread();
+
+#if !defined(_WIN32)
+		/** \brief Read callback of the reactor, decodes all the complete lines received
+		*/
+		void receiveLines(serial::Reactor &_reactor, serial::Reactor::PortId _port);
+#endif
+
+		/**  \brief Coalescer thread, sends the newest values given to setChannelCoalesced
+		*
+		*   Started by the first call to setChannelCoalesced, it writes at most 
+		*   one batch every m_coalesce_period ms and stops in the destructor
+		*/
+		void threadCoalescer() const;
+
+		/**  \brief Writer thread, the only thread writing on the serial port
+		*
+		*   Started by the first write, it always takes the safety lane first
+		*   and stops in the destructor after the queued writes are done
+		*/
+		void threadWriter() const;
+
+		/**  \brief Complete all the writes queued on a lane with false, m_write_mutex must be locked
+		*
+		*  @param _priority  lane to be emptied
+		*  @param _callbacks the callbacks of the discarded writes, to be called without the lock
+		*/
+		void discardWrites(int _priority, std::vector<writeCallback> &_callbacks) const;
+
+		/**  \brief Hold the writer, the writes are queued but not written until released
+		*
+		*   The safety lane is never held. Used by PPC1manager to release 
+		*   the writers of several devices at the same time
+		*
+		*  @param _hold  true to hold, false to release, the calls can be nested
+		*/
+		void holdWrites(bool _hold) const;
+
+		/**  \brief Send a batch on the safety lane, the shadow is not used to skip anything
+		*
+		*   The writes queued on the normal lane are dropped, they would undo this batch
+		*
+		*  @param _batch  commands
+		*/
+		bool sendSafetyBatch(const fluicell::commandBatch &_batch) const;
+
+		/**  \brief Wait for the writer to complete all the writes queued on both lanes
+		*
+		*   Used before closing the port, e.g. the pumpingOff sent by stop must reach the PPC1
+		*/
+		void flushWrites() const;
+
+		/**  \brief Set the shadow values written in a batch as pending, m_shadow_mutex must be locked
+		*/
+		void setShadowPending(const fluicell::commandBatch &_batch) const;
+
 		/**  \brief Decode data line function
 		  *
 		  *   This function decode every line out from the PPC1 device and fill
@@ -181,16 +315,31 @@ namespace fluicell
 		  *    Vrecirc: set 123mbar, read: 123.456789 mbar\n
 		  *    Valves: 0101\n
 		  *
+		  *  The line is decoded in place, no memory is allocated during the decoding
+		  *
 		  *  @param _data       input data to be decoded
+		  *  @param _size       number of characters in _data
 		  *  @param _PPC1_data  output data to be filled with decoded values
           *
 		  * \return true if success, false for any error
 		  *
 		  * \note _PPC1_data will hold the last value in case of any error
 		  */
-		bool decodeDataLine(const std::string &_data,
+		bool decodeDataLine(const char *_data, size_t _size,
 			fluicell::PPC1dataStructures::PPC1_data * _PPC1_data) const;
 
+		/**  \brief Decode data line function, overload for strings
+		  *
+		  *  @param _data       input data to be decoded
+		  *  @param _PPC1_data  output data to be filled with decoded values
+		  *
+		  * \return true if success, false for any error
+		  */
+		bool decodeDataLine(const std::string &_data,
+			fluicell::PPC1dataStructures::PPC1_data * _PPC1_data) const {
+			return decodeDataLine(_data.data(), _data.size(), _PPC1_data);
+		}
+
 		/**  \brief Decode one channel line
 		*
 		*    The channel line contains the following fields:
@@ -199,15 +348,111 @@ namespace fluicell
 		*
 		*    example of input data : B|-0.000000|0.034291|0.000000|0\n
 		*
+		*    An empty field is decoded as 0.0
+		*
 		*  @param _data  input data to be decoded
+		*  @param _size  number of characters in _data
 		*  @param _line  output line to be filled with decoded values
 		*
 		* \return true if success, false for any error (for instance broken messages)
 		*
 		* \note False occur for: empty data, NaN in the string, wrong data size
 		*/
-		bool decodeChannelLine(const std::string &_data, std::vector<double> &_line) const;
+		bool decodeChannelLine(const char *_data, size_t _size, std::array<double, 4> &_line) const;
+
+		/**  \brief Decode one channel line, overload for strings
+		*
+		*  @param _data  input data to be decoded
+		*  @param _line  output line to be filled with decoded values
+		*
+		* \return true if success, false for any error (for instance broken messages)
+		*/
+		bool decodeChannelLine(const std::string &_data, std::array<double, 4> &_line) const {
+			return decodeChannelLine(_data.data(), _data.size(), _line);
+		}
+
+		/**  \brief Decode a decimal number in the format [-]ddd[.ddd]
+		*
+		*    Replaces std::stod in the decoder, the result is the same 
+		*    but no memory is allocated
+		*
+		*  @param _begin  first character of the number
+		*  @param _end    one past the last character of the number
+		*  @param _value  decoded value
+		*
+		* \return false if the characters are not a valid number
+		*/
+		bool decodeNumber(const char *_begin, const char *_end, double &_value) const;
+
+
+		/**  \brief Find new line and separator characters in a block of data
+		*
+		*    Used by decodeBuffer, the block is m_scan_block_size bytes or less at the 
+		*    end of the buffer
+		*
+		*  @param _data        input data block
+		*  @param _size        available bytes from _data, only the first m_scan_block_size are scanned
+		*  @param _separators  output bitmask of the | positions
+		*
+		* \return bitmask of the \n positions
+		*/
+		unsigned int scanBlock(const char *_data, size_t _size, unsigned int &_separators) const;
+
+		/**  \brief Decode one line in a frame, used by decodeBuffer
+		*
+		*  @param _data        line to be decoded without the new line character
+		*  @param _size        number of characters in _data
+		*  @param _separators  positions of the first separators in the line
+		*  @param _n_separators  number of valid elements in _separators
+		*  @param _sample      frame under construction
+		*
+		* \return true if the line closes the frame (IN|OUT line)
+		*/
+		bool decodeSampleLine(const char *_data, size_t _size,
+			const size_t *_separators, size_t _n_separators,
+			fluicell::PPC1dataStructures::PPC1_sample &_sample) const;
+
+		/**  \brief Apply the new filter settings to m_filters, called by the thread 
+		*          when the version of m_filter_settings changes, only the filters 
+		*          with new settings are reset
+		*/
+		void updateFilters();
+
+		/** \brief Close the frame under construction and publish it
+		*
+		*   Called by the thread when the IN|OUT line arrives, it copies the current 
+		*   data into m_frame, stamps sequence number and time, publishes the frame 
+		*   as the last sample, pushes it in the samples buffer and updates the flows
+		*
+		*  @param _timestamp  time of reception of the IN|OUT line
+		*/
+		void commitFrame(std::chrono::steady_clock::time_point _timestamp);
+
+		/** \brief Notify an event to all the subscribers interested
+		*
+		*   Direct subscribers are called immediately, for the queued ones
+		*   the event is stored until dispatchEvents is called
+		*
+		*  @param _event  event to be notified
+		*/
+		void notify(const fluicell::PPC1dataStructures::PPC1_event &_event);
 
+		/** \brief Notify the exception event, used when the thread stops for an exception
+		*
+		*  @param _message  description of the exception
+		*/
+		void notifyException(const std::string &_message);
+
+		/** \brief Subscriber to the events
+		*/
+		struct subscriber
+		{
+			int id;
+			int event_mask;
+			eventCallback callback;
+			dispatchMode mode;
+		};
+		typedef std::vector<subscriber> subscriberList;
 
 		/** \brief Update inflow and outflow calculation 
 		*
@@ -216,15 +461,126 @@ namespace fluicell
 		*   This is currently based on calculation no sensor data are available.
 		*   
 		*
-		*  @param _PPC1_data  input data stream from PPC1 
+		*  @param _sample  complete frame from PPC1 
 		*  @param _PPC1_status  output _PPC1_status with current flows
 		*
 		* \note - For details about the specific calculations, refer to the
 		*         excel sheet in the resources folder
 		*/
-		void updateFlows(const fluicell::PPC1dataStructures::PPC1_data &_PPC1_data, 
+		void updateFlows(const fluicell::PPC1dataStructures::PPC1_sample &_sample, 
 			fluicell::PPC1dataStructures::PPC1_status &_PPC1_status) const;
 
+		/** \brief Check if the flows have to be calculated again for a new frame
+		*
+		*   The flows depend only on the sensor readings, the valves and the tip,
+		*   the values used for the last calculation are stored 
+		*
+		*  @param _sample  complete frame from PPC1 
+		*
+		* \return true if any reading, valve or the tip changed since the last call
+		*/
+		bool flowInputsChanged(const fluicell::PPC1dataStructures::PPC1_sample &_sample);
+
+		/** \brief Calculate the Poiseuille coefficients for the current tip, 
+		*          called every time the tip changes
+		*/
+		void updateFlowCoefficients();
+
+		/** \brief Set points for the solver parameters, see solveOperatingPoint
+		*/
+		void operatingPointAt(double _x, double _s, 
+			fluicell::PPC1dataStructures::operatingPoint &_point) const;
+
+		/** \brief Build the starting grid of solveOperatingPoint, m_solver_mutex must be locked
+		*/
+		void buildSolverGrid() const;
+
+		/** \brief Check the pending set point confirmations, called by the thread 
+		*
+		*   Confirmations matching the set points in m_PPC1_data are completed with true, 
+		*   the expired ones with false
+		*
+		*  @param _fail_all  the thread stops, isRunning becomes false and all the confirmations 
+		*                    are completed with false, under the lock used by expectSetPoints
+		*/
+		void checkConfirmations(bool _fail_all = false);
+
+		/** \brief Queue a confirmation for the set points of a batch already sent, see sendBatchAsync
+		*
+		*   The future is ready at once with true if there is nothing to confirm, 
+		*   if _timeout_ms is not positive or if the thread is not running
+		*/
+		std::future<bool> expectSetPoints(const fluicell::commandBatch &_batch, int _timeout_ms) const;
+
+		/** \brief A future already holding _value
+		*/
+		static std::future<bool> readyFuture(bool _value);
+
+		/** \brief Wait for a confirmation at most _timeout_ms, false if it is not ready by then
+		*
+		*   The thread completes the expired confirmations only when it runs, 
+		*   the caller never waits longer than the deadline
+		*/
+		static bool waitConfirmation(std::future<bool> _future, int _timeout_ms);
+
+		/** \brief Queue a batch for the writer, skipping what the shadow says is already there
+		*
+		*   m_coalesce_mutex must be locked, so a coalesced batch taken by the coalescer
+		*   is queued before any newer command and never after a safety batch
+		*
+		*  @param _batch    commands
+		*  @param _written  the commands actually queued, empty if nothing was needed
+		*/
+		bool writeBatch(const fluicell::commandBatch &_batch, fluicell::commandBatch &_written) const;
+
+		/** \brief Compare the shadow state with the last frame, called by the thread
+		*
+		*   Written values become confirmed when the PPC1 streams them back,
+		*   confirmed values that do not match the stream anymore become unknown
+		*/
+		void updateShadow();
+
+		/** \brief Forget the shadow state, the next commands are all sent
+		*/
+		void resetShadow() const;
+
+		/** \brief Send one valve command, l%u\n k%u\n j%u\n or i%u\n, skipped if the valve is already there
+		*
+		*  @param _command  valve character
+		*  @param _bit      valve bit in the setValvesState byte
+		*  @param _value    true = open
+		*/
+		bool setValve(char _command, int _bit, bool _value) const;
+
+		/**  \brief Last state written to the PPC1, used to skip the commands that would not change anything
+		*
+		*    A value is only trusted (confirmed) after the PPC1 streamed it back,
+		*    a value written and not yet streamed back (pending) is always sent again
+		**/
+		struct deviceShadow
+		{
+			enum shadowState {
+				unknown = 0,
+				pending = 1,
+				confirmed = 2
+			};
+
+			shadowState set_point_state[4];  //!< state of each channel set point
+			double set_point[4];             //!< last set point written for each channel
+			shadowState valves_state;        //!< state of the valves
+			int valves;                      //!< last valves written, setValvesState byte
+		};
+
+		/**  \brief Set point waiting for the confirmation from the PPC1, see setChannelAsync
+		**/
+		struct setPointConfirmation
+		{
+			int channels;                                     //!< one bit for each channel not yet confirmed
+			double values[fluicell::commandBatch::number_of_channels];  //!< set point of each channel
+			std::chrono::steady_clock::time_point deadline;
+			std::promise<bool> promise;
+		};
+
 
 		/** \brief Send a string to the PPC1 controller
 		  *
@@ -233,9 +589,42 @@ namespace fluicell
 		  */
 		bool sendData(const std::string &_data) const;
 
+		/** \brief Send a buffer to the PPC1 controller with a single write
+		  *
+		  *  @param _data  characters to be sent, not null terminated
+		  *  @param _size  number of characters
+		  *
+		  */
+		bool sendData(const char *_data, size_t _size) const;
+
+	public:
+
+		/** \brief Queue data for the writer thread, the caller never waits for the serial port
+		  *
+		  *  The writes on each lane are done in order, the safety lane always goes first.
+		  *  Each lane holds at most 64 writes, the write is refused when the lane is full.
+		  *
+		  *  @param _data      characters to be sent, not null terminated, at most commandBatch::max_size
+		  *  @param _size      number of characters
+		  *  @param _priority  lane, see writePriority
+		  *  @param _callback  optional, called by the writer thread when the write is done or discarded
+		  *
+		  *  \return false if the port is not open, the data are too long or the lane is full,
+		  *          the callback is not called in this case
+		  */
+		bool sendDataAsync(const char *_data, size_t _size, 
+			writePriority _priority = normalPriority, writeCallback _callback = writeCallback()) const;
+
+	private:
+
 		/** Read data from serial port
 		  *
-		  * \return false for any error
+		  * Read the next complete line from the data stream. Nothing received from
+		  * the PPC1 is ever discarded: if the read times out in the middle of a line 
+		  * the fragment is kept and completed in the next call. A line longer than 
+		  * m_max_line_length is dropped and the stream resynchronises on the next \n
+		  *
+		  * \return false for any error or if no complete line is available
 		  *
 		  * \note this function read one line until the new line \n
 		  */
@@ -285,6 +674,8 @@ namespace fluicell
 		const char m_decimal_separator = '.';      // decimal separator
 		const char m_minus = '-';					// minus sign
 		const char m_end_line = '\n';				// minus sign
+		const size_t m_max_line_length = 256;      // longer lines are considered corrupted
+		static const size_t m_scan_block_size = 32; // bytes scanned by scanBlock, at most the bits in unsigned int
 
 		// Serial port configuration parameters, only serial port number 
 		// and baud rate are configurable for the user, this is intentional!
@@ -292,16 +683,87 @@ namespace fluicell
 		std::string m_COMport;	            //!< port number
 		int m_baud_rate;                //!< baud rate	
 		int m_COM_timeout;              //!< timeout for the serial communication --- default value 250 ms
+		std::string m_line_buffer;      //!< line under construction, it holds the fragment of a partially received line
+		bool m_resync;                  //!< true after a corrupted line, data are discarded up to the next new line
+		std::atomic<unsigned long long> m_bytes_received;   //!< see streamCounters
+		std::atomic<unsigned long long> m_lines_received;   //!< see streamCounters
+		std::atomic<unsigned long long> m_lines_dropped;    //!< see streamCounters
+		std::atomic<unsigned long long> m_partial_lines;    //!< see streamCounters
 		
-		fluicell::PPC1dataStructures::PPC1_data *m_PPC1_data; /*!< ppc1 output structure */
-		fluicell::PPC1dataStructures::PPC1_status *m_PPC1_status;/*!< pipette status */
+		mutable fluicell::PPC1dataStructures::PPC1_data m_PPC1_data; /*!< ppc1 output structure, updated line by line by the thread, 
+		                                                                  the triggers are also reset by waitSync under m_sync_mutex */
+		fluicell::PPC1dataStructures::PPC1_sample m_frame;        //!< frame under construction, only used by the thread
+		fluicell::seqLock<fluicell::PPC1dataStructures::PPC1_snapshot> m_snapshot; //!< last complete frame and flows, written by the thread only
+		sampleBuffer m_sample_buffer;                             //!< all the frames received, written by the thread only
+		int m_last_valves[4];                                     //!< valves i, j, k, l in the last frame, to detect changes
+
+		// events subscription
+		std::shared_ptr<const subscriberList> m_subscribers;   //!< replaced as a whole on subscribe/unsubscribe, read with std::atomic_load
+		std::atomic<int> m_subscribed_events;                  //!< mask of the events with at least one subscriber
+		std::mutex m_subscribe_mutex;                          //!< serialises subscribe and unsubscribe
+		int m_next_subscriber_id;                              //!< id of the next subscriber
+		std::mutex m_event_queue_mutex;                        //!< protects m_event_queue
+		std::deque<std::pair<int, fluicell::PPC1dataStructures::PPC1_event> > m_event_queue; //!< events for queued subscribers (subscriber id, event)
+		const size_t m_max_queued_events = 1024;               //!< oldest events are dropped if nobody calls dispatchEvents
+		fluicell::PPC1dataStructures::PPC1_status *m_PPC1_status;/*!< pipette status, working copy of the thread, published in m_snapshot */
 		fluicell::PPC1dataStructures::tip *m_tip;
 		int m_wait_sync_timeout;        //!< timeout for wait sync function in seconds, default value 60 sec
+		mutable std::mutex m_sync_mutex;                      //!< protects the trigger signals in m_PPC1_data, m_trigger_time and m_sync_latency
+		mutable std::condition_variable m_sync_condition;     //!< notified when a trigger line arrives
+		mutable std::chrono::steady_clock::time_point m_trigger_time;  //!< reception time of the last trigger line
+		mutable fluicell::PPC1dataStructures::latencyHistogram m_sync_latency; //!< latency from trigger line to the return of waitSync
 
 		// threads
 		std::thread m_thread;                   //!< Member for the thread handling		
-		bool m_threadTerminationHandler;   //!< set to TRUE to stop the thread, automatically set to false during the thread starting
-		bool m_isRunning;                  //!< true when the thread is running
+		std::mutex m_thread_mutex;              //!< serializes run and stop
+		fluicell::stopToken m_thread_stop;      //!< stop request of the running thread, a new one for each run
+		std::atomic<bool> m_isRunning;          //!< true from run to the end of the thread
+		std::atomic<double> m_stop_latency;     //!< time taken by the last stop in ms, see getStopLatency
+#if !defined(_WIN32)
+		serial::Reactor *m_reactor;             //!< reactor streaming the data instead of m_thread, see run(serial::Reactor&)
+		serial::Reactor::PortId m_reactor_port; //!< the port in m_reactor
+		std::string m_reactor_piece;            //!< piece of line read from m_reactor
+		std::string m_reactor_line;             //!< complete line read from m_reactor
+#endif
+
+		// writer thread, see sendDataAsync
+		static const size_t m_write_queue_size = 64;            //!< maximum number of writes queued on each lane
+
+		/**  \brief One queued write, the data are copied so the caller buffer can go
+		**/
+		struct writeRequest
+		{
+			char data[fluicell::commandBatch::max_size];
+			size_t size;
+			writeCallback callback;
+		};
+
+		/**  \brief Bounded FIFO of writes, the requests are allocated once
+		**/
+		struct writeLane
+		{
+			std::vector<writeRequest> requests;  //!< circular buffer of m_write_queue_size requests
+			size_t head;                         //!< oldest request
+			size_t count;                        //!< number of requests queued
+		};
+
+		mutable std::thread m_writer_thread;                    //!< writer thread, started on the first write
+		mutable std::mutex m_write_mutex;                       //!< protects the lanes and the thread
+		mutable std::condition_variable m_write_condition;      //!< wakes the writer up on new writes and on stop
+		mutable writeLane m_write_lanes[2];                     //!< queued writes, indexed by writePriority
+		bool m_writer_stop;                                     //!< stops the writer, set in the destructor
+		mutable bool m_writer_busy;                             //!< a write taken from the lanes is not done yet
+		mutable int m_writer_hold;                              //!< the normal lane waits while positive, see holdWrites
+		mutable std::condition_variable m_write_idle_condition; //!< signalled after each write, see flushWrites
+
+		// coalescing of the interactive set points, see setChannelCoalesced
+		mutable std::thread m_coalesce_thread;                  //!< coalescer thread, started on the first use
+		mutable std::mutex m_coalesce_mutex;                    //!< protects the coalesced values and the thread, held while a batch is queued
+		mutable std::condition_variable m_coalesce_condition;   //!< wakes the coalescer up on new values and on stop
+		mutable double m_coalesced_values[4];                   //!< newest value for each channel
+		mutable std::atomic<int> m_coalesced_pending;           //!< one bit for each channel with a value not yet sent
+		std::atomic<int> m_coalesce_period;                     //!< minimum time between two coalesced writes (ms)
+		bool m_coalesce_stop;                                   //!< stops the coalescer, set in the destructor
 
 	    // this values are the constants to have 100% droplet size 
 		double m_default_pon;              //!< in mbar  -- default value  190.0 mbar
@@ -313,10 +775,47 @@ namespace fluicell
 		bool m_verbose;                     //!< verbose output when active
 		bool m_filter_enabled;              //!< if active enable data filtering from PPC1
 		int m_filter_size;                  //!< if m_filter_enabled active define the number of samples to be considered in the filter
+		std::array<fluicell::readingFilter, 4> m_filters;   //!< one filter per channel, used by the thread only
+		fluicell::seqLock<filterSettings> m_filter_settings; //!< filters requested by the user, applied by the thread
+		unsigned long long m_filter_version;                //!< version of m_filter_settings in use in m_filters
+		std::mutex m_filter_mutex;                          //!< serialises the writers of m_filter_settings
+		mutable std::atomic<bool> m_TTL_out_trigger;  //!< true = high, false = low
 
 		bool m_excep_handler;  // normally false, it will be true in case of exception
 							   //TODO: this is an easy and dirty way of forwarding exceptions, find the proper solution to it
 
+		// flows calculation
+		const double m_flow_constant;       //!< Poiseuille flow (nL/s) for unit pressure and length, see getFlowSimple
+		mutable std::mutex m_tip_mutex;     //!< protects m_tip
+		fluicell::seqLock<fluicell::PPC1dataStructures::flowCoefficients> m_flow_coefficients; //!< coefficients for the current tip, read by the thread
+		double m_flow_readings[4];          //!< sensor readings used in the last flows calculation, used by the thread only
+		int m_flow_valves;                  //!< valves used in the last flows calculation, used by the thread only
+		unsigned long long m_flow_tip_version;  //!< version of m_flow_coefficients used in the last flows calculation
+
+		// set point confirmations
+		const double m_set_point_tolerance = 0.01;     //!< max difference (mbar) between commanded and streamed set point
+		static const int m_confirmation_timeout = 1000; //!< ms, used by runCommand to wait for the set points
+		mutable std::mutex m_confirmation_mutex;        //!< protects m_confirmations
+		mutable std::vector<setPointConfirmation> m_confirmations; //!< set points waiting for the confirmation
+		mutable std::atomic<int> m_n_confirmations;     //!< size of m_confirmations, the thread skips the lock when 0
+
+		// device id request, see getDeviceID
+		std::mutex m_device_id_mutex;                   //!< protects m_device_id_pending and m_device_id_reply
+		bool m_device_id_pending;                       //!< true while getDeviceID waits for the reply from the I/O thread
+		std::promise<std::string> m_device_id_reply;    //!< completed by the I/O thread with the first line that is not data
+
+		// shadow of the device state
+		mutable std::mutex m_shadow_mutex;              //!< protects m_shadow, the thread only tries to lock it
+		mutable deviceShadow m_shadow;                  //!< last state written, see sendBatch
+		mutable std::atomic<unsigned long long> m_commands_skipped;  //!< commands not sent as they would not change anything
+
+		// operating point solver
+		static const int m_solver_grid_size = 32;   //!< grid points on each parameter (x, s)
+		mutable std::mutex m_solver_mutex;          //!< protects the solver grid
+		mutable std::vector<std::array<double, 2> > m_solver_grid;  //!< zone size and flow speed, x is the outer index
+		mutable unsigned long long m_solver_tip_version;            //!< version of m_flow_coefficients used for the grid
+		mutable std::array<double, 4> m_solver_defaults;            //!< default values used for the grid
+
 	public:
 
 		/**  \brief Connect to serial port
@@ -362,6 +861,9 @@ namespace fluicell
 		/**  \brief Put all the set points to zero and close the valves,
 		  *         the device is now in a sleep mode
 		  *
+		  *  The commands are sent on the safety lane in one write and all the 
+		  *  commands still queued on the normal lane are discarded
+		  *
 		  *  \return true if success, false for any error
 		  *
 		  **/
@@ -382,6 +884,8 @@ namespace fluicell
 		bool closeAllValves() const;
 
 		/**  \brief Send a reboot character to the device
+		  *
+		  *  The character is sent on the safety lane, the commands still queued are discarded
 		  *
 		  *  \note - Known issue: weird behaviour in disconnect/connect
 		  **/
@@ -392,25 +896,125 @@ namespace fluicell
 		  *  During the thread the PPC1 stream data on the open serial port and
 		  *  listen messages on the same port
 		  *
+		  *  isRunning is true when this function returns true
 		  *
+		  *  \return false if the thread is already running or the port is not open
 		  **/
-		virtual void run() {
-			m_threadTerminationHandler = false; //TODO: too weak, add checking if running and initialized
-			m_thread = std::thread(&PPC1api::threadSerial, this);
-			// run_thread.join();
-		}
+		virtual bool run();
+
+#if !defined(_WIN32)
+		/** \brief Stream the data on a reactor shared with other devices instead of a thread
+		*
+		*  The lines are decoded on the reactor thread, everything else works as with run(), 
+		*  stop() removes the port from the reactor. The reactor must live until stop
+		*
+		*  \note - the set point confirmations are checked on every frame, but they expire 
+		*          without data only if a tick of the reactor checks them, as PPC1manager does.
+		*          Without the tick the future of a silent device is completed by stop(); 
+		*          sendBatch and runCommand still return within their timeout
+		*
+		*  @param _reactor  reactor serving the port
+		*
+		*  \return false if the thread is already running or the port is not open
+		**/
+		bool run(serial::Reactor &_reactor);
+#endif
 
 		/**  \brief Safe stop the thread
+		  *
+		  *  The PPC1 is set to zero, then the thread is stopped and joined,
+		  *  so the serial port is not used anymore when this function returns.
+		  *  The time taken is given by getStopLatency
 		  *
 		  **/
-		void stop() {
-			pumpingOff();  // as we end the thread is good to put the PPC1 to zero
-			m_thread.detach();
-			m_thread.~thread();
-			m_threadTerminationHandler = true;
-			std::this_thread::sleep_for(std::chrono::microseconds(1000));  //--> wait the last execution
-		}
+		void stop();
+
+		/**  \brief Time taken by the last stop to join the thread in ms
+		  *
+		  **/
+		double getStopLatency() const { return m_stop_latency; }
+
+
+		/** \brief Set a value on one channel, only the newest value is sent
+		  *
+		  *  Meant for interactive controls (sliders, buttons): the value replaces any value 
+		  *  not yet sent on the same channel and a separate thread writes the pending 
+		  *  channels in one batch, at most once every getCoalescePeriod() ms. 
+		  *  Intermediate values are dropped, so the PPC1 never replays stale set points.
+		  *  A value set later with any other set function cancels the pending one.
+		  *
+		  *  @param  _channel  channel index, see PPC1dataStructures::PPC1_data::channelIndex
+		  *  @param  _value    set point in mbar
+		  *
+		  *  \return false if the channel or the value are not valid, errors on the write are only logged
+		  **/
+		bool setChannelCoalesced(int _channel, double _value) const;
+
+		/** \brief Set the minimum time between two writes of setChannelCoalesced
+		  *
+		  *  @param  _period_ms  period in milliseconds, 50 by default
+		  **/
+		void setCoalescePeriod(int _period_ms);
+
+		/** \brief Get the minimum time between two writes of setChannelCoalesced in ms
+		  **/
+		int getCoalescePeriod() const { return m_coalesce_period; }
+
+		/** \brief Set a value on one channel and get a future for the confirmation
+		  *
+		  *  The value is sent as in setVacuumChannelA .. setPressureChannelD, the future becomes
+		  *  ready when the set point streamed back by the PPC1 matches the value (true),
+		  *  or when _timeout_ms expires or the thread stops (false). 
+		  *
+		  *  Usage:
+		  *		- 	std::future<bool> a = my_ppc1->setChannelAsync(PPC1_data::channel_A, -115.0);
+		  *		- 	std::future<bool> d = my_ppc1->setChannelAsync(PPC1_data::channel_D, 190.0);
+		  *		- 	bool success = a.get() && d.get();
+		  *
+		  *  @param  _channel     channel index, see PPC1dataStructures::PPC1_data::channelIndex
+		  *  @param  _value       set point in mbar
+		  *  @param  _timeout_ms  maximum time for the confirmation in milliseconds
+		  *
+		  *  \return a future that is false if the value was not sent or not confirmed
+		  *
+		  *  \note - the confirmation requires the thread running, see run(), 
+		  *          otherwise the future only tells if the value was sent
+		  **/
+		std::future<bool> setChannelAsync(int _channel, double _value, 
+			int _timeout_ms = 1000) const;
 
+		/** \brief Send all the commands in a batch with a single write
+		  *
+		  *  The channels in the batch change at the same time, one USB packet 
+		  *  instead of one for each command.
+		  *
+		  *  @param _batch       commands, see fluicell::commandBatch
+		  *  @param _timeout_ms  if positive and the thread is running, wait for the PPC1 
+		  *                      to confirm all the channel set points in the batch
+		  *
+		  * \return false if the batch is empty, the write failed or a set point was not confirmed
+		  **/
+		bool sendBatch(const fluicell::commandBatch &_batch, int _timeout_ms = 0) const;
+
+		/** \brief Send all the commands in a batch with a single write and get a future for the confirmation
+		  *
+		  *  As sendBatch, but the caller does not wait: the future becomes true when the PPC1 
+		  *  streams back all the set points in the batch, false when _timeout_ms expires 
+		  *  or the thread stops. It is ready at once if the batch is not sent (false), 
+		  *  or if there are no set points to confirm or the thread is not running (true).
+		  *
+		  *  Usage:
+		  *		- 	std::future<bool> done = my_ppc1->sendBatchAsync(batch);
+		  *		- 	...
+		  *		- 	if (done.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready && done.get())
+		  *
+		  *  @param _batch       commands, see fluicell::commandBatch
+		  *  @param _timeout_ms  maximum time for the confirmation in milliseconds
+		  *
+		  *  \note - the expired confirmations are completed by the thread on its next frame
+		  *          or read timeout, use wait_for with the same timeout to never wait longer
+		  **/
+		std::future<bool> sendBatchAsync(const fluicell::commandBatch &_batch, int _timeout_ms = 1000) const;
 
 		/** \brief Set a value on the vacuum channel A, admitted values are [-300.0, 0.0] in mbar
 		  *
@@ -568,48 +1172,59 @@ namespace fluicell
 		*
 		*  Set the droplet size to a specific _percentage with respect to the default values
 		*  of vacuum and pressures.
-		*  The droplet size linear increment corresponds to a cubic power of the desired values 
-		*  for pressures and vacuums
+		*  The set points are calculated by solveOperatingPoint keeping the current
+		*  flow speed, 100% if the current value is out of range: pon and v_recirc move 
+		*  in opposite directions to change the zone size, all the channels are scaled 
+		*  together to keep the flow speed
 		*
-		*  new_Pon_value = default_Pon * (_percentage^1.3);
-		*  new_Vrecirc_value = default_Vrecirc * (_percentage^1.3);
-		*
-		*         
-		*  \note: The values of pressures and vacuum for Poff and Vswitch will be 
-		*         reset to the default values
 		*  \note: This function accepts values in [MIN_ZONE_SIZE_PERC, MAX_ZONE_SIZE_PERC]
-		*         
-		*
-		*   new_Poff_value = default_Poff
-		*   new_Vrecirc_value = default_Vrecirc
 		*
 		*  @param  _percentage is the desired percentage value
 		*
+		*  \note: the commands are queued without waiting for the PPC1, see setZoneSizePercAsync
+		*
 		*  \return -  false in case of errors
 		**/
 		bool setZoneSizePerc(double _percentage = 100.0) const;
 
-		/** \brief Change the zone size by a specific amount + or - 
+		/** \brief As setZoneSizePerc, with a future for the confirmation of the new set points
 		*
-		*  Change the droplet size by adding a specific _percentage with respect to the default values
-		*  of vacuum and pressures.
-		*  The droplet size linear increment corresponds to a cubic power of the desired values 
-		*  for pressures and vacuums.
+		*  @param  _percentage  desired zone size percentage
+		*  @param  _timeout_ms  maximum time for the confirmation in milliseconds
 		*
-		*  new_Pon_value = Pon_set_point + default_Pon * (_percentage^1.3);
-		*  new_Vrecirc_value = Vrecirc_set_point + default_Vrecirc * (_percentage^1.3);
+		*  \return -  a future that is false if the value is out of range, the solver fails
+		*             or the set points are not confirmed, see sendBatchAsync
+		**/
+		std::future<bool> setZoneSizePercAsync(double _percentage, int _timeout_ms = 1000) const;
+
+		/** \brief Change the zone size by a specific amount + or - 
+		*
+		*  Change the droplet size by adding a specific _percentage to the current zone size,
+		*  see getZoneSizePerc. The set points are calculated by solveOperatingPoint 
+		*  as in setZoneSizePerc, keeping the current flow speed.
 		*
-		*  \note: the other pressures/values will be untouched
 		*  \note: This function accepts values in [-MAX_ZONE_SIZE_INCREMENT, MAX_ZONE_SIZE_INCREMENT]
+		*          and the resulting zone size must be in [MIN_ZONE_SIZE_PERC, MAX_ZONE_SIZE_PERC]
 		*
 		*  \note: example: if _percentage = 5% ==> the size goes to 105%
 		*
 		*  @param  _percentage is the desired percentage value
 		*
+		*  \note: the commands are queued without waiting for the PPC1, see changeZoneSizePercByAsync
+		*
 		*  \return -  false in case of errors
 		**/
 		bool changeZoneSizePercBy(double _percentage = 0.0) const;
 
+		/** \brief As changeZoneSizePercBy, with a future for the confirmation of the new set points
+		*
+		*  @param  _percentage  zone size increment
+		*  @param  _timeout_ms  maximum time for the confirmation in milliseconds
+		*
+		*  \return -  a future that is false in case of errors, see setZoneSizePercAsync
+		**/
+		std::future<bool> changeZoneSizePercByAsync(double _percentage, int _timeout_ms = 1000) const;
+
 		/** \brief Get the current droplet size as percentage
 		*
 		*  The real percentage of the droplet is the cubic root of the real value
@@ -625,11 +1240,24 @@ namespace fluicell
 		**/
 		double getZoneSizePerc() const;
 
+		/** \brief Zone size in percentage for given set points, see getZoneSizePerc
+		*
+		*  @param  _pon       pressure on (mbar)
+		*  @param  _poff      pressure off (mbar)
+		*  @param  _v_switch  vacuum switch (mbar), negative
+		*  @param  _v_recirc  vacuum recirculation (mbar), negative
+		*
+		*  \return -  zone size percentage calculated with the flow model of the current tip
+		**/
+		double zoneSizePerc(double _pon, double _poff, double _v_switch, double _v_recirc) const;
+
 	
 		/** \brief Set the flow speed to _percentage, default value = 100.0 %
 		*
 		*  To increase the flow speed, all the values of pressures and vacuum are 
-		*  increased/decreased to the same percentage with respect to the default values
+		*  increased/decreased to the same percentage with respect to the default values.
+		*  The set points are calculated by solveOperatingPoint keeping the current
+		*  zone size, 100% if the current value is out of range
 		*
 		*  \note: This function accepts values in [MIN_ZONE_SIZE_PERC, MAX_ZONE_SIZE_PERC]
 		*
@@ -637,10 +1265,22 @@ namespace fluicell
 		*  @param  _percentage is the desired percentage value
 		*
 		*
+		*  \note: the commands are queued without waiting for the PPC1, see setFlowSpeedPercAsync
+		*
 		*  \return -  false in case of errors
 		**/
 		bool setFlowSpeedPerc(const double _percentage = 100.0) const;
 
+		/** \brief As setFlowSpeedPerc, with a future for the confirmation of the new set points
+		*
+		*  @param  _percentage  desired flow speed percentage
+		*  @param  _timeout_ms  maximum time for the confirmation in milliseconds
+		*
+		*  \return -  a future that is false if the value is out of range, the solver fails
+		*             or the set points are not confirmed, see sendBatchAsync
+		**/
+		std::future<bool> setFlowSpeedPercAsync(double _percentage, int _timeout_ms = 1000) const;
+
 
 		/** \brief Change the flow speed by _percentage, default value = 0.0 %
 		*
@@ -650,10 +1290,22 @@ namespace fluicell
 		*  @param  _percentage is the desired percentage value
 		*
 		*
+		*  \note: the commands are queued without waiting for the PPC1, see changeFlowSpeedPercByAsync
+		*
 		*  \return -  false in case of errors
 		**/
 		bool changeFlowSpeedPercBy(const double _percentage = 0.0) const;
 
+		/** \brief As changeFlowSpeedPercBy, with a future for the confirmation of the new set points
+		*
+		*  @param  _percentage  flow speed increment
+		*  @param  _timeout_ms  maximum time for the confirmation in milliseconds
+		*
+		*  \return -  a future that is false if a new value is out of range or 
+		*             the set points are not confirmed, see sendBatchAsync
+		**/
+		std::future<bool> changeFlowSpeedPercByAsync(double _percentage, int _timeout_ms = 1000) const;
+
 		/** \brief Get the current flow speed in percentage
 		*
 		* \note: the calculation is based on the the actual sensor readings
@@ -661,6 +1313,87 @@ namespace fluicell
 		*  \return -  value = average percentage among all the channels
 		**/
 		double getFlowSpeedPerc() const;
+
+		/** \brief Flow speed in percentage for given set points, see getFlowSpeedPerc
+		*
+		*  @param  _pon       pressure on (mbar)
+		*  @param  _poff      pressure off (mbar)
+		*  @param  _v_switch  vacuum switch (mbar), negative
+		*  @param  _v_recirc  vacuum recirculation (mbar), negative
+		*
+		*  \return -  average percentage among all the channels with respect to the default values
+		**/
+		double flowSpeedPerc(double _pon, double _poff, double _v_switch, double _v_recirc) const;
+
+		/** \brief Build the map of the operating points
+		*
+		*  Sweep all the combinations of set points in _range, calculate zone size
+		*  and flow speed percentages with the flow model of the current tip and 
+		*  write them in a binary file. The sweep is split among _n_threads threads.
+		*
+		*  File format, little endian as written by the host:
+		*     - header: "PPC1MAP" (8 chars), version (uint32), length to tip and length to zone (double),
+		*               min, step (double) and count (uint32) for pon, poff, v_switch, v_recirc
+		*     - table:  zone size and flow speed (float) for each point, pon is the outer 
+		*               loop and v_recirc the inner loop, the set points are implicit in the header
+		*
+		*  @param  _range       set points to be swept
+		*  @param  _file_name   output file
+		*  @param  _n_threads   number of threads, 0 to use all the cores
+		*
+		*  \return -  false in case of errors
+		*
+		*  \note -  the whole table is kept in memory, 8 bytes per point
+		**/
+		bool buildOperatingMap(const fluicell::PPC1dataStructures::operatingMapRange &_range,
+			const std::string &_file_name, unsigned int _n_threads = 0) const;
+
+		/** \brief Calculate the set points for a target zone size and flow speed
+		*
+		*  The set points are searched as 
+		*          pon = s * x * default_pon           poff = s * default_poff
+		*          v_recirc = s * (2 - x) * default_v_recirc      v_switch = s * default_v_switch
+		*  where s scales all the channels (flow speed) and x moves the balance between
+		*  pon and v_recirc (zone size), for s = 1 this is the pon / v_recirc balance of the former cubic root rule.
+		*  The starting point comes from a grid of (x, s) calculated for the current tip and 
+		*  default values, then Newton iterations refine it on zoneSizePerc and flowSpeedPerc.
+		*  The grid is built at the first call and again when tip or default values change.
+		*
+		*  @param  _zone_size_perc   target zone size percentage
+		*  @param  _flow_speed_perc  target flow speed percentage
+		*  @param  _point            output set points
+		*
+		*  \return -  false if the solver does not converge or the set points are out of range
+		**/
+		bool solveOperatingPoint(double _zone_size_perc, double _flow_speed_perc,
+			fluicell::PPC1dataStructures::operatingPoint &_point) const;
+
+		/** \brief Set zone size and flow speed together, see solveOperatingPoint
+		*
+		*  @param  _zone_size_perc   target zone size percentage, [MIN_ZONE_SIZE_PERC, MAX_ZONE_SIZE_PERC]
+		*  @param  _flow_speed_perc  target flow speed percentage, [MIN_FLOW_SPEED_PERC, MAX_FLOW_SPEED_PERC]
+		*
+		*  \return -  false in case of errors
+		*
+		*  \note: the commands are queued without waiting for the PPC1, see setOperatingPointAsync
+		**/
+		bool setOperatingPoint(double _zone_size_perc, double _flow_speed_perc) const;
+
+		/** \brief As setOperatingPoint, with a future for the confirmation of the new set points
+		*
+		*  Usage:
+		*		- 	std::future<bool> done = my_ppc1->setOperatingPointAsync(120.0, 80.0);
+		*		- 	bool success = done.get();  // or wait_for, see sendBatchAsync
+		*
+		*  @param  _zone_size_perc   target zone size percentage
+		*  @param  _flow_speed_perc  target flow speed percentage
+		*  @param  _timeout_ms       maximum time for the confirmation in milliseconds
+		*
+		*  \return -  a future that is false if the targets are out of range, the solver fails
+		*             or the set points are not confirmed, see sendBatchAsync
+		**/
+		std::future<bool> setOperatingPointAsync(double _zone_size_perc, double _flow_speed_perc, 
+			int _timeout_ms = 1000) const;
 		
 		/** \brief Set the vacuum by _percentage 
 		*
@@ -733,11 +1466,8 @@ namespace fluicell
 			double _delta_pressure = -14600.0,
 			double _pipe_length = 0.124	) const
 		{
-			double square_channel_mod = 1.128;
-			double pipe_diameter = 0.00003;
-			double dynamic_viscosity = 0.00089;
-			return getFlow(square_channel_mod, pipe_diameter, _delta_pressure, dynamic_viscosity, _pipe_length);
-
+			// constant part precomputed in m_flow_constant
+			return m_flow_constant * _delta_pressure / _pipe_length;
 		}
 
 
@@ -753,9 +1483,21 @@ namespace fluicell
 		*
 		*  @param  _cmd is a command, see <command> structure
 		*
+		*  \note the command cannot be stopped, see runCommand(_cmd, _stop)
 		**/
 		bool runCommand(fluicell::PPC1dataStructures::command _cmd) const;
 
+		/** \brief Run a command for the PPC1, the blocking commands end as soon as _stop is requested
+		*
+		*  wait, waitSync and syncOut wake up at once when _stop.requestStop() is called 
+		*  from another thread, the command returns false in this case
+		*
+		*  @param  _cmd   is a command, see <command> structure
+		*  @param  _stop  stop request shared with the thread that can stop the protocol
+		*
+		**/
+		bool runCommand(fluicell::PPC1dataStructures::command _cmd, const fluicell::stopToken &_stop) const;
+
 		/**  \brief Set the data stream period on the serial port
 		  *
 		  *  Send the string u%u\n to set the data stream period
@@ -832,8 +1574,12 @@ namespace fluicell
 		**/
 		void setTipParameters( double _length_to_tip,// = DEFAULT_LENGTH_TO_TIP,
 			                   double _length_to_zone){// = DEFAULT_LENGTH_TO_ZONE) {
-			m_tip->length_to_tip = _length_to_tip;
-			m_tip->length_to_zone = _length_to_zone;
+			{
+				std::lock_guard<std::mutex> lock(m_tip_mutex);
+				m_tip->length_to_tip = _length_to_tip;
+				m_tip->length_to_zone = _length_to_zone;
+			}
+			updateFlowCoefficients();
 		}
 
 		fluicell::PPC1dataStructures::tip::tipType getTipType() const {
@@ -849,8 +1595,12 @@ namespace fluicell
 		*  \note -  call this function without argument reset the tip to Prime
 		**/
 		void setTip(bool _tip = true) {
-			if (_tip == true) m_tip->usePrimeTip();
-			if (_tip == false) m_tip->useFlexTip();
+			{
+				std::lock_guard<std::mutex> lock(m_tip_mutex);
+				if (_tip == true) m_tip->usePrimeTip();
+				if (_tip == false) m_tip->useFlexTip();
+			}
+			updateFlowCoefficients();
 		}
 
 		/** \brief Get the length_to_tip value
@@ -878,6 +1628,9 @@ namespace fluicell
 		  * in range 1-6, where: 1-on pressure, 2-off pressure, 3-switch vacuum,
 		  * 4-recirculation vacuum, 5-valves, 6-synchronization
 		  *
+		  * While the data are streaming the reply is read by the I/O thread and handed over,
+		  * otherwise it is read here and run waits until it is done
+		  *
 		  * \return the device ID as a string
 		  **/
 		std::string getDeviceID();
@@ -918,6 +1671,29 @@ namespace fluicell
 		**/
 		void setFilterSize(int _size);
 
+		/**  \brief Set the filter on one channel
+		*
+		* Each channel has its own filter, e.g. the noisy vacuum channels can use a 
+		* median or a butterworth filter while the pressure channels keep the low pass,
+		* see fluicell::readingFilter for the available filters. 
+		* The filter history of the channel is cleared if the settings change,
+		* the other channels are not touched.
+		*
+		* @param  _channel   channel index, see PPC1dataStructures::PPC1_data::channelIndex
+		* @param  _settings  filter type, window size and parameter
+		*
+		* \return false if the channel or the settings are not valid
+		**/
+		bool setChannelFilter(int _channel, const fluicell::readingFilter::settings &_settings);
+
+		/**  \brief Get the filter on one channel
+		*
+		* @param  _channel   channel index, see PPC1dataStructures::PPC1_data::channelIndex
+		*
+		* \return the filter settings, default settings if the channel is not valid
+		**/
+		fluicell::readingFilter::settings getChannelFilter(int _channel) const;
+
 		/** \brief Check if the serial port is open and the PPC1 is connected
 		*
 		*  \return true if open
@@ -957,8 +1733,13 @@ namespace fluicell
 		* @param  _state  new sync signals state
 		**/
 		void resetSycnSignals(bool _state)  const {
-			m_PPC1_data->trigger_rise = _state;
-			m_PPC1_data->trigger_fall = _state;
+			{
+				std::lock_guard<std::mutex> lock(m_sync_mutex);
+				m_PPC1_data.setTriggers(_state, _state);
+				m_trigger_time = std::chrono::steady_clock::now();
+			}
+			// wake up a waitSync in case the signal is simulated
+			m_sync_condition.notify_all();
 		}
 
 		/** \brief Detect the sync signal arrived
@@ -973,24 +1754,35 @@ namespace fluicell
 		*  \return true when the signal is detected
 		**/
 		bool syncSignalArrived(bool _state)  const {
+			std::lock_guard<std::mutex> lock(m_sync_mutex);
 			if (_state == true) // check rise state 
-			{
-				if (m_PPC1_data->trigger_rise == true )
-				return true;
-			}
-			if (_state == false)  // check fall state
-			{
-				if (m_PPC1_data->trigger_fall == true )
-				return true;
-			}
-
-			return false;		
-			
-		}		//     "pX" is sent to make pulse output, where X is integer number equal or larger than 20 indicating the pulse length in milliseconds
+				return m_PPC1_data.getTrigger(fluicell::PPC1dataStructures::PPC1_data::trigger_rise);
+			else  // check fall state
+				return m_PPC1_data.getTrigger(fluicell::PPC1dataStructures::PPC1_data::trigger_fall);
+		}				//     "pX" is sent to make pulse output, where X is integer number equal or larger than 20 indicating the pulse length in milliseconds
 				//     "P" or "R" are use wait pulse input, either falling or rising front
 
 
 
+		/** \brief Get the latency of the waitSync command
+		*
+		*  The latency is the time between the reception of the trigger line (P or R)
+		*  and the return of the waitSync command, in microseconds
+		*
+		*  \return a copy of the latency histogram
+		**/
+		fluicell::PPC1dataStructures::latencyHistogram getSyncLatency() const {
+			std::lock_guard<std::mutex> lock(m_sync_mutex);
+			return m_sync_latency;
+		}
+
+		/** \brief Clear the waitSync latency histogram
+		**/
+		void resetSyncLatency() {
+			std::lock_guard<std::mutex> lock(m_sync_mutex);
+			m_sync_latency.reset();
+		}
+
 		/** \brief Check if an exception has been caught
 		*
 		*  \return true if exception
@@ -1002,79 +1794,79 @@ namespace fluicell
 		*
 		*  \return double recirculation set point
 		**/
-		inline double getVrecircSetPoint() const { return m_PPC1_data->channel_A->set_point; }
+		inline double getVrecircSetPoint() const { return getLastSample().channels[0].set_point; }
 
 		/** \brief get vacuum recirculation sensor reading
 		*
 		*  \return double recirculation sensor reading
 		**/
-		inline double getVrecircReading()  const { return m_PPC1_data->channel_A->sensor_reading; }
+		inline double getVrecircReading()  const { return getLastSample().channels[0].sensor_reading; }
 		
 		/** \brief get vacuum recirculation state of the error flag
 		*
 		*  \return int error flag
 		**/
-		inline int getVrecircState() const { return m_PPC1_data->channel_A->state; }
+		inline int getVrecircState() const { return getLastSample().channels[0].state; }
 
 		/** \brief get vacuum switch set point
 		*
 		*  \return double switch set point
 		**/
-		inline double getVswitchSetPoint()  const { return m_PPC1_data->channel_B->set_point; }
+		inline double getVswitchSetPoint()  const { return getLastSample().channels[1].set_point; }
 
 		/** \brief get vacuum switch sensor reading
 		*
 		*  \return double switch sensor reading
 		**/
-		inline double getVswitchReading() const { return m_PPC1_data->channel_B->sensor_reading; }
+		inline double getVswitchReading() const { return getLastSample().channels[1].sensor_reading; }
 
 		/** \brief get vacuum switch state of the error flag
 		*
 		*  \return int error flag
 		**/
-		inline int getVswitchState()  const { return m_PPC1_data->channel_B->state; }
+		inline int getVswitchState()  const { return getLastSample().channels[1].state; }
 
 		/** \brief get pressure off set point
 		*
 		*  \return double pressure off set point
 		**/
-		inline double getPoffSetPoint() const { return m_PPC1_data->channel_C->set_point; }
+		inline double getPoffSetPoint() const { return getLastSample().channels[2].set_point; }
 
 		/** \brief get pressure off sensor reading
 		*
 		*  \return double pressure off sensor reading
 		**/
-		inline double getPoffReading() const { return m_PPC1_data->channel_C->sensor_reading; }
+		inline double getPoffReading() const { return getLastSample().channels[2].sensor_reading; }
 
 		/** \brief get pressure off state of the error flag
 		*
 		*  \return int error flag
 		**/
-		inline int getPoffState()  const { return m_PPC1_data->channel_C->state; }
+		inline int getPoffState()  const { return getLastSample().channels[2].state; }
 		
 		/** \brief get pressure on set point
 		*
 		*  \return double pressure on set point
 		**/
-		inline double getPonSetPoint()  const { return m_PPC1_data->channel_D->set_point; }
+		inline double getPonSetPoint()  const { return getLastSample().channels[3].set_point; }
 
 		/** \brief get pressure on sensor reading
 		*
 		*  \return double pressure on sensor reading
 		**/
-		inline double getPonReading() const { return m_PPC1_data->channel_D->sensor_reading; }
+		inline double getPonReading() const { return getLastSample().channels[3].sensor_reading; }
 
 		/** \brief get pressure on state of the error flag
 		*
 		*  \return int error flag
 		**/
-		inline int getPonState() const { return m_PPC1_data->channel_D->state; }
+		inline int getPonState() const { return getLastSample().channels[3].state; }
 
 		/** \brief Get the communication state from the corrupted data flag
 		*
 		*  \return true if communication is ok, false in case of corrupted data
 		**/
-		inline bool getCommunicationState() const { return !m_PPC1_data->data_corrupted; }
+		inline bool getCommunicationState() const { return !getLastSample().data_corrupted; }
 
 
 		/** \brief Check if the well 1 is open
@@ -1082,7 +1874,7 @@ namespace fluicell
 		*  \return true if the well 1 is open, false otherwise
 		**/
 		bool isWeel1Open() const {
-			if (m_PPC1_data->l == 1) return true;
+			if (getLastSample().l == 1) return true;
 			else return false;
 		}
 
@@ -1091,7 +1883,7 @@ namespace fluicell
 		*  \return true if the well 2 is open, false otherwise
 		**/
 		bool isWeel2Open() const {
-			if (m_PPC1_data->k == 1) return true;
+			if (getLastSample().k == 1) return true;
 			else return false;
 		}
 
@@ -1100,7 +1892,7 @@ namespace fluicell
 		*  \return true if the well 3 is open, false otherwise
 		**/
 		bool isWeel3Open()  const {
-			if (m_PPC1_data->j == 1) return true;
+			if (getLastSample().j == 1) return true;
 			else return false;
 		}
 
@@ -1109,7 +1901,7 @@ namespace fluicell
 		*  \return true if the well 4 is open, false otherwise
 		**/
 		bool isWeel4Open() const {
-			if (m_PPC1_data->i == 1) return true;
+			if (getLastSample().i == 1) return true;
 			else return false;
 		}
 
@@ -1125,11 +1917,125 @@ namespace fluicell
 		*/
 		double protocolDuration(std::vector<fluicell::PPC1dataStructures::command> &_protocol)  const;
 
+		/** \brief Get the last complete frame received from the PPC1
+		*
+		*   All the values in the sample belong to the same frame, 
+		*   the sequence number allows to detect missing frames
+		*
+		*  \return a copy of the last sample
+		**/
+		fluicell::PPC1dataStructures::PPC1_sample getLastSample() const { return m_snapshot.load().sample; }
+
+		/** \brief Get the last complete frame and the flows calculated on it
+		*
+		*   The copy is consistent and it does not lock, the thread never waits 
+		*   for the readers. Better than calling many getters when several values 
+		*   are needed at the same time.
+		*
+		*  \return a copy of the current state
+		**/
+		fluicell::PPC1dataStructures::PPC1_snapshot getSnapshot() const { return m_snapshot.load(); }
+
+		/** \brief Create a cursor to read the samples stream
+		*
+		*   Every complete frame is pushed in a lock-free ring buffer of 
+		*   sampleBuffer::capacity() samples, each consumer (GUI, loggers, controllers) 
+		*   creates its own cursor and drains the samples at its own pace with readSamples.
+		*   The thread never waits for the readers, a reader which is too slow
+		*   loses the oldest samples, see sampleReader::lost.
+		*
+		*  \return a cursor positioned at the next sample to be received
+		**/
+		sampleReader createSampleReader() const { return m_sample_buffer.createReader(); }
+
+		/** \brief Read the samples received since the last call, oldest first
+		*
+		*  @param _reader       cursor created with createSampleReader
+		*  @param _samples      output array of samples, allocated by the caller
+		*  @param _max_samples  size of the _samples array
+		*
+		*  \return the number of samples written to _samples
+		**/
+		size_t readSamples(sampleReader &_reader,
+			fluicell::PPC1dataStructures::PPC1_sample *_samples, size_t _max_samples) const {
+			return m_sample_buffer.read(_reader, _samples, _max_samples);
+		}
+
+		/** \brief Subscribe to the PPC1 events
+		*
+		*   The callback is called for every event in _event_mask, for instance:
+		*
+		*      my_ppc1->subscribe(PPC1_event::newSample | PPC1_event::exception, my_callback);
+		*
+		*   With dispatchDirect the callback runs in the PPC1api thread, it must be short
+		*   and it must not call PPC1api functions that wait for the thread. 
+		*   With dispatchQueued the events are stored and the callback runs in the 
+		*   thread calling dispatchEvents.
+		*
+		*  @param _event_mask  combination of PPC1_event::eventType values
+		*  @param _callback    function to be called
+		*  @param _mode        dispatchDirect or dispatchQueued
+		*
+		*  \return the subscription id to be used in unsubscribe, -1 for invalid arguments
+		**/
+		int subscribe(int _event_mask, eventCallback _callback, dispatchMode _mode = dispatchDirect);
+
+		/** \brief Remove a subscription
+		*
+		*  @param _id  subscription id returned by subscribe
+		*
+		*  \return false if the id is not subscribed
+		*
+		*  \note a direct callback already running in the PPC1api thread may complete after this returns
+		**/
+		bool unsubscribe(int _id);
+
+		/** \brief Call the queued subscribers for the events received so far
+		*
+		*  @param _max_events  maximum number of events to dispatch
+		*
+		*  \return the number of events dispatched
+		**/
+		size_t dispatchEvents(size_t _max_events = 1024);
+
+		/** \brief Decode a buffer containing many lines from the PPC1
+		*
+		*   The whole buffer is split into lines and fields in a single vectorised pass
+		*   (SSE2 or AVX2 when available) and every complete frame is written into 
+		*   _samples, a frame is closed by the IN|OUT line. This allows to replay
+		*   recorded data streams or to catch up with a backlog of data.
+		*
+		*   Bytes after the last complete frame are not consumed, the caller can 
+		*   prepend them to the next buffer. Corrupted lines do not stop the decoding,
+		*   they mark the sample with data_corrupted.
+		*
+		*  @param _data          input data buffer
+		*  @param _size          number of characters in _data
+		*  @param _samples       output array of samples, allocated by the caller
+		*  @param _max_samples   size of the _samples array
+		*  @param _consumed      if not NULL it returns the number of bytes decoded
+		*
+		* \return the number of samples written to _samples
+		*
+		* \note sensor readings are not filtered
+		*/
+		size_t decodeBuffer(const char *_data, size_t _size,
+			fluicell::PPC1dataStructures::PPC1_sample *_samples, size_t _max_samples,
+			size_t *_consumed = NULL) const;
+
 		/** \brief Get the pipette status 
 		*
 		*  \return a copy of the data member
 		**/
-		const fluicell::PPC1dataStructures::PPC1_status* getPipetteStatus() const { return m_PPC1_status; }
+		fluicell::PPC1dataStructures::PPC1_status getPipetteStatus() const { return m_snapshot.load().status; }
+
+		/** \brief Get the counters of the data stream
+		*
+		*  Useful to check that no data are lost when the stream period is low
+		*
+		*  \return a copy of the current counters
+		**/
+		fluicell::PPC1dataStructures::streamCounters getStreamCounters() const;
    };
 
 }
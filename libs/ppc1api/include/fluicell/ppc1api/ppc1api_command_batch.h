@@ -0,0 +1,310 @@
+/*  +---------------------------------------------------------------------------+
+*  |                                                                           |
+*  | Fluicell AB, http://fluicell.com/                                         |
+*  | PPC1 API                                                                  |
+*  |                                                                           |
+*  | Authors: Mauro Bellone - http://www.maurobellone.com                      |
+*  | Released under GNU GPL License.                                           |
+*  +---------------------------------------------------------------------------+ */
+
+#pragma once
+
+// standard libraries
+#include <cstddef>
+#include <cmath>
+
+#include "ppc1api_data_structures.h"
+
+
+/**  \brief Define the Fluicell namespace, all the classes will be in here
+  *
+  **/
+namespace fluicell
+{
+
+	/**  \brief Commands for the PPC1 packed in one buffer, to be sent with a single write
+	*
+	*    The commands are formatted in a fixed size buffer, so building a batch
+	*    never allocates. The channel set points in the batch are remembered,
+	*    so PPC1api::sendBatch can wait for the PPC1 to confirm them.
+	*
+	*    Usage:
+	*		- 	fluicell::commandBatch batch;
+	*		- 	batch.setVacuumChannelA(-115.0);
+	*		- 	batch.setPressureChannelD(190.0);
+	*		- 	batch.setValvesState(0x01);
+	*		- 	my_ppc1.sendBatch(batch);
+	*
+	* \note the set methods return false and leave the batch unchanged when the
+	*       value is out of range or the buffer is full
+	**/
+	class commandBatch
+	{
+	public:
+
+		static const size_t max_size = 256;     //!< buffer size, more than enough for every command once
+		static const int number_of_channels = 4;
+
+		/**  \brief Constructor, the batch is empty
+		**/
+		commandBatch() { clear(); }
+
+		/**  \brief Remove all the commands
+		**/
+		void clear()
+		{
+			m_size = 0;
+			m_has_valves = false;
+			m_valves = 0;
+			m_other_commands = false;
+			for (int i = 0; i < number_of_channels; i++) {
+				m_has_set_point[i] = false;
+				m_set_point[i] = 0.0;
+			}
+		}
+
+		/**  \brief Add the command A%f\n, range [MIN_CHAN_A, MAX_CHAN_A] in mbar
+		**/
+		bool setVacuumChannelA(double _value) {
+			return appendSetPoint(fluicell::PPC1dataStructures::PPC1_data::channel_A, 'A', _value, MIN_CHAN_A, MAX_CHAN_A);
+		}
+
+		/**  \brief Add the command B%f\n, range [MIN_CHAN_B, MAX_CHAN_B] in mbar
+		**/
+		bool setVacuumChannelB(double _value) {
+			return appendSetPoint(fluicell::PPC1dataStructures::PPC1_data::channel_B, 'B', _value, MIN_CHAN_B, MAX_CHAN_B);
+		}
+
+		/**  \brief Add the command C%f\n, range [MIN_CHAN_C, MAX_CHAN_C] in mbar
+		**/
+		bool setPressureChannelC(double _value) {
+			return appendSetPoint(fluicell::PPC1dataStructures::PPC1_data::channel_C, 'C', _value, MIN_CHAN_C, MAX_CHAN_C);
+		}
+
+		/**  \brief Add the command D%f\n, range [MIN_CHAN_D, MAX_CHAN_D] in mbar
+		**/
+		bool setPressureChannelD(double _value) {
+			return appendSetPoint(fluicell::PPC1dataStructures::PPC1_data::channel_D, 'D', _value, MIN_CHAN_D, MAX_CHAN_D);
+		}
+
+		/**  \brief Add the set point of a channel, see PPC1_data::channelIndex
+		**/
+		bool setChannel(int _channel, double _value)
+		{
+			switch (_channel) {
+			case fluicell::PPC1dataStructures::PPC1_data::channel_A: return setVacuumChannelA(_value);
+			case fluicell::PPC1dataStructures::PPC1_data::channel_B: return setVacuumChannelB(_value);
+			case fluicell::PPC1dataStructures::PPC1_data::channel_C: return setPressureChannelC(_value);
+			case fluicell::PPC1dataStructures::PPC1_data::channel_D: return setPressureChannelD(_value);
+			default: return false;
+			}
+		}
+
+		/**  \brief Add the command v%02x\n, one bit for each valve from MSB=e to LSB=l
+		**/
+		bool setValvesState(int _value)
+		{
+			if (_value < 0 || _value > 0xff || m_size + 4 > max_size)
+				return false;
+			const char hex[] = "0123456789abcdef";
+			m_buffer[m_size++] = 'v';
+			m_buffer[m_size++] = hex[(_value >> 4) & 0x0f];
+			m_buffer[m_size++] = hex[_value & 0x0f];
+			m_buffer[m_size++] = '\n';
+			m_has_valves = true;
+			m_valves = _value;
+			return true;
+		}
+
+		/**  \brief Add a command without value, e.g. !\n
+		*
+		*  @param _command  command character
+		**/
+		bool addCommand(char _command)
+		{
+			if (m_size + 2 > max_size)
+				return false;
+			m_buffer[m_size++] = _command;
+			m_buffer[m_size++] = '\n';
+			m_other_commands = true;
+			return true;
+		}
+
+		/**  \brief Add a command with an integer value, e.g. p%d\n
+		*
+		*  @param _command  command character
+		*  @param _value    value
+		**/
+		bool addCommand(char _command, int _value)
+		{
+			if (!appendInteger(_command, _value))
+				return false;
+			m_other_commands = true;
+			return true;
+		}
+
+		/**  \brief Add a command with a decimal value, e.g. A%f\n
+		*
+		*  The value is written with 6 decimals as std::to_string does
+		*
+		*  @param _command  command character
+		*  @param _value    value, |_value| < 1e12
+		**/
+		bool addCommand(char _command, double _value)
+		{
+			if (!appendDecimal(_command, _value))
+				return false;
+			m_other_commands = true;
+			return true;
+		}
+
+		/**  \brief Formatted commands, not null terminated
+		**/
+		const char *data() const { return m_buffer; }
+
+		/**  \brief Number of characters in the batch
+		**/
+		size_t size() const { return m_size; }
+
+		/**  \brief True if there are no commands
+		**/
+		bool empty() const { return m_size == 0; }
+
+		/**  \brief True if the batch sets the channel, see PPC1_data::channelIndex
+		**/
+		bool hasSetPoint(int _channel) const {
+			return _channel >= 0 && _channel < number_of_channels && m_has_set_point[_channel];
+		}
+
+		/**  \brief Last set point added for the channel, see PPC1_data::channelIndex
+		**/
+		double getSetPoint(int _channel) const { return m_set_point[_channel]; }
+
+		/**  \brief True if the batch sets the valves with setValvesState
+		**/
+		bool hasValvesState() const { return m_has_valves; }
+
+		/**  \brief Last valves state added, see setValvesState
+		**/
+		int getValvesState() const { return m_valves; }
+
+		/**  \brief True if the batch has commands added with addCommand, 
+		*          these are not described by the set points and the valves state
+		**/
+		bool hasOtherCommands() const { return m_other_commands; }
+
+		/**  \brief Write a decimal value with 6 decimals, no allocation and no locale
+		*
+		*  The value is rounded as printf("%f") does in the default rounding mode, 
+		*  to the nearest on the exact binary value and to even on exact ties, 
+		*  so the result is the same as std::to_string
+		*
+		*  @param _buffer  output, at least 21 characters
+		*  @param _value   value, |_value| < 1e12
+		*
+		* \return the number of characters written, 0 if the value cannot be written
+		**/
+		static size_t formatDecimal(char *_buffer, double _value)
+		{
+			if (!(std::abs(_value) < 1e12))  // also false for NaN
+				return 0;
+			// the integer part and the fraction are exact, fma gives the exact 
+			// rounding error of fraction * 1e6 to decide the last digit
+			const double value = std::abs(_value);
+			const double integer = std::floor(value);
+			const double product = (value - integer) * 1e6;
+			const double error = std::fma(value - integer, 1e6, -product);
+			const double digits = std::floor(product);
+			const double above_half = (product - digits - 0.5) + error;  // exact sign
+			unsigned long long fraction = static_cast<unsigned long long>(digits);
+			if (above_half > 0.0 || (above_half == 0.0 && fraction % 2 == 1))
+				fraction++;
+			unsigned long long whole = static_cast<unsigned long long>(integer);
+			if (fraction == 1000000) {
+				whole++;
+				fraction = 0;
+			}
+
+			size_t n = 0;
+			if (std::signbit(_value))
+				_buffer[n++] = '-';
+			n += formatInteger(&_buffer[n], whole);
+			_buffer[n++] = '.';
+			for (int i = 5; i >= 0; i--) {
+				_buffer[n + i] = static_cast<char>('0' + fraction % 10);
+				fraction /= 10;
+			}
+			return n + 6;
+		}
+
+		/**  \brief Write an unsigned integer value
+		*
+		*  @param _buffer  output, at least 20 characters
+		*  @param _value   value
+		*
+		* \return the number of characters written
+		**/
+		static size_t formatInteger(char *_buffer, unsigned long long _value)
+		{
+			char reversed[20];
+			size_t n = 0;
+			do {
+				reversed[n++] = static_cast<char>('0' + _value % 10);
+				_value /= 10;
+			} while (_value != 0);
+			for (size_t i = 0; i < n; i++)
+				_buffer[i] = reversed[n - 1 - i];
+			return n;
+		}
+
+	private:
+
+		bool appendInteger(char _command, int _value)
+		{
+			char digits[20];
+			size_t n = formatInteger(digits, _value < 0 ? -static_cast<long long>(_value) : _value);
+			size_t length = 1 + (_value < 0 ? 1 : 0) + n + 1;
+			if (m_size + length > max_size)
+				return false;
+			m_buffer[m_size++] = _command;
+			if (_value < 0)
+				m_buffer[m_size++] = '-';
+			for (size_t i = 0; i < n; i++)
+				m_buffer[m_size++] = digits[i];
+			m_buffer[m_size++] = '\n';
+			return true;
+		}
+
+		bool appendDecimal(char _command, double _value)
+		{
+			char digits[32];
+			size_t n = formatDecimal(digits, _value);
+			if (n == 0 || m_size + n + 2 > max_size)
+				return false;
+			m_buffer[m_size++] = _command;
+			for (size_t i = 0; i < n; i++)
+				m_buffer[m_size++] = digits[i];
+			m_buffer[m_size++] = '\n';
+			return true;
+		}
+
+		bool appendSetPoint(int _channel, char _command, double _value, double _min, double _max)
+		{
+			if (!(_value >= _min && _value <= _max))
+				return false;
+			if (!appendDecimal(_command, _value))
+				return false;
+			m_has_set_point[_channel] = true;
+			m_set_point[_channel] = _value;
+			return true;
+		}
+
+		char m_buffer[max_size];                       //!< formatted commands
+		size_t m_size;                                 //!< characters in m_buffer
+		bool m_has_set_point[number_of_channels];      //!< channels set in this batch
+		double m_set_point[number_of_channels];        //!< last value set for each channel
+		bool m_has_valves;                             //!< valves state set in this batch
+		int m_valves;                                  //!< last valves state
+		bool m_other_commands;                         //!< commands added with addCommand
+	};
+}
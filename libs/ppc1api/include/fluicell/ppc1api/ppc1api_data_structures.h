@@ -29,7 +29,9 @@
 
 // standard libraries 
 #include <string>
-#include <numeric>
+#include <array>
+#include <type_traits>
+#include <chrono>
 
 
 /**  \brief Define the Fluicell namespace, all the classes will be in here
@@ -145,47 +147,34 @@ namespace fluicell { namespace PPC1dataStructures
 			*                 In this case the output and set point will be set to 0.
 			*                 The error flag clears when a new set point is set.
 			*
+			* \note the filter on the sensor reading is applied by PPC1api, see PPC1api::setFilterEnabled
 			**/
 			struct channel
 			{
 			public:
 				double set_point;                 //!< the closed loop PID controller input value (in mbar)
-				double sensor_reading;            //!< the actual current pressure value (in mbar), filtered if active
+				double sensor_reading;            //!< the actual current pressure value (in mbar)
 				double PID_out_DC;                //!< PID_out_DC PID output duty cycle is the output value of closed loop PID controller.
 				int state;                        //!< state shows error flags
 
+			public:
+
 				/**  \brief Set channel data
 				*
 				*    It allows the to set all the data in the channel in one line by giving all the data in one line.
-				*    this function also includes the data filtering function on the sensor reading, it uses two
-				*    class members: m_filter_enabled and m_filter_size
-				*
-				*    The implemented filter is a rolling average filter that averages the last n samples, 
-				*    where n is defined in the class member m_filter_size
 				*
 				*   @param _set_point 
 				*   @param _sensor_reading  
 				*   @param PID_out_DC 
 				*   @param _state 
-				*    
-				*
 				**/
 				void setChannelData(const double _set_point, const double _sensor_reading, 
 					const double PID_out_DC, const int _state)
 				{
 					this->set_point = _set_point;
-					//this->sensor_reading = _sensor_reading;
+					this->sensor_reading = _sensor_reading;
 					this->PID_out_DC = PID_out_DC;
 					this->state = _state;
-
-					if (m_filter_enabled) {
-						// TODO: enable lowPassFiltering to improve efficiency but mantain same behavior
-						//this->sensor_reading = movingAveragefilter(m_reading_vec, _sensor_reading);
-						this->sensor_reading = lowPassFilter(this->sensor_reading, _sensor_reading);
-					}
-					else {
-						this->sensor_reading = _sensor_reading;
-					}
 				}
 
 				/**  \brief Constructor for PPC1 channel data container
@@ -195,83 +184,52 @@ namespace fluicell { namespace PPC1dataStructures
 					set_point(0.0), 
 					sensor_reading(0.0),
 					PID_out_DC(0.0), 
-					state(0),
-					m_filter_enabled(true),
-					m_filter_size(20),
-					m_filter_alpha(0.1)
+					state(0)
 				{}
-				
-				bool isFilterEnables() { return m_filter_enabled; }
-				void enableFilter(bool _enable) { m_filter_enabled = _enable; }
-				int getFiltersize() { return m_filter_size; }
-				void setFiltersize(int _size) { m_filter_size = _size; }
-				double getFilterAlpha() { return m_filter_alpha; }
-				void setFilterAlpha(double _alpha) { m_filter_alpha = _alpha; }
-			private:
-
-				double lowPassFilter(const double lastValue, const double currentValue) const
-				{
-					double value = (1 - m_filter_alpha)*lastValue + m_filter_alpha * currentValue;
-					return value;
-				}
-				/**  \brief Implement a moving average filter of PPC1 data
-				*
-				*   @param _reading_vec the stack containing the history of readings
-				*   @param _sensor_reading the actual sensor reading
-				*
-				*
-				*  \note: it make use of m_filter_size data member for the size of the filter
-				*
-				*   \return the filtered value
-				*
-				**/
-				double movingAveragefilter(std::vector<double> &_reading_vec, double _sensor_reading)
-				{
-					if (_reading_vec.size() < m_filter_size) {
-						_reading_vec.push_back(_sensor_reading);
-					}
-					else {
-						_reading_vec.erase(_reading_vec.begin());
-						while (_reading_vec.size() > m_filter_size) {
-							_reading_vec.erase(_reading_vec.begin());
-						}
-						this->m_reading_vec.push_back(_sensor_reading);
-					}
-
-					double sum = std::accumulate(_reading_vec.begin(), _reading_vec.end(), 0.0);
-					double filtered_reading = sum / _reading_vec.size();
-					return filtered_reading; 
-				}
-
-				bool m_filter_enabled;          //!< class member to enable to filtering in the data reading
-				unsigned int m_filter_size;     //!< class member to set the filter size
-				double m_filter_alpha;          //!< alpha for the low pass filter
-				std::vector<double> m_reading_vec;   //!< internal vector used for the filter to save the history
 			};
 
-		public: 
-
-			channel *channel_A;  //!< pointer to vacuum channel A   --- V_recirc
-			channel *channel_B;  //!< pointer to vacuum channel B   --- V_switch
-			channel *channel_C;  //!< pointer to pressure channel C --- P_off
-			channel *channel_D;  //!< pointer to pressure channel D --- P_on
+			/**  \brief Index of the channels in PPC1_data::channels
+			**/
+			enum channelIndex {
+				channel_A = 0,  //!< vacuum channel A   --- V_recirc
+				channel_B = 1,  //!< vacuum channel B   --- V_switch
+				channel_C = 2,  //!< pressure channel C --- P_off
+				channel_D = 3   //!< pressure channel D --- P_on
+			};
 
 			/*	i%u | j%u | k%u | l%u\n where the characters i, j, k and l 
 			*   mark the output channels 8, 7, 6, 5 respectively and %u is 1 when the
 			*	output channel is connected to pressure channel D and 0 when channel C.
 			*/
-			int i;  //!< 8
-			int j;  //!< 7
-			int k;  //!< 6
-			int l;  //!< 5
+			enum valveBits {
+				valve_i = 0x01,  //!< 8
+				valve_j = 0x02,  //!< 7
+				valve_k = 0x04,  //!< 6
+				valve_l = 0x08   //!< 5
+			};
+
+			/**  \brief Bits in PPC1_data::flags
+			**/
+			enum flagBits {
+				ppc1_IN = 0x01,         //!< INx where x is either 0 or 1 and shows the input state
+				ppc1_OUT = 0x02,        //!< OUTy where y is either 0 or 1 and shows the output state
+				data_corrupted = 0x04   //!< set in case of corrupted data
+			};
 
-			int ppc1_IN;  //!< INx where x and y are either 0 or 1 and show the input state.
-			int ppc1_OUT; //!< OUTy where x and y are either 0 or 1 and show the output state
+			/**  \brief Bits in PPC1_data::triggers, they are false always and 
+			*           become true when the trigger is detected
+			**/
+			enum triggerBits {
+				trigger_fall = 0x01,
+				trigger_rise = 0x02
+			};
 
-			bool trigger_fall;   //!< this is false always, it becomes true when the trigger (fall) is detected
-			bool trigger_rise;  //!< this is false always, it becomes true when the trigger (rise) is detected
-			bool TTL_out_trigger;    //!< true = high, false = low
-			bool data_corrupted;     //!< true in case of corrupted data, false otherwise
+		public: 
+
+			std::array<channel, 4> channels;  //!< channels A, B, C, D, see channelIndex
+			unsigned char valves;             //!< valves i, j, k, l, see valveBits
+			unsigned char flags;              //!< input, output and data corrupted, see flagBits
+			unsigned char triggers;           //!< see triggerBits, kept apart from flags as it is also written by waitSync
 
 		public:
 
@@ -279,135 +237,377 @@ namespace fluicell { namespace PPC1dataStructures
 			*
 			**/
 			PPC1_data() :
-				channel_A(new channel),
-				channel_B(new channel),
-				channel_C(new channel),
-				channel_D(new channel),
-				i(0), j(0), k(0), l(0),
-				ppc1_IN(0), ppc1_OUT(0),
-				TTL_out_trigger(false),
-				trigger_fall(false),
-				trigger_rise(false),
-				data_corrupted(false)
+				valves(0),
+				flags(0),
+				triggers(0)
 			{ }
 
-			/**  \brief Set size for the rolling average filter
-			*
-			*   @param _size size of the filter, accepts positive values, reasonable values are between [10 - 30]
-			*
-			*   \return false in case of negative _size
+			/**  \brief State of one valve
 			*
+			*   \return 1 if the output channel is connected to pressure channel D, 0 for channel C
+			**/
+			int getValve(valveBits _valve) const { return (valves & _valve) ? 1 : 0; }
+
+			/**  \brief Set the state of all the valves, admitted values are only 0 and 1
 			**/
-			void enableFilter(bool _enable) {
-								
-				this->channel_A->enableFilter(_enable);
-				this->channel_B->enableFilter(_enable);
-				this->channel_C->enableFilter(_enable);
-				this->channel_D->enableFilter(_enable);
-				
+			void setValves(int _i, int _j, int _k, int _l) {
+				valves = static_cast<unsigned char>(
+					(_i ? valve_i : 0) | (_j ? valve_j : 0) | (_k ? valve_k : 0) | (_l ? valve_l : 0));
 			}
 
-			/**  \brief Set size for the rolling average filter
-			*
-			*   @param _size size of the filter, accepts positive values, reasonable values are between [10 - 30]
-		    * 
-			*   \return false in case of negative _size
+			bool getFlag(flagBits _flag) const { return (flags & _flag) != 0; }
+			void setFlag(flagBits _flag, bool _value) {
+				flags = static_cast<unsigned char>(_value ? (flags | _flag) : (flags & ~_flag));
+			}
+
+			bool getTrigger(triggerBits _trigger) const { return (triggers & _trigger) != 0; }
+			void setTriggers(bool _fall, bool _rise) {
+				triggers = static_cast<unsigned char>((_fall ? trigger_fall : 0) | (_rise ? trigger_rise : 0));
+			}
+		};
+		static_assert(std::is_trivially_copyable<PPC1_data>::value,
+			"PPC1_data must be trivially copyable");
+
+
+		/**  \brief One complete frame of data from the PPC1
+		*
+		*    A frame is the group of lines streamed by the PPC1 at every period:
+		*
+		*      A|-0.000000|0.114514|0.000000|0\n
+		*      B|-0.000000|0.034291|0.000000|0\n
+		*      C|0.000000|-0.103121|0.000000|0\n
+		*      D|0.000000|0.028670|0.000000|0\n
+		*      i0|j0|k0|l0\n
+		*      IN1|OUT1\n
+		*
+		*    the IN|OUT line closes the frame, P and R lines (TTL triggers) belong 
+		*    to the frame they are received in. 
+		*    Differently from PPC1_data this is a plain structure, it can be freely 
+		*    copied and stored in arrays. Samples published by the PPC1api thread have 
+		*    filtered sensor readings (if the filter is enabled), samples from 
+		*    decodeBuffer have the raw values.
+		*
+		*  @param sequence        frame counter, consecutive frames have consecutive numbers
+		*  @param timestamp       time of reception of the last line of the frame
+		*  @param channels        channel data, index 0 to 3 for A, B, C, D
+		*  @param i, j, k, l      valves state, 1 = open
+		*  @param ppc1_IN         TTL input state
+		*  @param ppc1_OUT        TTL output state
+		*  @param trigger_fall    true if a falling TTL (P) was received in this frame
+		*  @param trigger_rise    true if a rising TTL (R) was received in this frame
+		*  @param data_corrupted  true if at least one line in the frame could not be decoded
+		**/
+		struct PPC1_sample
+		{
+		public:
+
+			/**  \brief Channel values in a sample
+			**/
+			typedef PPC1_data::channel channelSample;
+
+			unsigned long long sequence;
+			std::chrono::steady_clock::time_point timestamp;
+			channelSample channels[4];
+			int i;
+			int j;
+			int k;
+			int l;
+			int ppc1_IN;
+			int ppc1_OUT;
+			bool trigger_fall;
+			bool trigger_rise;
+			bool data_corrupted;
+
+		public:
+
+			PPC1_sample() :
+				sequence(0), 
+				i(0), j(0), k(0), l(0), ppc1_IN(0), ppc1_OUT(0),
+				trigger_fall(false), trigger_rise(false), data_corrupted(false)
+			{ }
+		};
+
+
+		/**  \brief Event notified by PPC1api to the subscribers, see PPC1api::subscribe
+		*
+		*  @param type     what happened, one of the eventType values
+		*  @param sample   last complete frame, for trigger events the frame under construction
+		*  @param message  description of the exception, empty for the other events
+		**/
+		struct PPC1_event
+		{
+		public:
+
+			/**  \brief Event types, they can be combined in a mask
+			**/
+			enum eventType {
+				newSample = 0x01,         //!< a complete frame has been received
+				triggerRise = 0x02,       //!< rising TTL signal detected (R line)
+				triggerFall = 0x04,       //!< falling TTL signal detected (P line)
+				valvesChanged = 0x08,     //!< the state of the valves i, j, k, l changed
+				corruptedFrame = 0x10,    //!< at least one line in the frame could not be decoded
+				exception = 0x20,         //!< the thread stopped because of an exception
+				allEvents = 0x3F
+			};
+
+			eventType type;
+			PPC1_sample sample;
+			std::string message;
+
+		public:
+
+			PPC1_event() : type(newSample) {}
+
+			PPC1_event(eventType _type, const PPC1_sample &_sample) :
+				type(_type), sample(_sample) {}
+		};
+
+
+		/**  \brief PPC1_status structure contains the inflow and outflow data for each well in the pipette
+		*
+		*   All the values are in the table flows, see flowIndex for the content, e.g. 
+		*          double outflow = status.flows[PPC1_status::outflow_on];
+		*          double well_3 = status.getFlowRate(3);
+		*
+		*  \note : TODO: the guide is still not entirely complete
+		**/
+		struct PPC1_status
+		{
+		public: 
+
+			/**  \brief Position of the values in the table flows
+			**/
+			enum flowIndex {
+				delta_pressure = 0,
+				pipe_length,
+				outflow_on,
+				outflow_off,
+				outflow_tot,
+				inflow_recirculation,
+				inflow_switch,
+				in_out_ratio_on,
+				in_out_ratio_off,
+				in_out_ratio_tot,
+				solution_usage_off,
+				solution_usage_on,
+				flow_rate_1,          //!< flow rates of the wells 1 to 8 are consecutive
+				flow_rate_2,
+				flow_rate_3,
+				flow_rate_4,
+				flow_rate_5,
+				flow_rate_6,
+				flow_rate_7,
+				flow_rate_8,
+				number_of_flows
+			};
+
+			std::array<double, number_of_flows> flows;
+
+		public:
+
+			PPC1_status() { flows.fill(0.0); }
+
+			/**  \brief Flow rate of one well
 			*
+			*  @param _well  well number [1 - 8]
 			**/
-			bool setFilterSize(int _size) {
-				if (_size < 0) { 
-					std::cerr << " fluicell::PPC1_data::setFilterSize :: ---- error --- MESSAGE:"
-						 << "Size of the filter in PPC1api cannot be negative " << std::endl;
-					return false; 
+			double getFlowRate(int _well) const { return flows[flow_rate_1 + _well - 1]; }
+		};
+
+		/**  \brief Set points swept by PPC1api::buildOperatingMap
+		*
+		*   The axis are in the order pon, poff, v_switch, v_recirc (mbar), 
+		*   each axis goes from min to max included with the given step
+		*
+		*  @param min   first value of each axis
+		*  @param max   last value of each axis
+		*  @param step  increment of each axis, it must be positive
+		**/
+		struct operatingMapRange
+		{
+		public:
+			enum axis { pon = 0, poff = 1, v_switch = 2, v_recirc = 3 };
+
+			double min[4];
+			double max[4];
+			double step[4];
+
+		public:
+			operatingMapRange() {
+				for (int n = 0; n < 4; n++) {
+					min[n] = 0.0; max[n] = 0.0; step[n] = 1.0;
 				}
-				this->channel_A->setFiltersize(_size); 
-				this->channel_A->setFilterAlpha(double(_size) / 100.0); 
-				this->channel_B->setFiltersize(_size);
-				this->channel_B->setFilterAlpha(double(_size) / 100.0);
-				this->channel_C->setFiltersize(_size);
-				this->channel_C->setFilterAlpha(double(_size) / 100.0);
-				this->channel_D->setFiltersize(_size);
-				this->channel_D->setFilterAlpha(double(_size) / 100.0);
-				return true;
 			}
 
-			/**  \brief Detor
-			*
-			*    Essentially delete all the channels data structures (pointers) initialized
+			/**  \brief Set one axis
+			**/
+			void setAxis(axis _axis, double _min, double _max, double _step) {
+				min[_axis] = _min; max[_axis] = _max; step[_axis] = _step;
+			}
+
+			/**  \brief Number of values on one axis, 0 if the axis is not valid
 			**/
-			~PPC1_data() {
-				delete channel_A;
-				delete channel_B;
-				delete channel_C;
-				delete channel_D;
+			unsigned int count(int _axis) const {
+				if (!(step[_axis] > 0.0) || max[_axis] < min[_axis])
+					return 0;
+				// tolerance on the last value for non integer steps
+				return static_cast<unsigned int>((max[_axis] - min[_axis]) / step[_axis] + 1e-9) + 1;
 			}
 		};
 
+		/**  \brief Set points for a target zone size and flow speed, see PPC1api::solveOperatingPoint
+		*
+		*  @param pon         pressure on (mbar)
+		*  @param poff        pressure off (mbar)
+		*  @param v_switch    vacuum switch (mbar), negative
+		*  @param v_recirc    vacuum recirculation (mbar), negative
+		*  @param zone_size   zone size percentage given by the set points
+		*  @param flow_speed  flow speed percentage given by the set points
+		*  @param iterations  Newton iterations used by the solver
+		**/
+		struct operatingPoint
+		{
+		public:
+			double pon;
+			double poff;
+			double v_switch;
+			double v_recirc;
+			double zone_size;
+			double flow_speed;
+			int iterations;
 
-		/**  \brief PPC1_status structure contains the inflow and outflow data for each well in the pipette
+		public:
+			operatingPoint() :
+				pon(0.0), poff(0.0), v_switch(0.0), v_recirc(0.0),
+				zone_size(0.0), flow_speed(0.0), iterations(0)
+			{}
+		};
+
+		/**  \brief Poiseuille coefficients for a tip, they only change with the tip geometry
+		*
+		*  @param tip        flow (nL/s) for a unit delta pressure (100*mbar) through the pipe to the tip
+		*  @param zone       flow (nL/s) for a unit delta pressure (100*mbar) through twice the pipe to the zone
+		*  @param tip_zone   ratio length_to_tip / length_to_zone
+		**/
+		struct flowCoefficients
+		{
+		public:
+			double tip;
+			double zone;
+			double tip_zone;
+
+		public:
+			flowCoefficients() : tip(0.0), zone(0.0), tip_zone(0.0) {}
+		};
+
+		/**  \brief Consistent view of the PPC1 state
 		*
-		*  @param delta_pressure
-		*  @param pipe_length
-		*  @param outflow_on
-		*  @param outflow_off
-		*  @param outflow_tot
-		*  @param inflow_recirculation
-		*  @param inflow_switch
-		*  @param in_out_ratio_on
-		*  @param in_out_ratio_off
-		*  @param in_out_ratio_tot
-		*  @param solution_usage_off
-		*  @param solution_usage_on
-		*  @param flow_rate_1
-		*  @param flow_rate_2
-		*  @param flow_rate_3
-		*  @param flow_rate_4
-		*  @param flow_rate_5
-		*  @param flow_rate_6
-		*  @param flow_rate_7
-		*  @param flow_rate_8
+		*    The last complete frame received and the flows calculated on it,
+		*    both fields always refer to the same frame
 		*
+		*  @param sample  last complete frame
+		*  @param status  flows calculated from sample
+		**/
+		struct PPC1_snapshot
+		{
+			PPC1_sample sample;
+			PPC1_status status;
+		};
+
+		/**  \brief Counters for the data stream coming from the PPC1
 		*
-		*  \note : TODO: the guide is still not entirely complete
+		*  @param bytes_received   total number of bytes read from the serial port
+		*  @param lines_received   number of complete lines handed to the decoder
+		*  @param lines_dropped    number of lines discarded because too long or corrupted
+		*  @param partial_lines    number of times a read timed out in the middle of a line
+		*  @param commands_skipped number of commands not sent because the PPC1 is already in that state
+		*
+		*  \note counters are reset on every connectCOM
 		**/
-		struct PPC1_status
+		struct streamCounters
 		{
-		public: 
+		public:
 
-			double delta_pressure;
-			double pipe_length;
-			double outflow_on;
-			double outflow_off; 
-			double outflow_tot; 
-			double inflow_recirculation;
-			double inflow_switch;
-			double in_out_ratio_on; 
-			double in_out_ratio_off; 
-			double in_out_ratio_tot;
-			double solution_usage_off;
-			double solution_usage_on;
-			double flow_rate_1;
-			double flow_rate_2;
-			double flow_rate_3;
-			double flow_rate_4;
-			double flow_rate_5;
-			double flow_rate_6;
-			double flow_rate_7;
-			double flow_rate_8;
+			unsigned long long bytes_received;
+			unsigned long long lines_received;
+			unsigned long long lines_dropped;
+			unsigned long long partial_lines;
+			unsigned long long commands_skipped;
 
 		public:
 
-			PPC1_status() :
-				delta_pressure(0.0), pipe_length(0.0), 
-				outflow_on(0.0), outflow_off(0.0), outflow_tot(0.0), 
-				inflow_recirculation(0.0), inflow_switch(0.0), 
-				in_out_ratio_on(0.0), in_out_ratio_off(0.0), in_out_ratio_tot(0.0), 
-				solution_usage_off(0.0), solution_usage_on(0.0),
-				flow_rate_1(0.0), flow_rate_2(0.0), flow_rate_3(0.0), flow_rate_4(0.0),
-				flow_rate_5(0.0), flow_rate_6(0.0), flow_rate_7(0.0), flow_rate_8(0.0)
+			streamCounters() :
+				bytes_received(0), lines_received(0),
+				lines_dropped(0), partial_lines(0),
+				commands_skipped(0)
 			{}
 		};
 
+		/**  \brief Histogram of latencies with logarithmic buckets
+		*
+		*    Bucket 0 counts latencies below 2 us, bucket n counts latencies 
+		*    in [2^n, 2^(n+1)) us, the last bucket counts anything longer
+		*
+		*  @param buckets   number of latencies in each bucket
+		*  @param count     total number of latencies
+		*  @param sum_us    sum of all the latencies in us
+		*  @param min_us    shortest latency in us
+		*  @param max_us    longest latency in us
+		**/
+		struct latencyHistogram
+		{
+		public:
+
+			static const int n_buckets = 32;
+
+			unsigned long long buckets[n_buckets];
+			unsigned long long count;
+			double sum_us;
+			double min_us;
+			double max_us;
+
+		public:
+
+			latencyHistogram() { reset(); }
+
+			/**  \brief Add a latency to the histogram
+			*
+			*  @param _us  latency in microseconds
+			**/
+			void add(double _us)
+			{
+				if (_us < 0.0)
+					_us = 0.0;
+				int bucket = 0;
+				unsigned long long us = static_cast<unsigned long long>(_us);
+				while (us >= 2 && bucket < n_buckets - 1) {
+					us >>= 1;
+					bucket++;
+				}
+				buckets[bucket]++;
+				if (count == 0 || _us < min_us) min_us = _us;
+				if (count == 0 || _us > max_us) max_us = _us;
+				sum_us += _us;
+				count++;
+			}
+
+			/**  \brief Average latency in microseconds, 0 if empty
+			**/
+			double mean() const { return count > 0 ? sum_us / count : 0.0; }
+
+			/**  \brief Remove all the latencies
+			**/
+			void reset()
+			{
+				for (int n = 0; n < n_buckets; n++)
+					buckets[n] = 0;
+				count = 0;
+				sum_us = 0.0;
+				min_us = 0.0;
+				max_us = 0.0;
+			}
+		};
+
 		/**  \brief Data structure handling the type of the tip
 		*
 		*  This allows to modify the type of the tip
@@ -0,0 +1,267 @@
+/*  +---------------------------------------------------------------------------+
+*  |                                                                           |
+*  | Fluicell AB, http://fluicell.com/                                         |
+*  | PPC1 API                                                                  |
+*  |                                                                           |
+*  | Authors: Mauro Bellone - http://www.maurobellone.com                      |
+*  | Released under GNU GPL License.                                           |
+*  +---------------------------------------------------------------------------+ */
+
+#pragma once
+
+// standard libraries
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+
+
+/**  \brief Define the Fluicell namespace, all the classes will be in here
+  *
+  **/
+namespace fluicell
+{
+
+	/**  \brief Filter for the sensor readings of one channel
+	*
+	*    The filter type is selected at run time, all the types keep their
+	*    state in fixed size arrays, so the filter never allocates and it can
+	*    be copied as a whole:
+	*		- 	noFilter:       the reading is not changed
+	*		- 	lowPass:        exponential moving average, parameter is alpha in (0, 1]
+	*		- 	movingAverage:  average of the last size readings, running sum O(1)
+	*		- 	median:         median of the last size readings, the window is kept sorted
+	*		- 	butterworth:    2nd order low pass IIR (biquad), parameter is the cut-off
+	*		                    frequency as a fraction of the sampling frequency in (0, 0.5)
+	*
+	*    Usage:
+	*		- 	my_filter.setup(fluicell::readingFilter::settings(fluicell::readingFilter::median, 9));
+	*		- 	double value = my_filter.apply(reading);
+	*
+	* \note the filter is not thread safe, use one filter per thread
+	**/
+	class readingFilter
+	{
+	public:
+
+		static const int max_size = 64;   //!< maximum window size for movingAverage and median
+
+		/**  \brief Available filters
+		**/
+		enum filterType {
+			noFilter = 0,
+			lowPass = 1,
+			movingAverage = 2,
+			median = 3,
+			butterworth = 4
+		};
+
+		/**  \brief Filter settings
+		*
+		*  @param type       filter type
+		*  @param size       window size for movingAverage and median, [1 - max_size]
+		*  @param parameter  alpha for lowPass, cut-off frequency ratio for butterworth
+		**/
+		struct settings
+		{
+		public:
+			filterType type;
+			int size;
+			double parameter;
+
+		public:
+			settings(filterType _type = lowPass, int _size = 20, double _parameter = 0.1) :
+				type(_type), size(_size), parameter(_parameter) {}
+
+			/**  \brief Check the settings
+			*
+			* \return false if the size or the parameter are out of range for the type
+			**/
+			bool isValid() const {
+				switch (type) {
+				case noFilter: return true;
+				case lowPass: return parameter > 0.0 && parameter <= 1.0;
+				case movingAverage:
+				case median: return size >= 1 && size <= max_size;
+				case butterworth: return parameter > 0.0 && parameter < 0.5;
+				default: return false;
+				}
+			}
+
+			/**  \brief Same type, size and parameter
+			**/
+			bool operator==(const settings &_other) const {
+				return type == _other.type && size == _other.size && parameter == _other.parameter;
+			}
+
+			bool operator!=(const settings &_other) const { return !(*this == _other); }
+		};
+
+		/**  \brief Constructor, default settings
+		**/
+		readingFilter() { setup(settings()); }
+
+		/**  \brief Change the filter, the history is cleared
+		*
+		*  @param _settings  new settings
+		*
+		* \return false if the settings are not valid, the filter is not changed in this case
+		**/
+		bool setup(const settings &_settings)
+		{
+			if (!_settings.isValid())
+				return false;
+			m_settings = _settings;
+			if (m_settings.type == butterworth)
+				butterworthCoefficients(m_settings.parameter);
+			reset();
+			return true;
+		}
+
+		/**  \brief Current settings
+		**/
+		settings getSettings() const { return m_settings; }
+
+		/**  \brief Clear the history, the next reading is taken as it is
+		**/
+		void reset()
+		{
+			m_count = 0;
+			m_position = 0;
+			m_sum = 0.0;
+			m_z1 = 0.0;
+			m_z2 = 0.0;
+		}
+
+		/**  \brief Filter a new reading
+		*
+		*  @param _reading  new reading
+		*
+		* \return the filtered value
+		**/
+		double apply(double _reading)
+		{
+			switch (m_settings.type)
+			{
+			case lowPass: {
+				if (m_count == 0) {
+					m_count = 1;
+					m_sum = _reading;
+				}
+				else {
+					m_sum += m_settings.parameter * (_reading - m_sum);
+				}
+				return m_sum;
+			}
+			case movingAverage: {
+				const int size = m_settings.size;
+				if (m_count < size) {
+					m_count++;
+				}
+				else {
+					m_sum -= m_window[m_position];
+				}
+				m_window[m_position] = _reading;
+				m_sum += _reading;
+				if (++m_position == size) {
+					m_position = 0;
+					// the running sum drifts with the rounding errors,
+					// recompute it once per window, still O(1) per reading on average
+					m_sum = 0.0;
+					for (int n = 0; n < m_count; n++)
+						m_sum += m_window[n];
+				}
+				return m_sum / m_count;
+			}
+			case median: {
+				const int size = m_settings.size;
+				if (m_count == size) {
+					// the window is full, drop the oldest reading from the sorted copy
+					removeSorted(m_window[m_position]);
+				}
+				else {
+					m_count++;
+				}
+				m_window[m_position] = _reading;
+				if (++m_position == size)
+					m_position = 0;
+				insertSorted(_reading);
+				const int n = m_count;
+				return (n & 1) ? m_sorted[n / 2] : 0.5 * (m_sorted[n / 2 - 1] + m_sorted[n / 2]);
+			}
+			case butterworth: {
+				if (m_count == 0) {
+					// start from the steady state to avoid the initial transient
+					m_count = 1;
+					m_z1 = _reading * (1.0 - m_b0);
+					m_z2 = _reading * (m_b2 - m_a2);
+				}
+				// transposed direct form II
+				const double value = m_b0 * _reading + m_z1;
+				m_z1 = m_b1 * _reading - m_a1 * value + m_z2;
+				m_z2 = m_b2 * _reading - m_a2 * value;
+				return value;
+			}
+			default:
+				return _reading;
+			}
+		}
+
+	private:
+
+		/**  \brief Bilinear transform of the 2nd order Butterworth low pass
+		*
+		*  @param _cutoff  cut-off frequency as a fraction of the sampling frequency
+		**/
+		void butterworthCoefficients(double _cutoff)
+		{
+			const double pi = 3.14159265358979323846;
+			const double k = std::tan(pi * _cutoff);
+			const double q = 1.0 / std::sqrt(2.0);
+			const double norm = 1.0 / (1.0 + k / q + k * k);
+			m_b0 = k * k * norm;
+			m_b1 = 2.0 * m_b0;
+			m_b2 = m_b0;
+			m_a1 = 2.0 * (k * k - 1.0) * norm;
+			m_a2 = (1.0 - k / q + k * k) * norm;
+		}
+
+		/**  \brief Insert a reading in the sorted copy of the window,
+		*          m_sorted has m_count - 1 valid readings before the call
+		**/
+		void insertSorted(double _reading)
+		{
+			int n = m_count - 1;
+			int first = 0, last = n;
+			while (first < last) {  // binary search of the position
+				int middle = (first + last) / 2;
+				if (m_sorted[middle] < _reading) first = middle + 1;
+				else last = middle;
+			}
+			std::memmove(&m_sorted[first + 1], &m_sorted[first], (n - first) * sizeof(double));
+			m_sorted[first] = _reading;
+		}
+
+		/**  \brief Remove a reading from the sorted copy of the window, m_sorted has m_count valid readings
+		**/
+		void removeSorted(double _reading)
+		{
+			int first = 0, last = m_count - 1;
+			while (first < last) {
+				int middle = (first + last) / 2;
+				if (m_sorted[middle] < _reading) first = middle + 1;
+				else last = middle;
+			}
+			std::memmove(&m_sorted[first], &m_sorted[first + 1], (m_count - 1 - first) * sizeof(double));
+		}
+
+		settings m_settings;           //!< current settings
+		int m_count;                   //!< readings in the history, up to the window size
+		int m_position;                //!< next position to be written in m_window
+		double m_sum;                  //!< running sum for movingAverage, last value for lowPass
+		double m_window[max_size];     //!< last readings in order of arrival
+		double m_sorted[max_size];     //!< last readings sorted, only for median
+		double m_b0, m_b1, m_b2;       //!< biquad coefficients, feedforward
+		double m_a1, m_a2;             //!< biquad coefficients, feedback
+		double m_z1, m_z2;             //!< biquad state
+	};
+}
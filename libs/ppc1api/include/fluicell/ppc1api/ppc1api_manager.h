@@ -0,0 +1,147 @@
+/*  +---------------------------------------------------------------------------+
+*  |                                                                           |
+*  | Fluicell AB, http://fluicell.com/                                         |
+*  | PPC1 API                                                                  |
+*  |                                                                           |
+*  | Authors: Mauro Bellone - http://www.maurobellone.com                      |
+*  | Released under GNU GPL License.                                           |
+*  +---------------------------------------------------------------------------+ */
+
+#pragma once
+
+// standard libraries
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "ppc1api.h"
+
+
+/**  \brief Define the Fluicell namespace, all the classes will be in here
+  *
+  **/
+namespace fluicell
+{
+
+	/**  \brief Several PPC1 in the same process
+	*
+	*    The devices are connected at the same time and their data streams share
+	*    one I/O thread, a serial::Reactor (on Windows each device has its own thread).
+	*    Each device is a normal PPC1api with its own state, the handles give
+	*    access to all its functions. The synchronised commands are queued on all
+	*    the devices before any is written, so the pipettes get them within the same millisecond.
+	*
+	*    Usage:
+	*		- 	fluicell::PPC1manager manager;
+	*		- 	manager.connect(fluicell::PPC1manager::discover());
+	*		- 	manager.run();
+	*		- 	manager.openSolution(2);                          // solution 2 on all the pipettes
+	*		- 	manager.device(0).setPressureChannelD(190.0);    // one pipette only
+	*		- 	manager.stop();
+	*
+	* \note the manager functions must be called from one thread, the device
+	*       functions are thread safe as for a single PPC1api
+	**/
+	class PPC1manager
+	{
+	public:
+
+		/**  \brief Constructor, no devices
+		**/
+		PPC1manager();
+
+		/**  \brief Destructor, the devices are stopped and disconnected
+		**/
+		~PPC1manager();
+
+		/**  \brief Serial ports with a PPC1 connected, matching PPC1_VID and PPC1_PID
+		**/
+		static std::vector<std::string> discover();
+
+		/**  \brief Connect a PPC1 on each port, all at the same time
+		*
+		*  The devices connected before are disconnected. The ports that cannot
+		*  be connected are left out, so the device indexes follow the ports connected
+		*
+		*  @param _ports  serial ports, see discover
+		*
+		* \return the number of devices connected
+		**/
+		size_t connect(const std::vector<std::string> &_ports);
+
+		/**  \brief Start streaming the data of all the devices on the shared I/O thread
+		*
+		* \return false if a device cannot start
+		**/
+		bool run();
+
+		/**  \brief Stop all the devices, as PPC1api::stop, they stay connected
+		**/
+		void stop();
+
+		/**  \brief Stop and disconnect all the devices, the handles are not valid anymore
+		**/
+		void disconnect();
+
+		/**  \brief True between run and stop
+		**/
+		bool isRunning() const { return m_running; }
+
+		/**  \brief Number of devices connected
+		**/
+		size_t size() const { return m_devices.size(); }
+
+		/**  \brief Handle of a device, valid until disconnect
+		*
+		*  @param _index  device index from 0 to size() - 1
+		**/
+		fluicell::PPC1api &device(size_t _index) { return *m_devices.at(_index); }
+
+		/**  \brief Serial port of a device
+		*
+		*  @param _index  device index from 0 to size() - 1
+		**/
+		const std::string &getPort(size_t _index) const { return m_ports.at(_index); }
+
+		/**  \brief Send one batch to each device at the same time
+		*
+		*  The writers are held until all the batches are queued, then they are
+		*  released together and each device writes its own, see PPC1api::sendBatch
+		*
+		*  @param _batches     the batch for each device, an empty batch leaves the device out
+		*  @param _timeout_ms  if positive, wait for all the devices to confirm their set points
+		*
+		* \return false if a batch was not sent or a set point was not confirmed
+		**/
+		bool sendSynchronized(const std::vector<fluicell::commandBatch> &_batches, int _timeout_ms = 0);
+
+		/**  \brief Open the same solution on all the devices at the same time, as the solution commands do
+		*
+		*  @param _solution  from 1 to 4, 0 closes all the solutions
+		*
+		* \return false if out of range or not sent to all the devices
+		**/
+		bool openSolution(int _solution);
+
+	private:
+
+		// disable copy
+		PPC1manager(const PPC1manager&);
+		PPC1manager& operator=(const PPC1manager&);
+
+		/**  \brief True if the hardware id of a port has the PPC1 VID and PID
+		*
+		*  @param _hardware_id  e.g. USB\VID_16D0&PID_083A&REV_0200 on Windows, USB VID:PID=16d0:083a on Linux
+		**/
+		static bool matchVIDPID(const std::string &_hardware_id);
+
+		static const unsigned int m_tick_period = 100;  //!< in ms, the set point confirmations expire with this resolution
+
+#if !defined(_WIN32)
+		std::unique_ptr<serial::Reactor> m_reactor;     //!< shared I/O thread, created by the first run, it outlives the devices
+#endif
+		std::vector<std::unique_ptr<fluicell::PPC1api> > m_devices;  //!< connected devices
+		std::vector<std::string> m_ports;               //!< port of each device
+		bool m_running;                                 //!< true between run and stop
+	};
+}
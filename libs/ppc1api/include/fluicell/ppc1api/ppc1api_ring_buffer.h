@@ -0,0 +1,194 @@
+/*  +---------------------------------------------------------------------------+
+*  |                                                                           |
+*  | Fluicell AB, http://fluicell.com/                                         |
+*  | PPC1 API                                                                  |
+*  |                                                                           |
+*  | Authors: Mauro Bellone - http://www.maurobellone.com                      |
+*  | Released under GNU GPL License.                                           |
+*  +---------------------------------------------------------------------------+ */
+
+#pragma once
+
+// standard libraries
+#include <cstddef>
+#include <atomic>
+#include <type_traits>
+
+
+/**  \brief Define the Fluicell namespace, all the classes will be in here
+  *
+  **/
+namespace fluicell
+{
+
+	/**  \brief Lock-free ring buffer with one writer and many readers
+	*
+	*    The writer never waits: when the buffer is full the oldest elements are
+	*    overwritten. Every reader has its own cursor (ringBuffer::reader) and
+	*    drains the buffer at its own pace, a reader that falls behind by more
+	*    than the capacity loses the oldest elements and the loss is counted
+	*    in the cursor.
+	*
+	*    Each slot carries a sequence number written before and after the element
+	*    (as in a seqlock), so a reader detects an element overwritten while it
+	*    was copying it.
+	*
+	*    Usage:
+	*		- 	writer thread:       my_buffer.push(element);
+	*		- 	create a cursor:     fluicell::ringBuffer<T, 1024>::reader my_reader = my_buffer.createReader();
+	*		- 	reader thread:       size_t n = my_buffer.read(my_reader, elements, max_elements);
+	*
+	*  @param T         element type, it must be trivially copyable
+	*  @param Capacity  number of elements, it must be a power of 2
+	*
+	* \note only one thread can call push
+	**/
+	template <typename T, size_t Capacity>
+	class ringBuffer
+	{
+		static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+			"ringBuffer capacity must be a power of 2");
+		static_assert(std::is_trivially_copyable<T>::value,
+			"ringBuffer elements must be trivially copyable");
+
+		static const size_t m_cache_line = 64;   //!< padding used to keep writer and readers on different cache lines
+
+	public:
+
+		/**  \brief Read cursor, one for each reader
+		*
+		*  @param position  index of the next element to be read
+		*  @param lost      number of elements overwritten before this reader could read them
+		**/
+		struct reader
+		{
+			unsigned long long position;
+			unsigned long long lost;
+
+		private:
+			char m_padding[m_cache_line - 2 * sizeof(unsigned long long)];
+		};
+
+		/**  \brief Constructor, the buffer is empty
+		**/
+		ringBuffer() : m_head(0)
+		{
+			for (size_t i = 0; i < Capacity; i++)
+				m_slots[i].sequence.store(0, std::memory_order_relaxed);
+		}
+
+		/**  \brief Append an element, the oldest element is overwritten if the buffer is full
+		*
+		*  @param _value  element to be copied in the buffer
+		*
+		* \note only one thread can call push
+		**/
+		void push(const T &_value)
+		{
+			const unsigned long long position = m_head.load(std::memory_order_relaxed);
+			slot &s = m_slots[position & (Capacity - 1)];
+
+			// odd sequence while the element is being written
+			s.sequence.store(2 * position + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			s.value = _value;
+			s.sequence.store(2 * position + 2, std::memory_order_release);
+
+			m_head.store(position + 1, std::memory_order_release);
+		}
+
+		/**  \brief Create a cursor to read the elements pushed from now on
+		*
+		* \return the new cursor
+		**/
+		reader createReader() const
+		{
+			reader r;
+			r.position = m_head.load(std::memory_order_acquire);
+			r.lost = 0;
+			return r;
+		}
+
+		/**  \brief Copy the elements not yet read by _reader, oldest first
+		*
+		*  @param _reader  cursor of the calling reader, it is moved after the last element read
+		*  @param _values  output array
+		*  @param _max_values  size of the output array
+		*
+		* \return the number of elements copied in _values
+		*
+		* \note lock-free and it never blocks the writer
+		**/
+		size_t read(reader &_reader, T *_values, size_t _max_values) const
+		{
+			size_t n_values = 0;
+			unsigned long long head = m_head.load(std::memory_order_acquire);
+			while (n_values < _max_values && _reader.position < head)
+			{
+				// elements older than the capacity are already overwritten
+				if (head - _reader.position > Capacity) {
+					_reader.lost += head - Capacity - _reader.position;
+					_reader.position = head - Capacity;
+				}
+
+				const slot &s = m_slots[_reader.position & (Capacity - 1)];
+				const unsigned long long expected = 2 * _reader.position + 2;
+				const unsigned long long before = s.sequence.load(std::memory_order_acquire);
+				if (before == expected) {
+					_values[n_values] = s.value;
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if (s.sequence.load(std::memory_order_relaxed) == expected) {
+						n_values++;
+						_reader.position++;
+						continue;
+					}
+				}
+
+				// the writer lapped this reader, move ahead and try again
+				head = m_head.load(std::memory_order_acquire);
+				if (head - _reader.position <= Capacity) {
+					_reader.lost++;
+					_reader.position++;
+				}
+			}
+			return n_values;
+		}
+
+		/**  \brief Number of elements available to _reader
+		*
+		* \return the number of elements, at most the capacity
+		**/
+		size_t available(const reader &_reader) const
+		{
+			unsigned long long count = m_head.load(std::memory_order_acquire) - _reader.position;
+			return count > Capacity ? Capacity : static_cast<size_t>(count);
+		}
+
+		/**  \brief Total number of elements pushed since the creation
+		**/
+		unsigned long long pushed() const { return m_head.load(std::memory_order_acquire); }
+
+		/**  \brief Capacity of the buffer
+		**/
+		size_t capacity() const { return Capacity; }
+
+	private:
+
+		// disable copy
+		ringBuffer(const ringBuffer&);
+		ringBuffer& operator=(const ringBuffer&);
+
+		/**  \brief One element with its sequence number, even when the element is complete
+		**/
+		struct slot
+		{
+			std::atomic<unsigned long long> sequence;
+			T value;
+		};
+
+		char m_padding_before[m_cache_line];          //!< keep m_head on its own cache line
+		std::atomic<unsigned long long> m_head;       //!< index of the next element to be written
+		char m_padding_after[m_cache_line - sizeof(std::atomic<unsigned long long>)];
+		slot m_slots[Capacity];                       //!< elements
+	};
+}
@@ -0,0 +1,171 @@
+/*  +---------------------------------------------------------------------------+
+*  |                                                                           |
+*  | Fluicell AB, http://fluicell.com/                                         |
+*  | PPC1 API                                                                  |
+*  |                                                                           |
+*  | Authors: Mauro Bellone - http://www.maurobellone.com                      |
+*  | Released under GNU GPL License.                                           |
+*  +---------------------------------------------------------------------------+ */
+
+#pragma once
+
+// standard libraries
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include "ppc1api_data_structures.h"
+#include "ppc1api_stop_token.h"
+
+
+/**  \brief Define the Fluicell namespace, all the classes will be in here
+  *
+  **/
+namespace fluicell
+{
+
+	/**  \brief Run a protocol on absolute deadlines
+	*
+	*    The protocol is compiled into the time of each step from a single start
+	*    timestamp: the wait commands only move the time line forward, they are
+	*    not executed. The other commands run one after the other on the scheduler
+	*    thread, each as soon as its deadline is reached. A slow command delays the
+	*    following ones until the next wait absorbs the delay, so the schedule 
+	*    does not drift, however long the protocol is.
+	*
+	*    Commands with an unknown duration (ask_msg, waitSync) move the rest of
+	*    the time line by the time they take.
+	*
+	*    Usage:
+	*		- 	fluicell::protocolScheduler scheduler;
+	*		- 	scheduler.start(protocol, [&](const command &_cmd) { return my_ppc1->runCommand(_cmd); });
+	*		- 	bool success = scheduler.wait();
+	*		- 	std::vector<fluicell::protocolScheduler::stepReport> report = scheduler.getReport();
+	*
+	* \note the runner is called on the scheduler thread
+	**/
+	class protocolScheduler
+	{
+	public:
+
+		/**  \brief Function running one command, it returns false on errors
+		**/
+		typedef std::function<bool(const fluicell::PPC1dataStructures::command &)> commandRunner;
+
+		/**  \brief Time line of one step and how it went
+		*
+		*  @param index        position of the command in the protocol
+		*  @param deadline_ms  planned start time from the protocol start in ms
+		*  @param lateness_ms  actual start time minus the deadline in ms
+		*  @param success      result of the runner
+		**/
+		struct stepReport
+		{
+			size_t index;
+			double deadline_ms;
+			double lateness_ms;
+			bool success;
+		};
+
+		/**  \brief Function called after each step, on the scheduler thread
+		**/
+		typedef std::function<void(const stepReport &)> stepCallback;
+
+		/**  \brief Constructor, nothing is running
+		**/
+		protocolScheduler();
+
+		/**  \brief Destructor, stops the protocol and waits for the thread
+		**/
+		~protocolScheduler();
+
+		/**  \brief Compile the protocol and start running it now
+		*
+		*  @param _protocol  commands, copied
+		*  @param _runner    function running the commands
+		*  @param _on_step   optional, called after each step
+		*  @param _stop      stop request, pass the same token to the runner to stop the steps too
+		*
+		* \return false if a protocol is already running
+		**/
+		bool start(const std::vector<fluicell::PPC1dataStructures::command> &_protocol,
+			commandRunner _runner, stepCallback _on_step = stepCallback(), 
+			const fluicell::stopToken &_stop = fluicell::stopToken());
+
+		/**  \brief Stop the protocol, the same as requestStop on the token given to start
+		**/
+		void stop();
+
+		/**  \brief Wait for the protocol to end
+		*
+		* \return true if all the steps ran successfully and the protocol was not stopped
+		**/
+		bool wait();
+
+		/**  \brief True while the protocol is running
+		**/
+		bool isRunning() const { return m_running; }
+
+		/**  \brief Time from the protocol start in seconds, the steps with an unknown duration are not counted
+		**/
+		double getElapsed() const;
+
+		/**  \brief Time left to the next step in seconds, 0 if it is due
+		**/
+		double getTimeLeftForStep() const;
+
+		/**  \brief Copy of the steps completed so far
+		**/
+		std::vector<stepReport> getReport() const;
+
+		/**  \brief Latest start of a step with respect to its deadline in ms
+		**/
+		double getMaxLateness() const;
+
+		/**  \brief Time of each step of the protocol from the start in ms, see stepReport::deadline_ms
+		*
+		*  @param _protocol  commands
+		*
+		* \return one deadline for each command, the wait commands included
+		**/
+		static std::vector<double> compile(const std::vector<fluicell::PPC1dataStructures::command> &_protocol);
+
+	private:
+
+		// disable copy
+		protocolScheduler(const protocolScheduler&);
+		protocolScheduler& operator=(const protocolScheduler&);
+
+		/**  \brief Scheduler thread
+		**/
+		void threadScheduler();
+
+		/**  \brief Sleep until the deadline, false if stopped before
+		*
+		*   The long part of the wait can be interrupted by stop, the last
+		*   m_final_sleep_us are slept with an absolute deadline to be on time
+		**/
+		bool sleepUntil(std::chrono::steady_clock::time_point _deadline);
+
+		typedef std::chrono::steady_clock clock;
+		static const int m_final_sleep_us = 2000;   //!< last part of the wait, not interruptible
+
+		std::thread m_thread;                       //!< scheduler thread
+		mutable std::mutex m_mutex;                 //!< protects the report and the time line
+		std::atomic<bool> m_running;                //!< true while the thread runs the protocol
+		fluicell::stopToken m_stop;                 //!< stop request of the protocol running
+		bool m_success;                             //!< result of the last protocol
+
+		std::vector<fluicell::PPC1dataStructures::command> m_protocol;  //!< protocol running
+		std::vector<double> m_deadlines;            //!< see compile
+		commandRunner m_runner;                     //!< runs the commands
+		stepCallback m_on_step;                     //!< optional
+		clock::time_point m_start;                  //!< protocol start
+		clock::duration m_shift;                    //!< time taken by the steps with an unknown duration
+		clock::time_point m_next_deadline;          //!< deadline of the next step
+		std::vector<stepReport> m_report;           //!< steps completed
+	};
+}
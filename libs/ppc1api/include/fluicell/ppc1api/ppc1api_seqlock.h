@@ -0,0 +1,97 @@
+/*  +---------------------------------------------------------------------------+
+*  |                                                                           |
+*  | Fluicell AB, http://fluicell.com/                                         |
+*  | PPC1 API                                                                  |
+*  |                                                                           |
+*  | Authors: Mauro Bellone - http://www.maurobellone.com                      |
+*  | Released under GNU GPL License.                                           |
+*  +---------------------------------------------------------------------------+ */
+
+#pragma once
+
+// standard libraries
+#include <atomic>
+#include <type_traits>
+
+
+/**  \brief Define the Fluicell namespace, all the classes will be in here
+  *
+  **/
+namespace fluicell
+{
+
+	/**  \brief Sequence lock holding one value, one writer and many readers
+	*
+	*    The writer never waits for the readers, it increments the sequence number
+	*    before and after writing the value (odd while writing). A reader copies the
+	*    value and repeats the copy only if the sequence number changed meanwhile,
+	*    so it always gets a consistent value without locking.
+	*
+	*    Usage:
+	*		- 	writer thread:   my_value.store(value);
+	*		- 	reader thread:   T value = my_value.load();
+	*
+	*  @param T  value type, it must be trivially copyable
+	*
+	* \note only one thread can call store
+	**/
+	template <typename T>
+	class seqLock
+	{
+		static_assert(std::is_trivially_copyable<T>::value,
+			"seqLock values must be trivially copyable");
+
+	public:
+
+		/**  \brief Constructor, the value is default constructed
+		**/
+		seqLock() : m_sequence(0) {}
+
+		/**  \brief Write a new value
+		*
+		*  @param _value  new value
+		*
+		* \note only one thread can call store
+		**/
+		void store(const T &_value)
+		{
+			const unsigned long long sequence = m_sequence.load(std::memory_order_relaxed);
+			m_sequence.store(sequence + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			m_value = _value;
+			m_sequence.store(sequence + 2, std::memory_order_release);
+		}
+
+		/**  \brief Read a consistent copy of the value
+		*
+		* \return the last value written
+		**/
+		T load() const
+		{
+			T value;
+			unsigned long long before, after;
+			do {
+				before = m_sequence.load(std::memory_order_acquire);
+				value = m_value;
+				std::atomic_thread_fence(std::memory_order_acquire);
+				after = m_sequence.load(std::memory_order_relaxed);
+			} while (before != after || (before & 1));
+			return value;
+		}
+
+		/**  \brief Number of values written since the creation
+		**/
+		unsigned long long version() const {
+			return m_sequence.load(std::memory_order_acquire) / 2;
+		}
+
+	private:
+
+		// disable copy
+		seqLock(const seqLock&);
+		seqLock& operator=(const seqLock&);
+
+		std::atomic<unsigned long long> m_sequence;  //!< even when the value is consistent
+		T m_value;                                   //!< protected value
+	};
+}
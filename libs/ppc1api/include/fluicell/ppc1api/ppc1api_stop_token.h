@@ -0,0 +1,148 @@
+/*  +---------------------------------------------------------------------------+
+*  |                                                                           |
+*  | Fluicell AB, http://fluicell.com/                                         |
+*  | PPC1 API                                                                  |
+*  |                                                                           |
+*  | Authors: Mauro Bellone - http://www.maurobellone.com                      |
+*  | Released under GNU GPL License.                                           |
+*  +---------------------------------------------------------------------------+ */
+
+#pragma once
+
+// standard libraries
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+
+/**  \brief Define the Fluicell namespace, all the classes will be in here
+  *
+  **/
+namespace fluicell
+{
+
+	/**  \brief Stop request shared by the threads running a protocol
+	*
+	*    The copies of a token share the same state: requestStop on any copy
+	*    wakes up at once all the threads sleeping on it and runs the registered
+	*    callbacks, used to wake up waits on other condition variables.
+	*
+	*    Usage:
+	*		- 	fluicell::stopToken stop;
+	*		- 	worker thread:   if (!stop.sleepFor(std::chrono::seconds(10))) return;  // stopped
+	*		- 	other thread:    stop.requestStop();
+	*
+	* \note a token cannot be reset, create a new one for each run
+	**/
+	class stopToken
+	{
+	public:
+
+		/**  \brief Constructor, a new state not stopped
+		**/
+		stopToken() : m_state(std::make_shared<state>()) {}
+
+		/**  \brief Stop all the waits on this token, it can be called by any thread
+		**/
+		void requestStop() const
+		{
+			std::vector<std::function<void()> > callbacks;
+			{
+				std::lock_guard<std::mutex> lock(m_state->mutex);
+				if (m_state->stop)
+					return;
+				m_state->stop = true;
+				for (size_t i = 0; i < m_state->callbacks.size(); i++)
+					callbacks.push_back(m_state->callbacks[i].second);
+			}
+			m_state->condition.notify_all();
+			for (size_t i = 0; i < callbacks.size(); i++)
+				callbacks[i]();
+		}
+
+		/**  \brief True after requestStop
+		**/
+		bool stopRequested() const { return m_state->stop; }
+
+		/**  \brief Sleep until the deadline or the stop
+		*
+		*  @param _deadline  steady clock time to wake up
+		*
+		* \return false if stopped before the deadline
+		**/
+		bool sleepUntil(std::chrono::steady_clock::time_point _deadline) const
+		{
+			std::unique_lock<std::mutex> lock(m_state->mutex);
+			while (!m_state->stop && std::chrono::steady_clock::now() < _deadline)
+				m_state->condition.wait_until(lock, _deadline);
+			return !m_state->stop;
+		}
+
+		/**  \brief Sleep for a time or until the stop
+		*
+		*  @param _time  time to sleep
+		*
+		* \return false if stopped before the time is over
+		**/
+		template <class Rep, class Period>
+		bool sleepFor(const std::chrono::duration<Rep, Period> &_time) const
+		{
+			return sleepUntil(std::chrono::steady_clock::now() +
+				std::chrono::duration_cast<std::chrono::steady_clock::duration>(_time));
+		}
+
+		/**  \brief Register a function called by requestStop, called at once if already stopped
+		*
+		*  @param _callback  function, it must not block
+		*
+		* \return an id for removeCallback
+		**/
+		int addCallback(std::function<void()> _callback) const
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_state->mutex);
+				if (!m_state->stop) {
+					m_state->callbacks.push_back(std::make_pair(++m_state->next_id, _callback));
+					return m_state->next_id;
+				}
+			}
+			_callback();
+			return 0;
+		}
+
+		/**  \brief Remove a function registered with addCallback
+		**/
+		void removeCallback(int _id) const
+		{
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+			for (size_t i = 0; i < m_state->callbacks.size(); i++) {
+				if (m_state->callbacks[i].first == _id) {
+					m_state->callbacks.erase(m_state->callbacks.begin() + i);
+					return;
+				}
+			}
+		}
+
+	private:
+
+		/**  \brief State shared by the copies of a token
+		**/
+		struct state
+		{
+			state() : stop(false), next_id(0) {}
+
+			std::mutex mutex;
+			std::condition_variable condition;
+			std::atomic<bool> stop;
+			int next_id;
+			std::vector<std::pair<int, std::function<void()> > > callbacks;
+		};
+
+		std::shared_ptr<state> m_state;  //!< shared by all the copies
+	};
+}
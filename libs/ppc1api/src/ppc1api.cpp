@@ -9,6 +9,22 @@
 
 #include "fluicell/ppc1api/ppc1api.h"
 #include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <system_error>
+
+// vector instructions used in decodeBuffer
+#if defined(__AVX2__)
+ #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <emmintrin.h>
+ #define PPC1API_SSE2
+#endif
+#if defined(_MSC_VER)
+ #include <intrin.h>
+#endif
 
 #ifdef VLD_MEMORY_CHECK
  #include <vld.h>
@@ -16,8 +32,19 @@
 
 #define HERE std::string(__FUNCTION__ + std::string(" at line ") + std::to_string(__LINE__))
 
+// index of the lowest bit set in a non zero mask
+static inline unsigned int lowestBitSet(unsigned int _mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, _mask);
+	return index;
+#else
+	return __builtin_ctz(_mask);
+#endif
+}
+
 fluicell::PPC1api::PPC1api() :
-	m_PPC1_data(new fluicell::PPC1dataStructures::PPC1_data),
 	m_PPC1_status(new fluicell::PPC1dataStructures::PPC1_status),
 	m_tip(new fluicell::PPC1dataStructures::tip),
 	m_verbose(false),
@@ -26,76 +53,267 @@ fluicell::PPC1api::PPC1api() :
 	m_baud_rate(115200),
 	m_dataStreamPeriod(200),
 	m_COM_timeout(250),
+	m_resync(false),
+	m_bytes_received(0),
+	m_lines_received(0),
+	m_lines_dropped(0),
+	m_partial_lines(0),
+	m_subscribers(std::make_shared<const subscriberList>()),
+	m_subscribed_events(0),
+	m_next_subscriber_id(0),
 	m_wait_sync_timeout(60),
-	m_excep_handler(false)
+	m_isRunning(false),
+	m_stop_latency(0.0),
+#if !defined(_WIN32)
+	m_reactor(NULL),
+	m_reactor_port(0),
+#endif
+	m_writer_stop(false),
+	m_writer_busy(false),
+	m_writer_hold(0),
+	m_coalesced_pending(0),
+	m_coalesce_period(50),
+	m_coalesce_stop(false),
+	m_excep_handler(false),
+	m_flow_constant(M_PI * std::pow(1.128 * 0.00003, 4) / (128.0 * 0.00089) * 1000.0 * 1000000000.0),
+	m_flow_valves(-1),
+	m_flow_tip_version(0),
+	m_n_confirmations(0),
+	m_device_id_pending(false),
+	m_commands_skipped(0),
+	m_solver_tip_version(0)
 {
+	// flows are calculated on the first frame
+	for (int n = 0; n < 4; n++)
+		m_flow_readings[n] = 0.0;
+	updateFlowCoefficients();
+	resetShadow();
+	for (int n = 0; n < 4; n++)
+		m_coalesced_values[n] = 0.0;
+	for (int n = 0; n < 2; n++) {
+		m_write_lanes[n].requests.resize(m_write_queue_size);
+		m_write_lanes[n].head = 0;
+		m_write_lanes[n].count = 0;
+	}
+
 	// set default values for pressures and vacuums
 	setDefaultPV();
 	
+	// the longest line is a channel line, this avoids any reallocation while streaming
+	m_line_buffer.reserve(m_max_line_length);
+
 	// set default filter values
 	m_filter_enabled = true;
 	m_filter_size = 20;
+	m_filter_version = m_filter_settings.version();
+	m_TTL_out_trigger = false;
+}
 
-	// initialize thread variables
-	m_threadTerminationHandler = false; // it will be true when the thread starts
-	m_isRunning = false;
+bool fluicell::PPC1api::run()
+{
+	std::lock_guard<std::mutex> lock(m_thread_mutex);
+	if (m_isRunning) {
+		logError(HERE, " the thread is already running");
+		return false;
+	}
+	if (!m_PPC1_serial->isOpen()) {
+		logError(HERE, " cannot run the thread --- port not open");
+		return false;
+	}
+	if (m_thread.joinable())
+		m_thread.join();  // the last thread ended by itself, e.g. on exception
+
+	m_thread_stop = fluicell::stopToken();
+	m_isRunning = true;
+	m_thread = std::thread(&PPC1api::threadSerial, this);
+	return true;
+}
+
+#if !defined(_WIN32)
+bool fluicell::PPC1api::run(serial::Reactor &_reactor)
+{
+	std::lock_guard<std::mutex> lock(m_thread_mutex);
+	if (m_isRunning) {
+		logError(HERE, " the thread is already running");
+		return false;
+	}
+	if (!m_PPC1_serial->isOpen()) {
+		logError(HERE, " cannot run on the reactor --- port not open");
+		return false;
+	}
+	if (m_thread.joinable())
+		m_thread.join();  // the last thread ended by itself, e.g. on exception
+
+	m_reactor_piece.reserve(m_max_line_length);
+	m_reactor_line.reserve(m_max_line_length);
+	m_isRunning = true;
+	try {
+		m_reactor_port = _reactor.add(*m_PPC1_serial,
+			[this, &_reactor](serial::Reactor::PortId _port) { receiveLines(_reactor, _port); },
+			[this](serial::Reactor::PortId, const std::string &_error) { stopOnException(" " + _error); });
+	}
+	catch (std::exception &e) {
+		m_isRunning = false;
+		logError(HERE, " cannot add the port to the reactor " + std::string(e.what()));
+		return false;
+	}
+	m_reactor = &_reactor;
+	return true;
+}
+#endif
+
+void fluicell::PPC1api::stop()
+{
+	pumpingOff();  // as we end the thread is good to put the PPC1 to zero
+	std::lock_guard<std::mutex> lock(m_thread_mutex);
+	joinThread();
+}
+
+void fluicell::PPC1api::joinThread()
+{
+#if !defined(_WIN32)
+	if (m_reactor) {
+		// no callback is running when remove returns, except when called by a callback
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		m_reactor->remove(m_reactor_port);
+		m_reactor = NULL;
+		checkConfirmations(true);
+		m_stop_latency = std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count();
+		return;
+	}
+#endif
+	if (!m_thread.joinable())
+		return;
+	if (m_thread.get_id() == std::this_thread::get_id()) {
+		// called by a subscriber on the serial thread, it cannot join itself
+		logError(HERE, " stop called from the serial thread, the thread is not joined");
+		m_thread_stop.requestStop();
+		return;
+	}
+
+	// the thread checks the request after each read, cancelRead wakes up the read waiting for data
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	m_thread_stop.requestStop();
+	try {
+		m_PPC1_serial->cancelRead();
+	}
+	catch (serial::IOException &e) {
+		// the read still ends within m_COM_timeout
+		logError(HERE, " cannot cancel the read " + std::string(e.what()));
+	}
+	m_thread.join();
+	m_stop_latency = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
 }
 
 void fluicell::PPC1api::threadSerial() 
 {
 	try {
-		std::mutex my_mutex;
-		m_isRunning = true;
-		while (!m_threadTerminationHandler)
+		std::string data;
+		data.reserve(m_max_line_length);
+		while (!m_thread_stop.stopRequested())
 		{
-			if(my_mutex.try_lock())
-			{
-				std::string data;
-				if (readData(data))
-						m_PPC1_data->data_corrupted = !decodeDataLine(data, m_PPC1_data);
-				this->updateFlows(*m_PPC1_data, *m_PPC1_status); 
-				my_mutex.unlock();
-			}
-			else {
-				logError(HERE, " impossible to lock ");
-				my_mutex.unlock();
-				m_threadTerminationHandler = true;
+			// consume every line received, readData blocks up to m_COM_timeout
+			// confirmations are checked also without data, so they can expire
+			if (!readData(data)) {
+				checkConfirmations();
+				continue;
 			}
+			processLine(data);
 		}
-		m_isRunning = false;
+		checkConfirmations(true);
 	}
 	catch (serial::IOException &e) 	{
-		m_isRunning = false; 
-		m_threadTerminationHandler = true;
-		m_PPC1_serial->close(); 
-		logError(HERE, " IOException " + std::string(e.what()));
-		m_excep_handler = true;
-		return;
+		stopOnException(" IOException " + std::string(e.what()));
 	}
 	catch (serial::SerialException &e) 	{
-		m_isRunning = false; 
-		m_threadTerminationHandler = true;
-		m_PPC1_serial->close(); 
-		logError(HERE, " SerialException " + std::string(e.what())); 
-		m_excep_handler = true;
-		return;
+		stopOnException(" SerialException " + std::string(e.what()));
 	}
 	catch (std::exception &e) 	{
-		m_isRunning = false; 
-		m_threadTerminationHandler = true;
-		m_PPC1_serial->close();
-		logError(HERE, 
-			std::string(" exception " + std::string(e.what())));
-		m_excep_handler = true;
-		return;
+		stopOnException(" exception " + std::string(e.what()));
+	}
+}
+
+void fluicell::PPC1api::processLine(const std::string &_data)
+{
+	// the I/O thread is the only writer of m_PPC1_data and m_frame, 
+	// readers get the published snapshot, 
+	// only the trigger lines are shared with waitSync
+	if (_data[0] == 'P' || _data[0] == 'R') {
+		{
+			std::lock_guard<std::mutex> lock(m_sync_mutex);
+			m_PPC1_data.setFlag(fluicell::PPC1dataStructures::PPC1_data::data_corrupted, 
+				!decodeDataLine(_data, &m_PPC1_data));
+			m_trigger_time = std::chrono::steady_clock::now();
+		}
+		m_sync_condition.notify_all();
+		notify(fluicell::PPC1dataStructures::PPC1_event(_data[0] == 'R' ?
+			fluicell::PPC1dataStructures::PPC1_event::triggerRise :
+			fluicell::PPC1dataStructures::PPC1_event::triggerFall, m_frame));
+	}
+	else if (_data[0] >= 'A' && _data[0] <= 'D') {
+		// the decoder gives the raw sensor reading, the filter is applied here
+		const int n = _data[0] - 'A';
+		const bool decoded = decodeDataLine(_data, &m_PPC1_data);
+		m_PPC1_data.setFlag(fluicell::PPC1dataStructures::PPC1_data::data_corrupted, !decoded);
+		if (m_filter_settings.version() != m_filter_version)
+			updateFilters();
+		if (decoded && m_filter_enabled)
+			m_PPC1_data.channels[n].sensor_reading = 
+				m_filters[n].apply(m_PPC1_data.channels[n].sensor_reading);
+	}
+	else if (_data[0] != 'i' && _data[0] != 'I' && replyDeviceID(_data)) {
+		return;  // not a data line, it is not part of the frame
+	}
+	else {
+		m_PPC1_data.setFlag(fluicell::PPC1dataStructures::PPC1_data::data_corrupted, 
+			!decodeDataLine(_data, &m_PPC1_data));
+	}
+	if (m_PPC1_data.getFlag(fluicell::PPC1dataStructures::PPC1_data::data_corrupted)) {
+		m_lines_dropped++;
+		m_frame.data_corrupted = true;
+	}
+	else if (_data[0] == 'P') {
+		m_frame.trigger_fall = true;
+	}
+	else if (_data[0] == 'R') {
+		m_frame.trigger_rise = true;
 	}
+
+	// the IN|OUT line is the last of the frame 
+	if (_data[0] == 'I') {
+		commitFrame(std::chrono::steady_clock::now());
+		checkConfirmations();
+		updateShadow();
+	}
+}
+
+bool fluicell::PPC1api::replyDeviceID(const std::string &_data)
+{
+	std::lock_guard<std::mutex> lock(m_device_id_mutex);
+	if (!m_device_id_pending)
+		return false;
+	m_device_id_pending = false;
+	m_device_id_reply.set_value(_data);
+	return true;
 }
 
-bool fluicell::PPC1api::decodeDataLine(const std::string &_data, 
+void fluicell::PPC1api::stopOnException(const std::string &_message)
+{
+	m_isRunning = false; 
+	m_PPC1_serial->close(); 
+	logError(HERE, _message);
+	m_excep_handler = true;
+	checkConfirmations(true);
+	notifyException(_message);
+}
+
+bool fluicell::PPC1api::decodeDataLine(const char *_data, size_t _size,
 	fluicell::PPC1dataStructures::PPC1_data *_PPC1_data) const
 {
 	// check for empty data
-	if (_data.empty())
+	if (_size == 0)
 	{
 		logError(HERE, " Error in decoding line - Empty line ");
 		return false;
@@ -108,278 +326,613 @@ bool fluicell::PPC1api::decodeDataLine(const std::string &_data,
 		return false;
 	}
 
-	std::vector<double> line;  // decoded line 
-
-	if (_data.at(0) == 'A') {
-		if (decodeChannelLine(_data, line))  // decode the line 
-		{   // and fill the right place in the data structure
-			_PPC1_data->channel_A->setChannelData ( line.at(0), line.at(1),
-				line.at(2), (int)line.at(3));
-			return true;
-		}
-		else {
-			logError(HERE, " Error in decoding line ");
-			return false;
-		}
-	}
-
-	if (_data.at(0) == 'B') {
-		if (decodeChannelLine(_data, line))  // decode the line 
-		{   // and fill the right place in the data structure
-			_PPC1_data->channel_B->setChannelData(line.at(0), line.at(1),
-				line.at(2), (int)line.at(3));
-			return true;
-		}
-		else {
-			logError(HERE, " Error in decoding line ");
-			return false;
-		}
-	}
-
-	if (_data.at(0) == 'C') {
-		if (decodeChannelLine(_data, line))  // decode the line 
-		{   // and fill the right place in the data structure
-			_PPC1_data->channel_C->setChannelData(line.at(0), line.at(1),
-				line.at(2), (int)line.at(3));
-			return true;
-		}
-		else {
-			logError(HERE, " Error in decoding line ");
-			return false;
-		}
-	}
-
-	if (_data.at(0) == 'D') {
-		if (decodeChannelLine(_data, line))  // decode the line 
-		{   // and fill the right place in the data structure
-			_PPC1_data->channel_D->setChannelData(line.at(0), line.at(1),
-				line.at(2), (int)line.at(3));
-			return true;
-		}
-		else {
-			logError(HERE, " Error in decoding line ");
-			return false;
-		}
-	}
+	fluicell::PPC1dataStructures::PPC1_data::channel *chan = NULL;
+	switch (_data[0])
+	{
+	case 'A': chan = &_PPC1_data->channels[fluicell::PPC1dataStructures::PPC1_data::channel_A]; break;
+	case 'B': chan = &_PPC1_data->channels[fluicell::PPC1dataStructures::PPC1_data::channel_B]; break;
+	case 'C': chan = &_PPC1_data->channels[fluicell::PPC1dataStructures::PPC1_data::channel_C]; break;
+	case 'D': chan = &_PPC1_data->channels[fluicell::PPC1dataStructures::PPC1_data::channel_D]; break;
 
-	if (_data.at(0) == 'i') {
+	case 'i': {
 		// string format:  i0|j0|k0|l0
 		// char index   :  0123456789
-		int value = toDigit(_data.at(1));
-		if (value == 0 || value == 1) { // admitted values are only 0 and 1
-			_PPC1_data->i = value;
-		}
-		else {
-			logError(HERE, 
-				" Error in decoding line _PPC1_data->i string: " + 
-				_data + " value " + std::to_string(value));
-			return false;
-		}
-
-		value = toDigit(_data.at(4));
-		if (value == 0 || value == 1) { // admitted values are only 0 and 1
-			_PPC1_data->j = value;
-		}
-		else {
-			logError(HERE,
-				" Error in decoding line _PPC1_data->j string: " + 
-				_data + " value " + std::to_string(value));
-			return false;
-		}
-
-		value = toDigit(_data.at(7));
-		if (value == 0 || value == 1) { // admitted values are only 0 and 1
-			_PPC1_data->k = value;
-		}
-		else { 
-			logError(HERE,
-				" Error in decoding line _PPC1_data->k string: " + 
-				_data + " value " + std::to_string(value));
+		if (_size < 11) {
+			logError(HERE, " Error in decoding line - corrupted valves line ");
 			return false;
 		}
-
-		value = toDigit(_data.at(10));
-		if (value == 0 || value == 1) { // admitted values are only 0 and 1
-			_PPC1_data->l = value;
-		}
-		else {
-			logError(HERE,
-				" Error in decoding line _PPC1_data->l string: " + 
-				_data + " value " + std::to_string(value));
+		int i = toDigit(_data[1]);
+		int j = toDigit(_data[4]);
+		int k = toDigit(_data[7]);
+		int l = toDigit(_data[10]);
+		// admitted values are only 0 and 1
+		if ((i != 0 && i != 1) || (j != 0 && j != 1) ||
+			(k != 0 && k != 1) || (l != 0 && l != 1)) {
+			logError(HERE, " Error in decoding line - valves string: " +
+				std::string(_data, _size));
 			return false;
 		}
+		_PPC1_data->setValves(i, j, k, l);
 		return true;
 	}
 
-	if (_data.at(0) == 'I') {
+	case 'I': {
 		// string format: IN1|OUT1 or IN0|OUT0
 		// char index:    01234567
-		int value = toDigit(_data.at(2));
+		if (_size < 8) {
+			logError(HERE, " Error in decoding line - corrupted IN|OUT line ");
+			return false;
+		}
+		int value = toDigit(_data[2]);
 		if (value == 0 || value == 1) { // admitted values are only 0 and 1
-			_PPC1_data->ppc1_IN = value;
+			_PPC1_data->setFlag(fluicell::PPC1dataStructures::PPC1_data::ppc1_IN, value == 1);
 		}
 		else {
-			logError(HERE, " Error in decoding line _PPC1_data->ppc1_IN " );
+			logError(HERE, " Error in decoding line _PPC1_data->ppc1_IN ");
 			return false;
 		}
-		value = toDigit(_data.at(7));
+		value = toDigit(_data[7]);
 		if (value == 0 || value == 1) { // admitted values are only 0 and 1
-			_PPC1_data->ppc1_OUT = value;
+			_PPC1_data->setFlag(fluicell::PPC1dataStructures::PPC1_data::ppc1_OUT, value == 1);
 		}
 		else {
-			logError(HERE, " Error in decoding line _PPC1_data->ppc1_OUT "); 
+			logError(HERE, " Error in decoding line _PPC1_data->ppc1_OUT ");
 			return false;
 		}
 		return true;
 	}
 
-	if (_data.at(0) == 'P') {  // FALLING TTL signal detected
+	case 'P':  // FALLING TTL signal detected
 		// string format: P\n
 		// char index:    01
-		_PPC1_data->trigger_fall = true;
-		_PPC1_data->trigger_rise = false;
+		_PPC1_data->setTriggers(true, false);
 		return true;
-	} 
 
-	if (_data.at(0) == 'R') {  //RISING TTL signal detected
+	case 'R':  //RISING TTL signal detected
 		// string format: R\n
 		// char index:    01
-		_PPC1_data->trigger_fall = false;
-		_PPC1_data->trigger_rise = true;
+		_PPC1_data->setTriggers(false, true);
 		return true;
+
+	default:
+		return false;  // in case _data(0) is none of the expected value
 	}
 
-	return false;  // in case _data(0) is none of the expected value
+	// channel lines A, B, C, D
+	std::array<double, 4> line;  // decoded line 
+	if (!decodeChannelLine(_data, _size, line))  // decode the line 
+	{
+		logError(HERE, " Error in decoding line ");
+		return false;
+	}
+	// and fill the right place in the data structure
+	chan->setChannelData(line[0], line[1], line[2], (int)line[3]);
+	return true;
 }
 
-bool fluicell::PPC1api::decodeChannelLine(const std::string &_data, std::vector<double> &_line) const
+bool fluicell::PPC1api::decodeChannelLine(const char *_data, size_t _size, 
+	std::array<double, 4> &_line) const
 {
 	// check for empty data
-	if (_data.empty())
+	if (_size == 0)
 	{
 		logError(HERE, " Error in decoding line - Empty line "); 
 		return false;
 	}
 
-	_line.clear();
-	unsigned int byte_counter = 2;              // in the line 0 is letter and 1 is the separator e.g. A|
-	while (byte_counter < _data.length())       // scan the whole string
-	{
-		std::string value;
-		// extract line 
-		// extract the value before the character "new line"
-		while (_data.at(byte_counter) != m_separator)//*separator)
-		{
-			if (_data.at(byte_counter) == m_end_line) // if the char is the endline the function break
-			{
-				_line.push_back(std::stod(value));
-				break;
-			}
+	// the line ends at the first new line, if any
+	const char *end = static_cast<const char*>(memchr(_data, m_end_line, _size));
+	if (end == NULL)
+		end = _data + _size;
 
-			// check the char for validity
-			// this is to make sure that stod function get an actual number instead of a character 
-			if (!isdigit(_data.at(byte_counter))) // if the char is not a digit
-				if (_data.at(byte_counter) != m_minus) // if the char is not the minus sign
-					if (_data.at(byte_counter) != m_decimal_separator) // if the char is not the decimal separator
-					{
-						return false;  // something is wrong with the string (not a number)
-					}
+	// in the line 0 is letter and 1 is the separator e.g. A|
+	const char *field = _data + 2;
+	size_t n_values = 0;
+	while (field < end && n_values < _line.size()) 
+	{
+		const char *field_end = static_cast<const char*>(memchr(field, m_separator, end - field));
+		if (field_end == NULL)
+			field_end = end;
 
-			// validity check passed
-			value.push_back(_data.at(byte_counter));
-			byte_counter++;
-			if (byte_counter >= _data.length()) 
-				break;
+		if (field == field_end) {
+			_line[n_values] = 0.0;  // empty value
+		}
+		else if (!decodeNumber(field, field_end, _line[n_values])) {
+			return false;  // something is wrong with the string (not a number)
 		}
-		byte_counter++;
+		n_values++;
+		field = field_end + 1;
+	}
 
-		// check if the value is empty
-		if (!value.empty()) {
-			_line.push_back(stod(value)); 
-			if (_line.size() > 3)
-				return true; // we expect 4 values so we exit at the 4th
+	// check for proper data size, we expect 4 values
+	if (n_values < _line.size()) {
+		logError(HERE, " Error in decoding line - corrupted data line "); 
+		return false;
+	}
+
+	return true;
+}
+
+bool fluicell::PPC1api::decodeNumber(const char *_begin, const char *_end, double &_value) const
+{
+	// exact powers of ten, any integer below 2^53 divided by one of these
+	// gives the correctly rounded result, that is what strtod returns
+	static const double pow10[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const unsigned long long max_exact = 1ULL << 53;
+
+	const char *c = _begin;
+	bool negative = (c < _end && *c == m_minus);
+	if (negative)
+		c++;
+
+	unsigned long long mantissa = 0;
+	int n_decimals = 0;   // digits after the decimal separator
+	bool decimal_separator = false;
+	bool exact = true;
+	for (; c < _end; c++)
+	{
+		if (*c >= '0' && *c <= '9') {
+			if (mantissa < max_exact) {
+				mantissa = mantissa * 10 + (*c - '0');
+				if (decimal_separator)
+					n_decimals++;
+			}
+			else {
+				exact = false;  // too many digits for the fast path
+			}
+		}
+		else if (*c == m_decimal_separator && !decimal_separator) {
+			decimal_separator = true;
 		}
 		else {
-			_line.push_back(0.0);
+			return false;  // not a digit, minus sign or decimal separator
 		}
 	}
 
-	// check for proper data size
-	if (_line.size() < 3) {
-		logError(HERE, " Error in decoding line - corrupted data line "); 
+	// at least one digit is required
+	if (c - _begin == (negative ? 1 : 0) + (decimal_separator ? 1 : 0))
 		return false;
+
+	if (!exact || mantissa >= max_exact || n_decimals > 22) {
+		// out of the fast path, it never happens for the PPC1 messages
+		// which have 6 decimals, use strtod on a local copy of the number
+		char buffer[64];
+		size_t length = _end - _begin;
+		if (length >= sizeof(buffer))
+			return false;
+		memcpy(buffer, _begin, length);
+		buffer[length] = '\0';
+		_value = strtod(buffer, NULL);
+		return true;
 	}
 
+	_value = static_cast<double>(mantissa) / pow10[n_decimals];
+	if (negative)
+		_value = -_value;
 	return true;
 }
 
-void fluicell::PPC1api::updateFlows(const fluicell::PPC1dataStructures::PPC1_data &_PPC1_data, 
-	fluicell::PPC1dataStructures::PPC1_status &_PPC1_status) const
+unsigned int fluicell::PPC1api::scanBlock(const char *_data, size_t _size,
+	unsigned int &_separators) const
 {
-	// calculate inflow
-	double delta_pressure = 100.0 * (-_PPC1_data.channel_A->sensor_reading);//   v_r;
+	if (_size >= m_scan_block_size) {
+#if defined(__AVX2__)
+		const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(_data));
+		_separators = static_cast<unsigned int>(_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(block, _mm256_set1_epi8(m_separator))));
+		return static_cast<unsigned int>(_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(block, _mm256_set1_epi8(m_end_line))));
+#elif defined(PPC1API_SSE2)
+		const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_data));
+		const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_data + 16));
+		const __m128i separator = _mm_set1_epi8(m_separator);
+		const __m128i end_line = _mm_set1_epi8(m_end_line);
+		_separators = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(low, separator))) |
+			(static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(high, separator))) << 16);
+		return static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(low, end_line))) |
+			(static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(high, end_line))) << 16);
+#endif
+	}
 
-	_PPC1_status.inflow_recirculation = 2.0 * 
-		this->getFlowSimple(delta_pressure, m_tip->length_to_tip);
+	// end of the buffer, or no vector instructions available
+	size_t size = _size;
+	if (size > m_scan_block_size)
+		size = m_scan_block_size;
+	unsigned int end_lines = 0;
+	_separators = 0;
+	for (size_t n = 0; n < size; n++) {
+		if (_data[n] == m_end_line)
+			end_lines |= 1u << n;
+		else if (_data[n] == m_separator)
+			_separators |= 1u << n;
+	}
+	return end_lines;
+}
 
-	delta_pressure = 100.0 * (-_PPC1_data.channel_A->sensor_reading +
-		2.0 * _PPC1_data.channel_C->sensor_reading * ( 1 - m_tip->length_to_tip / m_tip->length_to_zone) );
-	_PPC1_status.inflow_switch = 2.0 * this->getFlowSimple(delta_pressure, m_tip->length_to_tip);
+bool fluicell::PPC1api::decodeSampleLine(const char *_data, size_t _size,
+	const size_t *_separators, size_t _n_separators,
+	fluicell::PPC1dataStructures::PPC1_sample &_sample) const
+{
+	if (_size == 0) 
+		return false;  // empty line, nothing to do
 
-	delta_pressure = 100.0 * 2.0 * _PPC1_data.channel_C->sensor_reading;
-	_PPC1_status.solution_usage_off = this->getFlowSimple(delta_pressure, 2.0 * m_tip->length_to_zone);
+	switch (_data[0])
+	{
+	case 'A':
+	case 'B':
+	case 'C':
+	case 'D': {
+		// string format: A|-0.000000|0.114514|0.000000|0
+		// 4 values are expected after the channel character
+		if (_n_separators < 4 || _separators[0] != 1) {
+			_sample.data_corrupted = true;
+			return false;
+		}
+		double values[4];
+		for (size_t n = 0; n < 4; n++) {
+			const char *begin = _data + _separators[n] + 1;
+			const char *end = _data + (n + 1 < _n_separators ? _separators[n + 1] : _size);
+			if (begin == end)
+				values[n] = 0.0;  // empty value
+			else if (!decodeNumber(begin, end, values[n])) {
+				_sample.data_corrupted = true;
+				return false;
+			}
+		}
+		fluicell::PPC1dataStructures::PPC1_sample::channelSample &chan = 
+			_sample.channels[_data[0] - 'A'];
+		chan.set_point = values[0];
+		chan.sensor_reading = values[1];
+		chan.PID_out_DC = values[2];
+		chan.state = (int)values[3];
+		return false;
+	}
 
-	delta_pressure = 100.0 * _PPC1_data.channel_D->sensor_reading;
-	_PPC1_status.solution_usage_on = this->getFlowSimple(delta_pressure, m_tip->length_to_tip);
+	case 'i': {
+		// string format:  i0|j0|k0|l0
+		// char index   :  0123456789
+		if (_size < 11) {
+			_sample.data_corrupted = true;
+			return false;
+		}
+		int i = toDigit(_data[1]);
+		int j = toDigit(_data[4]);
+		int k = toDigit(_data[7]);
+		int l = toDigit(_data[10]);
+		// admitted values are only 0 and 1
+		if ((i != 0 && i != 1) || (j != 0 && j != 1) ||
+			(k != 0 && k != 1) || (l != 0 && l != 1)) {
+			_sample.data_corrupted = true;
+			return false;
+		}
+		_sample.i = i;
+		_sample.j = j;
+		_sample.k = k;
+		_sample.l = l;
+		return false;
+	}
+
+	case 'I': {
+		// string format: IN1|OUT1 or IN0|OUT0
+		// char index:    01234567
+		// this is the last line of the frame even if corrupted
+		int in = _size < 8 ? -1 : toDigit(_data[2]);
+		int out = _size < 8 ? -1 : toDigit(_data[7]);
+		if ((in != 0 && in != 1) || (out != 0 && out != 1)) {
+			_sample.data_corrupted = true;
+			return true;
+		}
+		_sample.ppc1_IN = in;
+		_sample.ppc1_OUT = out;
+		return true;
+	}
 
-	delta_pressure = 100.0 * (_PPC1_data.channel_D->sensor_reading +
-		(_PPC1_data.channel_C->sensor_reading * 3.0) -
-		(-_PPC1_data.channel_B->sensor_reading * 2.0));
-	_PPC1_status.outflow_on = this->getFlowSimple(delta_pressure, m_tip->length_to_tip);
+	case 'P':  // FALLING TTL signal detected
+		_sample.trigger_fall = true;
+		return false;
 
-	delta_pressure = 100.0 * ((_PPC1_data.channel_C->sensor_reading * 4.0) -
-		(-_PPC1_data.channel_B->sensor_reading * 2.0));
-	_PPC1_status.outflow_off = 2.0 * this->getFlowSimple(delta_pressure, 2.0 * m_tip->length_to_zone);
+	case 'R':  // RISING TTL signal detected
+		_sample.trigger_rise = true;
+		return false;
 
-	_PPC1_status.in_out_ratio_on = _PPC1_status.outflow_on / _PPC1_status.inflow_recirculation;
-	_PPC1_status.in_out_ratio_off = _PPC1_status.outflow_off / _PPC1_status.inflow_recirculation;
+	default:
+		_sample.data_corrupted = true;
+		return false;
+	}
+}
 
-	if (_PPC1_data.i || _PPC1_data.j ||
-		_PPC1_data.k || _PPC1_data.l) // if one of the solutions is on
+size_t fluicell::PPC1api::decodeBuffer(const char *_data, size_t _size,
+	fluicell::PPC1dataStructures::PPC1_sample *_samples, size_t _max_samples,
+	size_t *_consumed) const
+{
+	size_t n_samples = 0;
+	size_t consumed = 0;
+	if (_data == NULL || _samples == NULL) {
+		if (_consumed != NULL) 
+			*_consumed = 0;
+		return 0;
+	}
+
+	// values not received in a frame are taken from the previous one
+	fluicell::PPC1dataStructures::PPC1_sample sample;
+	size_t line_begin = 0;
+	size_t separators[4];   // only the first 4 separators in a line are used
+	size_t n_separators = 0;
+
+	for (size_t block = 0; block < _size && n_samples < _max_samples; 
+		block += m_scan_block_size)
 	{
-		delta_pressure = 100.0 * (_PPC1_data.channel_D->sensor_reading +
-			(_PPC1_data.channel_C->sensor_reading * 3.0) -
-			(-_PPC1_data.channel_B->sensor_reading * 2.0));
+		unsigned int separators_mask;
+		unsigned int end_lines_mask = scanBlock(_data + block, _size - block, separators_mask);
+
+		// visit separators and new lines in order of position
+		unsigned int mask = end_lines_mask | separators_mask;
+		while (mask != 0)
+		{
+			unsigned int bit = lowestBitSet(mask);
+			size_t position = block + bit;
+			mask &= mask - 1;
+
+			if ((end_lines_mask >> bit) & 1u) {
+				bool end_of_frame = decodeSampleLine(_data + line_begin, position - line_begin,
+					separators, n_separators, sample);
+				line_begin = position + 1;
+				n_separators = 0;
+				if (end_of_frame) {
+					sample.sequence = n_samples;
+					_samples[n_samples++] = sample;
+					consumed = line_begin;
+					sample.trigger_fall = false;
+					sample.trigger_rise = false;
+					sample.data_corrupted = false;
+					if (n_samples == _max_samples)
+						break;
+				}
+			}
+			else if (n_separators < 4) {
+				separators[n_separators++] = position - line_begin;
+			}
+		}
+	}
+
+	if (_consumed != NULL)
+		*_consumed = consumed;
+	return n_samples;
+}
+
+void fluicell::PPC1api::commitFrame(std::chrono::steady_clock::time_point _timestamp)
+{
+	// the frame takes the current value of all the lines, 
+	// sensor readings are already filtered in m_PPC1_data
+	typedef fluicell::PPC1dataStructures::PPC1_data data;
+	for (int n = 0; n < 4; n++)
+		m_frame.channels[n] = m_PPC1_data.channels[n];
+	m_frame.i = m_PPC1_data.getValve(data::valve_i);
+	m_frame.j = m_PPC1_data.getValve(data::valve_j);
+	m_frame.k = m_PPC1_data.getValve(data::valve_k);
+	m_frame.l = m_PPC1_data.getValve(data::valve_l);
+	m_frame.ppc1_IN = m_PPC1_data.getFlag(data::ppc1_IN) ? 1 : 0;
+	m_frame.ppc1_OUT = m_PPC1_data.getFlag(data::ppc1_OUT) ? 1 : 0;
+	m_frame.sequence++;
+	m_frame.timestamp = _timestamp;
+
+	// flows only change with the readings, the valves or the tip 
+	if (flowInputsChanged(m_frame))
+		this->updateFlows(m_frame, *m_PPC1_status);
+
+	// publish sample and flows together
+	fluicell::PPC1dataStructures::PPC1_snapshot snapshot;
+	snapshot.sample = m_frame;
+	snapshot.status = *m_PPC1_status;
+	bool valves_changed = (m_frame.sequence > 1) && 
+		(m_frame.i != m_last_valves[0] || m_frame.j != m_last_valves[1] ||
+		 m_frame.k != m_last_valves[2] || m_frame.l != m_last_valves[3]);
+	m_last_valves[0] = m_frame.i;
+	m_last_valves[1] = m_frame.j;
+	m_last_valves[2] = m_frame.k;
+	m_last_valves[3] = m_frame.l;
+	m_snapshot.store(snapshot);
+	m_sample_buffer.push(m_frame);
+
+	// the subscribers are notified after the publication 
+	notify(fluicell::PPC1dataStructures::PPC1_event(
+		fluicell::PPC1dataStructures::PPC1_event::newSample, m_frame));
+	if (valves_changed)
+		notify(fluicell::PPC1dataStructures::PPC1_event(
+			fluicell::PPC1dataStructures::PPC1_event::valvesChanged, m_frame));
+	if (m_frame.data_corrupted)
+		notify(fluicell::PPC1dataStructures::PPC1_event(
+			fluicell::PPC1dataStructures::PPC1_event::corruptedFrame, m_frame));
+
+	// these only refer to the frame just published
+	m_frame.trigger_fall = false;
+	m_frame.trigger_rise = false;
+	m_frame.data_corrupted = false;
+}
 
-		_PPC1_status.outflow_tot = _PPC1_status.outflow_on;
-		_PPC1_status.in_out_ratio_tot = _PPC1_status.in_out_ratio_on;
+void fluicell::PPC1api::notify(const fluicell::PPC1dataStructures::PPC1_event &_event)
+{
+	// nothing to do if nobody is interested
+	if ((m_subscribed_events & _event.type) == 0)
+		return;
 
-		_PPC1_status.flow_rate_1 = _PPC1_status.solution_usage_off;
-		_PPC1_status.flow_rate_2 = _PPC1_status.solution_usage_off;
-		_PPC1_status.flow_rate_3 = _PPC1_status.solution_usage_off;
-		_PPC1_status.flow_rate_4 = _PPC1_status.solution_usage_off;
+	std::shared_ptr<const subscriberList> subscribers = std::atomic_load(&m_subscribers);
+	for (size_t i = 0; i < subscribers->size(); i++)
+	{
+		const subscriber &s = subscribers->at(i);
+		if ((s.event_mask & _event.type) == 0)
+			continue;
+
+		if (s.mode == dispatchQueued) {
+			std::lock_guard<std::mutex> lock(m_event_queue_mutex);
+			if (m_event_queue.size() >= m_max_queued_events)
+				m_event_queue.pop_front();  // nobody is dispatching, drop the oldest
+			m_event_queue.push_back(std::make_pair(s.id, _event));
+			continue;
+		}
 
-		if (_PPC1_data.l) _PPC1_status.flow_rate_1 = _PPC1_status.solution_usage_on;
-		if (_PPC1_data.k) _PPC1_status.flow_rate_2 = _PPC1_status.solution_usage_on;
-		if (_PPC1_data.j) _PPC1_status.flow_rate_3 = _PPC1_status.solution_usage_on;
-		if (_PPC1_data.i) _PPC1_status.flow_rate_4 = _PPC1_status.solution_usage_on;
+		// a failing subscriber must not stop the thread
+		try {
+			s.callback(_event);
+		}
+		catch (std::exception &e) {
+			logError(HERE, " exception in the subscriber " + 
+				std::to_string(s.id) + " " + std::string(e.what()));
+		}
 	}
-	else {
+}
 
-		_PPC1_status.outflow_tot = _PPC1_status.outflow_off;
-		_PPC1_status.in_out_ratio_tot = _PPC1_status.in_out_ratio_off;
+void fluicell::PPC1api::notifyException(const std::string &_message)
+{
+	fluicell::PPC1dataStructures::PPC1_event event(
+		fluicell::PPC1dataStructures::PPC1_event::exception, m_frame);
+	event.message = _message;
+	notify(event);
+}
+
+int fluicell::PPC1api::subscribe(int _event_mask, eventCallback _callback, dispatchMode _mode)
+{
+	if (!_callback || (_event_mask & fluicell::PPC1dataStructures::PPC1_event::allEvents) == 0) {
+		logError(HERE, " invalid subscription ");
+		return -1;
+	}
+
+	std::lock_guard<std::mutex> lock(m_subscribe_mutex);
+	subscriber s;
+	s.id = m_next_subscriber_id++;
+	s.event_mask = _event_mask;
+	s.callback = _callback;
+	s.mode = _mode;
+
+	// copy on write, the thread keeps using the old list until it is done with it
+	std::shared_ptr<subscriberList> subscribers = 
+		std::make_shared<subscriberList>(*std::atomic_load(&m_subscribers));
+	subscribers->push_back(s);
+	std::atomic_store(&m_subscribers, std::shared_ptr<const subscriberList>(subscribers));
+	m_subscribed_events |= _event_mask;
+	return s.id;
+}
 
-		_PPC1_status.flow_rate_1 = _PPC1_status.solution_usage_off;
-		_PPC1_status.flow_rate_2 = _PPC1_status.solution_usage_off;
-		_PPC1_status.flow_rate_3 = _PPC1_status.solution_usage_off;
-		_PPC1_status.flow_rate_4 = _PPC1_status.solution_usage_off;
+bool fluicell::PPC1api::unsubscribe(int _id)
+{
+	std::lock_guard<std::mutex> lock(m_subscribe_mutex);
+	std::shared_ptr<subscriberList> subscribers = std::make_shared<subscriberList>();
+	int event_mask = 0;
+	bool found = false;
+	std::shared_ptr<const subscriberList> current = std::atomic_load(&m_subscribers);
+	for (size_t i = 0; i < current->size(); i++) {
+		if (current->at(i).id == _id) {
+			found = true;
+			continue;
+		}
+		subscribers->push_back(current->at(i));
+		event_mask |= current->at(i).event_mask;
 	}
+	if (!found)
+		return false;
 
-	_PPC1_status.flow_rate_5 = _PPC1_status.inflow_switch / 2.0;
-	_PPC1_status.flow_rate_6 = _PPC1_status.inflow_switch / 2.0;
-	_PPC1_status.flow_rate_7 = _PPC1_status.inflow_recirculation / 2.0;
-	_PPC1_status.flow_rate_8 = _PPC1_status.inflow_recirculation / 2.0;
+	std::atomic_store(&m_subscribers, std::shared_ptr<const subscriberList>(subscribers));
+	m_subscribed_events = event_mask;
+	return true;
+}
 
+size_t fluicell::PPC1api::dispatchEvents(size_t _max_events)
+{
+	std::deque<std::pair<int, fluicell::PPC1dataStructures::PPC1_event> > events;
+	{
+		std::lock_guard<std::mutex> lock(m_event_queue_mutex);
+		if (m_event_queue.size() <= _max_events) {
+			events.swap(m_event_queue);
+		}
+		else {
+			events.assign(m_event_queue.begin(), m_event_queue.begin() + _max_events);
+			m_event_queue.erase(m_event_queue.begin(), m_event_queue.begin() + _max_events);
+		}
+	}
+
+	// callbacks run without holding any lock, they can subscribe or unsubscribe
+	std::shared_ptr<const subscriberList> subscribers = std::atomic_load(&m_subscribers);
+	size_t n_events = 0;
+	for (size_t e = 0; e < events.size(); e++)
+	{
+		for (size_t i = 0; i < subscribers->size(); i++) {
+			if (subscribers->at(i).id != events[e].first)
+				continue;  // this subscriber may be gone in the meantime
+			subscribers->at(i).callback(events[e].second);
+			n_events++;
+			break;
+		}
+	}
+	return n_events;
+}
+
+void fluicell::PPC1api::updateFlows(const fluicell::PPC1dataStructures::PPC1_sample &_sample, 
+	fluicell::PPC1dataStructures::PPC1_status &_PPC1_status) const
+{
+	typedef fluicell::PPC1dataStructures::PPC1_status status;
+	const fluicell::PPC1dataStructures::flowCoefficients c = m_flow_coefficients.load();
+	const double v_recirc = _sample.channels[0].sensor_reading;
+	const double v_switch = _sample.channels[1].sensor_reading;
+	const double p_off = _sample.channels[2].sensor_reading;
+	const double p_on = _sample.channels[3].sensor_reading;
+	std::array<double, status::number_of_flows> &flows = _PPC1_status.flows;
+
+	// calculate inflow
+	flows[status::inflow_recirculation] = 2.0 * c.tip * 100.0 * (-v_recirc);
+	flows[status::inflow_switch] = 2.0 * c.tip * 100.0 * (-v_recirc + 2.0 * p_off * (1 - c.tip_zone));
+	flows[status::solution_usage_off] = c.zone * 100.0 * 2.0 * p_off;
+	flows[status::solution_usage_on] = c.tip * 100.0 * p_on;
+
+	// calculate outflow
+	flows[status::outflow_on] = c.tip * 100.0 * (p_on + (p_off * 3.0) - (-v_switch * 2.0));
+	flows[status::outflow_off] = 2.0 * c.zone * 100.0 * ((p_off * 4.0) - (-v_switch * 2.0));
+
+	flows[status::in_out_ratio_on] = flows[status::outflow_on] / flows[status::inflow_recirculation];
+	flows[status::in_out_ratio_off] = flows[status::outflow_off] / flows[status::inflow_recirculation];
+
+	// the wells 1 to 4 are connected to the valves l, k, j, i
+	const int valves[4] = { _sample.l, _sample.k, _sample.j, _sample.i };
+	const bool solution_on = _sample.i || _sample.j || _sample.k || _sample.l;
+	flows[status::outflow_tot] = solution_on ? flows[status::outflow_on] : flows[status::outflow_off];
+	flows[status::in_out_ratio_tot] = solution_on ? 
+		flows[status::in_out_ratio_on] : flows[status::in_out_ratio_off];
+	for (int n = 0; n < 4; n++)
+		flows[status::flow_rate_1 + n] = valves[n] ? 
+			flows[status::solution_usage_on] : flows[status::solution_usage_off];
+
+	flows[status::flow_rate_5] = flows[status::inflow_switch] / 2.0;
+	flows[status::flow_rate_6] = flows[status::inflow_switch] / 2.0;
+	flows[status::flow_rate_7] = flows[status::inflow_recirculation] / 2.0;
+	flows[status::flow_rate_8] = flows[status::inflow_recirculation] / 2.0;
+}
+
+bool fluicell::PPC1api::flowInputsChanged(const fluicell::PPC1dataStructures::PPC1_sample &_sample)
+{
+	const int valves = _sample.i | (_sample.j << 1) | (_sample.k << 2) | (_sample.l << 3);
+	const unsigned long long tip_version = m_flow_coefficients.version();
+	bool changed = valves != m_flow_valves || tip_version != m_flow_tip_version;
+	for (int n = 0; n < 4; n++)
+		changed = changed || _sample.channels[n].sensor_reading != m_flow_readings[n];
+	if (!changed)
+		return false;
+
+	m_flow_valves = valves;
+	m_flow_tip_version = tip_version;
+	for (int n = 0; n < 4; n++)
+		m_flow_readings[n] = _sample.channels[n].sensor_reading;
+	return true;
+}
+
+void fluicell::PPC1api::updateFlowCoefficients()
+{
+	std::lock_guard<std::mutex> lock(m_tip_mutex);
+	fluicell::PPC1dataStructures::flowCoefficients c;
+	c.tip = m_flow_constant / m_tip->length_to_tip;
+	c.zone = m_flow_constant / (2.0 * m_tip->length_to_zone);
+	c.tip_zone = m_tip->length_to_tip / m_tip->length_to_zone;
+	m_flow_coefficients.store(c);
 }
 
 bool fluicell::PPC1api::connectCOM() 
@@ -390,6 +943,9 @@ bool fluicell::PPC1api::connectCOM()
 		m_PPC1_serial->setBaudrate(m_baud_rate);
 		m_PPC1_serial->setFlowcontrol(serial::flowcontrol_none);
 		m_PPC1_serial->setParity(serial::parity_none);
+		// reads block until a line is complete or the timeout expires
+		serial::Timeout timeout = serial::Timeout::simpleTimeout(m_COM_timeout);
+		m_PPC1_serial->setTimeout(timeout);
 
 		if (!checkVIDPID(m_COMport)) {
 			logError(HERE, " no match VID/PID device "); 
@@ -412,6 +968,15 @@ bool fluicell::PPC1api::connectCOM()
 			return false;
 		}
 		else {
+			// new session, the stream starts from scratch
+			m_line_buffer.clear();
+			m_resync = false;
+			m_bytes_received = 0;
+			m_lines_received = 0;
+			m_lines_dropped = 0;
+			m_partial_lines = 0;
+			m_commands_skipped = 0;
+			resetShadow();  // the PPC1 state is unknown until it is streamed
 			m_excep_handler = false; //only on connection verified we reset the exception handler
 			return true; // open connection verified 
 		}
@@ -452,7 +1017,14 @@ bool fluicell::PPC1api::connectCOM()
 
 void fluicell::PPC1api::disconnectCOM()
 {
+	{
+		// the port is not closed under the serial thread
+		std::lock_guard<std::mutex> lock(m_thread_mutex);
+		joinThread();
+	}
 	if (m_PPC1_serial->isOpen()) {
+		// the commands queued go out before the port is closed, e.g. the pumpingOff sent by stop
+		flushWrites();
 		m_PPC1_serial->close();
 		std::this_thread::sleep_for(std::chrono::microseconds(100));
 		m_excep_handler = false;
@@ -462,11 +1034,13 @@ void fluicell::PPC1api::disconnectCOM()
 void fluicell::PPC1api::pumpingOff() const
 {
 	if (m_PPC1_serial->isOpen()) {
-		setVacuumChannelA(0.0);   
-		setVacuumChannelB(0.0);   
-		setPressureChannelC(0.0); 
-		setPressureChannelD(0.0); 
-		closeAllValves();
+		fluicell::commandBatch batch;
+		batch.setVacuumChannelA(0.0);
+		batch.setVacuumChannelB(0.0);
+		batch.setPressureChannelC(0.0);
+		batch.setPressureChannelD(0.0);
+		batch.setValvesState(0xF0);  // close all the valves
+		sendSafetyBatch(batch);
 	}
 }
 
@@ -486,131 +1060,271 @@ bool fluicell::PPC1api::closeAllValves() const
 
 void fluicell::PPC1api::reboot() const
 {
-	if (m_PPC1_serial->isOpen()) {
-		m_PPC1_serial->write("!\n");
-	}
+	// nothing queued makes sense after a reboot
+	fluicell::commandBatch batch;
+	batch.addCommand('!');
+	sendSafetyBatch(batch);
 }
 
-bool fluicell::PPC1api::setVacuumChannelA(const double _value) const
+std::future<bool> fluicell::PPC1api::setChannelAsync(int _channel, double _value, 
+	int _timeout_ms) const
 {
+	bool sent = false;
+	switch (_channel) {
+	case fluicell::PPC1dataStructures::PPC1_data::channel_A: sent = setVacuumChannelA(_value); break;
+	case fluicell::PPC1dataStructures::PPC1_data::channel_B: sent = setVacuumChannelB(_value); break;
+	case fluicell::PPC1dataStructures::PPC1_data::channel_C: sent = setPressureChannelC(_value); break;
+	case fluicell::PPC1dataStructures::PPC1_data::channel_D: sent = setPressureChannelD(_value); break;
+	default: 
+		logError(HERE, " invalid channel " + std::to_string(_channel));
+		break;
+	}
+
+	if (!sent)
+		return readyFuture(false);
+
+	fluicell::commandBatch batch;
+	batch.setChannel(_channel, _value);
+	return expectSetPoints(batch, _timeout_ms);
+}
 
-	if (_value >= MIN_CHAN_A && _value <= MAX_CHAN_A)
-	{
-		std::string ss;
-		ss.append("A");
-		ss.append(std::to_string(_value));
-		ss.append("\n");
-		if (sendData(ss)) return true;
+std::future<bool> fluicell::PPC1api::expectSetPoints(const fluicell::commandBatch &_batch, 
+	int _timeout_ms) const
+{
+	setPointConfirmation confirmation;
+	confirmation.channels = 0;
+	for (int n = 0; n < fluicell::commandBatch::number_of_channels; n++) {
+		confirmation.values[n] = 0.0;
+		if (_batch.hasSetPoint(n)) {
+			confirmation.channels |= 1 << n;
+			confirmation.values[n] = _batch.getSetPoint(n);
+		}
 	}
-	else
+	if (confirmation.channels == 0 || _timeout_ms <= 0)
+		return readyFuture(true);  // nothing to wait for
+
+	// the thread completes the promise when the set points come back,
+	// it sets m_isRunning to false under the same lock when it stops
+	std::future<bool> future = confirmation.promise.get_future();
+	confirmation.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_timeout_ms);
+	std::lock_guard<std::mutex> lock(m_confirmation_mutex);
+	if (!m_isRunning) {
+		confirmation.promise.set_value(true);  // nothing can be confirmed, the batch was sent
+		return future;
+	}
+	m_confirmations.push_back(std::move(confirmation));
+	m_n_confirmations = static_cast<int>(m_confirmations.size());
+	return future;
+}
+
+std::future<bool> fluicell::PPC1api::readyFuture(bool _value)
+{
+	std::promise<bool> promise;
+	promise.set_value(_value);
+	return promise.get_future();
+}
+
+bool fluicell::PPC1api::waitConfirmation(std::future<bool> _future, int _timeout_ms)
+{
+	if (_future.wait_for(std::chrono::milliseconds(std::max(_timeout_ms, 0))) != std::future_status::ready)
+		return false;  // not expired by the thread yet
+	return _future.get();
+}
+
+void fluicell::PPC1api::checkConfirmations(bool _fail_all)
+{
+	if (m_n_confirmations == 0 && !_fail_all)
+		return;
+
+	const int n_channels = fluicell::commandBatch::number_of_channels;
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(m_confirmation_mutex);
+	if (_fail_all)
+		m_isRunning = false;  // no confirmation is queued after this, see expectSetPoints
+	size_t n = 0;
+	while (n < m_confirmations.size())
 	{
-		logError(HERE, " out of range " );
-		sendData("A0.0\n");  // send 0
-		return false;
+		setPointConfirmation &c = m_confirmations[n];
+		for (int ch = 0; ch < n_channels && !_fail_all; ch++)
+			if ((c.channels & (1 << ch)) != 0 &&
+				std::abs(m_PPC1_data.channels[ch].set_point - c.values[ch]) <= m_set_point_tolerance)
+				c.channels &= ~(1 << ch);
+
+		if (c.channels == 0) {
+			c.promise.set_value(true);
+		}
+		else if (_fail_all || now >= c.deadline) {
+			std::string channels;
+			for (int ch = 0; ch < n_channels; ch++)
+				if ((c.channels & (1 << ch)) != 0)
+					channels += static_cast<char>('A' + ch);
+			logError(HERE, " set points not confirmed on the channels " + channels);
+			c.promise.set_value(false);
+		}
+		else {
+			n++;
+			continue;
+		}
+		// completed, the last one takes its place
+		if (n != m_confirmations.size() - 1)
+			m_confirmations[n] = std::move(m_confirmations.back());
+		m_confirmations.pop_back();
 	}
+	m_n_confirmations = static_cast<int>(m_confirmations.size());
+}
+
+bool fluicell::PPC1api::setVacuumChannelA(const double _value) const
+{
+	fluicell::commandBatch batch;
+	if (batch.setVacuumChannelA(_value))
+		return sendBatch(batch);
+
+	logError(HERE, " out of range ");
+	sendData("A0.0\n");  // send 0
 	return false;
 }
 
 bool fluicell::PPC1api::setVacuumChannelB(const double _value) const
 {
-	if (_value >= MIN_CHAN_B && _value <= MAX_CHAN_B)
-	{
-		std::string ss;
-		ss.append("B");
-		ss.append(std::to_string(_value));
-		ss.append("\n");
-		if (sendData(ss)) return true;
-	}
-	else
-	{
-		logError(HERE, " out of range ");
-		sendData("B0.0\n");  // send 0
-		return false;
-	}
+	fluicell::commandBatch batch;
+	if (batch.setVacuumChannelB(_value))
+		return sendBatch(batch);
+
+	logError(HERE, " out of range ");
+	sendData("B0.0\n");  // send 0
 	return false;
 }
 
 bool fluicell::PPC1api::setPressureChannelC(const double _value) const
 {
-	if (_value >= MIN_CHAN_C && _value <= MAX_CHAN_C)
-	{
-		std::string ss;
-		ss.append("C");
-		ss.append(std::to_string(_value));
-		ss.append("\n");
-		if (sendData(ss)) return true;
-	}
-	else
-	{
-		logError(HERE, " out of range ");
-		sendData("C0.0\n");  // send 0
-		return false;
-	}
+	fluicell::commandBatch batch;
+	if (batch.setPressureChannelC(_value))
+		return sendBatch(batch);
+
+	logError(HERE, " out of range ");
+	sendData("C0.0\n");  // send 0
 	return false;
 }
 
 bool fluicell::PPC1api::setPressureChannelD(const double _value) const
 {
-	if (_value >= MIN_CHAN_D && _value <= MAX_CHAN_D)
-	{
-		std::string ss;
-		ss.append("D");
-		ss.append(std::to_string(_value));
-		ss.append("\n");
-		if (sendData(ss)) return true;
-	}
-	else {
-		logError(HERE, " out of range ");
-		sendData("D0.0\n");  // send 0
-		return false;
-	}
+	fluicell::commandBatch batch;
+	if (batch.setPressureChannelD(_value))
+		return sendBatch(batch);
 
+	logError(HERE, " out of range ");
+	sendData("D0.0\n");  // send 0
 	return false;
 }
 
 bool fluicell::PPC1api::setValve_l(const bool _value) const
 {
-	if (_value) 
-		return sendData("l1\n");   // close
-	else 
-		return sendData("l0\n");  // open
+	return setValve('l', 0x01, _value);
 }
 
-bool fluicell::PPC1api::setValve_k(const bool _value)  const 
+bool fluicell::PPC1api::setValve_k(const bool _value) const
 {
-	if (_value) 
-		return sendData("k1\n");   // close
-	else 
-		return sendData("k0\n");  // open
+	return setValve('k', 0x02, _value);
 }
 
-bool fluicell::PPC1api::setValve_j(const bool _value)  const 
+bool fluicell::PPC1api::setValve_j(const bool _value) const
 {
-	if (_value) 
-		return sendData("j1\n");   // close
-	else 
-		return sendData("j0\n");  // open
+	return setValve('j', 0x04, _value);
 }
 
 bool fluicell::PPC1api::setValve_i(const bool _value) const
 {
-	if (_value) 
-		return sendData("i1\n");   // close
-	else 
-		return sendData("i0\n");  // open
+	return setValve('i', 0x08, _value);
+}
+
+bool fluicell::PPC1api::setChannelCoalesced(int _channel, double _value) const
+{
+	// check the value now, the thread cannot report errors
+	fluicell::commandBatch check;
+	if (!check.setChannel(_channel, _value)) {
+		logError(HERE, " out of range or invalid channel " + std::to_string(_channel));
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_coalesce_mutex);
+	m_coalesced_values[_channel] = _value;
+	m_coalesced_pending |= 1 << _channel;
+	if (!m_coalesce_thread.joinable())
+		m_coalesce_thread = std::thread(&PPC1api::threadCoalescer, this);
+	m_coalesce_condition.notify_one();
+	return true;
+}
+
+void fluicell::PPC1api::setCoalescePeriod(int _period_ms)
+{
+	if (_period_ms < 0) {
+		logError(HERE, " negative coalesce period " + std::to_string(_period_ms));
+		return;
+	}
+	m_coalesce_period = _period_ms;
+}
+
+void fluicell::PPC1api::threadCoalescer() const
+{
+	std::chrono::steady_clock::time_point next_write = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock(m_coalesce_mutex);
+	while (!m_coalesce_stop)
+	{
+		if (m_coalesced_pending == 0) {
+			m_coalesce_condition.wait(lock);
+			continue;
+		}
+		// new values keep replacing the pending ones until the next write is allowed
+		if (std::chrono::steady_clock::now() < next_write) {
+			m_coalesce_condition.wait_until(lock, next_write);
+			continue;
+		}
+
+		// the batch is queued under the lock, a command sent after this one 
+		// (e.g. pumpingOff) is always queued after it
+		const int pending = m_coalesced_pending.exchange(0);
+		fluicell::commandBatch batch;
+		for (int n = 0; n < fluicell::commandBatch::number_of_channels; n++)
+			if (pending & (1 << n))
+				batch.setChannel(n, m_coalesced_values[n]);
+		next_write = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_coalesce_period);
+
+		fluicell::commandBatch written;
+		writeBatch(batch, written);
+	}
+}
+
+bool fluicell::PPC1api::setValve(char _command, int _bit, bool _value) const
+{
+	std::lock_guard<std::mutex> lock(m_shadow_mutex);
+	if (m_shadow.valves_state == deviceShadow::confirmed &&
+		((m_shadow.valves & _bit) != 0) == _value) {
+		m_commands_skipped++;
+		return true;
+	}
+
+	const char command[3] = { _command, _value ? '1' : '0', '\n' };
+	if (!sendData(command, sizeof(command))) {
+		m_shadow.valves_state = deviceShadow::unknown;
+		return false;
+	}
+	// a single valve only updates a state already known
+	if (m_shadow.valves_state != deviceShadow::unknown) {
+		m_shadow.valves = _value ? (m_shadow.valves | _bit) : (m_shadow.valves & ~_bit);
+		m_shadow.valves_state = deviceShadow::pending;
+	}
+	return true;
 }
 
 bool fluicell::PPC1api::setValvesState(const int _value) const
 {
-	std::stringstream value;
-	value << std::setfill('0') 
-		  << std::setw(2) // we expect only one byte so 2 is the number of allowed hex digits
-		  << std::hex << _value;
-	std::string msg;
-	msg.append("v");
-	msg.append(value.str());
-	msg.append("\n");
-	return sendData(msg);
+	// we expect only one byte so 2 is the number of allowed hex digits
+	fluicell::commandBatch batch;
+	if (batch.setValvesState(_value))
+		return sendBatch(batch);
+
+	logError(HERE, " out of range ");
+	return false;
 }
 
 bool fluicell::PPC1api::setTTLstate(const bool _value) const
@@ -618,14 +1332,14 @@ bool fluicell::PPC1api::setTTLstate(const bool _value) const
 	if (_value) {
 		if (sendData("o1\n"))   // high
 		{
-			m_PPC1_data->TTL_out_trigger = true;
+			m_TTL_out_trigger = true;
 			return true;
 		}
 	}
 	else {
 		if (sendData("o0\n"))  // low
 		{
-			m_PPC1_data->TTL_out_trigger = false;
+			m_TTL_out_trigger = false;
 			return true;
 		}
 	}
@@ -637,11 +1351,9 @@ bool fluicell::PPC1api::setPulsePeriod(const int _value) const
 {
 	if (_value >= MIN_PULSE_PERIOD )
 	{
-		std::string ss;
-		ss.append("p");
-		ss.append(std::to_string(_value));
-		ss.append("\n");
-		return sendData(ss);
+		fluicell::commandBatch batch;
+		batch.addCommand('p', _value);
+		return sendBatch(batch);
 	}
 	else
 	{
@@ -655,11 +1367,9 @@ bool fluicell::PPC1api::setRuntimeTimeout(const int _value) const
 
 	if (_value < 1)
 	{
-		std::string ss;
-		ss.append("z");
-		ss.append(std::to_string(_value));
-		ss.append("\n");
-		return sendData(ss);
+		fluicell::commandBatch batch;
+		batch.addCommand('z', _value);
+		return sendBatch(batch);
 	}
 	else
 	{
@@ -669,376 +1379,422 @@ bool fluicell::PPC1api::setRuntimeTimeout(const int _value) const
 }
 
 bool fluicell::PPC1api::setZoneSizePerc(double _percentage) const
+{
+	// the commands are queued, the future is ready at once without a timeout
+	return setZoneSizePercAsync(_percentage, 0).get();
+}
+
+std::future<bool> fluicell::PPC1api::setZoneSizePercAsync(double _percentage, int _timeout_ms) const
 {
 	// check for out of bound values
 	if (_percentage < MIN_ZONE_SIZE_PERC ||
 		_percentage > MAX_ZONE_SIZE_PERC)
 	{
 		logError(HERE, " zone size value out of range ");
-		return false; // out of bound
-	}
-
-	// convert percentage
-	double percentage = _percentage / 100.0;
-
-	// the zone size is actually the cubic root of the display value	
-	double value = m_default_v_recirc * (2.0 -
-		std::pow(percentage, (1.0 / 3.0)));
-	
-	logStatus(HERE, " new recirculation value " + std::to_string(value) +
-			"m_default_v_recirc" + std::to_string(m_default_v_recirc));
-
-	// check for out of bound vacuum values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_A || value >= MAX_CHAN_A) {
-		logError(HERE, " recirculation value out of range ");
-		return false; // out of bound
+		return readyFuture(false); // out of bound
 	}
 
-	// send the command
-	if (!setVacuumChannelA(value)) {
-		return false;
-	}
+	// keep the current flow speed
+	double flow_speed = getFlowSpeedPerc();
+	if (flow_speed < MIN_FLOW_SPEED_PERC || flow_speed > MAX_FLOW_SPEED_PERC)
+		flow_speed = 100.0;
 
-	// reset the switch to default
-	if (!setVacuumChannelB(m_default_v_switch)) {
-		return false;
-	}
-
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10));
-
-	// calculate the new Pon value
-	// using the cubic root of the display value
-	value = m_default_pon * (
-		std::pow(percentage, (1.0 / 3.0)));
-
-	logStatus(HERE," new pon value " + std::to_string(value) +
-			"m_default_pon" + std::to_string(m_default_pon));
-
-	// check for out of bound pressure values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_D || value >= MAX_CHAN_D) {
-		logError(HERE, " pon pressure value out of range ");
-		return false; // out of bound 
-	}
-
-	// send the command
-	if (!setPressureChannelD(value)) {
-		return false;
-	}
-
-	// reset the poff to default
-	if (!setPressureChannelC(m_default_poff)) {
-		return false;
-	}
-
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10));
-	return true;
+	return setOperatingPointAsync(_percentage, flow_speed, _timeout_ms);
 }
 
 bool fluicell::PPC1api::changeZoneSizePercBy(double _percentage) const
+{
+	// the commands are queued, the future is ready at once without a timeout
+	return changeZoneSizePercByAsync(_percentage, 0).get();
+}
+
+std::future<bool> fluicell::PPC1api::changeZoneSizePercByAsync(double _percentage, int _timeout_ms) const
 {	
 	// check for out of bound values
 	if (std::abs(_percentage) > MAX_ZONE_SIZE_INCREMENT )
 	{
 		logError(HERE, " zone size value out of range ");
-		return false; // out of bound
-	}
-
-	// convert percentage
-	double increment = (100.0 + _percentage) / 100.0;
-
-	// calculate new vacuum value
-	// the zone size is actually the cubic root of the display value	
-	double delta = (1.0 - std::pow(increment, (1.0 / 3.0)));
-	double value = m_PPC1_data->channel_A->set_point +
-		m_default_v_recirc * delta;
-
-	logStatus(HERE,	" new recirculation value " + std::to_string(value) +
-			"m_default_v_recirc" + std::to_string(m_default_v_recirc));
-	 
-	// check for out of bound vacuum values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_A || value >= MAX_CHAN_A) {
-		logError(HERE, " recirculation value out of range ");
-		return false; // out of bound
-	}
-
-	// send the command
-	if (!setVacuumChannelA(value)) {
-		return false;
+		return readyFuture(false); // out of bound
 	}
 
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10));
-	
-	// calculate new pressure value
-	// the zone size is actually the cubic root of the display value	
-	//delta = (1.0 - std::pow(increment, (1.0 / 3.0)));
-	value = m_PPC1_data->channel_D->set_point - m_default_pon  * delta;
-	
-	logStatus(HERE,	" new pon value " + std::to_string(value) +
-			"m_default_pon" + std::to_string(m_default_pon));
-	
-	// check for out of bound pressure values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_D || value >= MAX_CHAN_D) {
-		logError(HERE, " pon pressure value out of range ");
-		return false; // out of bound
-	}
-	
-	// send the command
-	if (!setPressureChannelD(value)) {
-		return false;
-	}
-	
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10));
-	return true;
+	// the new zone size is checked and solved as in setZoneSizePerc
+	return setZoneSizePercAsync(getZoneSizePerc() + _percentage, _timeout_ms);
 }
 
 double fluicell::PPC1api::getZoneSizePerc() const
 {
-	double in_out_ratio_on = 0;
+	// all the values are taken from the same frame
+	const fluicell::PPC1dataStructures::PPC1_sample sample = getLastSample();
 
 	bool use_sensor_reading = false;
 	if (use_sensor_reading) {
-		in_out_ratio_on = m_PPC1_status->in_out_ratio_on;
-	}
-	else
-	{
-		// calculate the outflow_on based on set value instead of the sensor reading
-		double outflow_on;
-		double delta_pressure = 100.0 * (m_PPC1_data->channel_D->set_point +
-			(m_PPC1_data->channel_C->set_point * 3.0) -
-			(-m_PPC1_data->channel_B->set_point * 2.0));
-	    outflow_on = this->getFlowSimple(delta_pressure, m_tip->length_to_tip);
-
-		// calculate inflow_recirculation based on set value instead of the sensor reading
-		double inflow_recirculation;
-		delta_pressure = 100.0 * (-m_PPC1_data->channel_A->set_point);//   v_r;
-		inflow_recirculation = 2.0 * this->getFlowSimple(delta_pressure, m_tip->length_to_tip);
-		
-		in_out_ratio_on = outflow_on / inflow_recirculation;
+		double in_out_ratio_on = getPipetteStatus().flows[fluicell::PPC1dataStructures::PPC1_status::in_out_ratio_on];
+		return 100.0 *(in_out_ratio_on + 0.21) / 0.31;
 	}
+
+	// calculation based on set value instead of the sensor reading
+	return zoneSizePerc(sample.channels[3].set_point, sample.channels[2].set_point,
+		sample.channels[1].set_point, sample.channels[0].set_point);
+}
+
+double fluicell::PPC1api::zoneSizePerc(double _pon, double _poff, 
+	double _v_switch, double _v_recirc) const
+{
+	const double tip = m_flow_coefficients.load().tip;
+
+	// calculate the outflow_on 
+	double delta_pressure = 100.0 * (_pon + (_poff * 3.0) - (-_v_switch * 2.0));
+	double outflow_on = tip * delta_pressure;
+
+	// calculate inflow_recirculation 
+	delta_pressure = 100.0 * (-_v_recirc);//   v_r;
+	double inflow_recirculation = 2.0 * tip * delta_pressure;
+
+	double in_out_ratio_on = outflow_on / inflow_recirculation;
 	double ds = 100.0 *(in_out_ratio_on + 0.21) / 0.31;
 	return ds;
 }
 
 bool fluicell::PPC1api::setFlowSpeedPerc(const double _percentage) const
+{
+	// the commands are queued, the future is ready at once without a timeout
+	return setFlowSpeedPercAsync(_percentage, 0).get();
+}
+
+std::future<bool> fluicell::PPC1api::setFlowSpeedPercAsync(double _percentage, int _timeout_ms) const
 {
 	// check for out of bound values
 	if (_percentage < MIN_FLOW_SPEED_PERC ||
 		_percentage > MAX_FLOW_SPEED_PERC)
 	{
-		logError(HERE, " zone size value out of range ");
-		return false; // out of bound
-	}
-
-	// convert percentage
-	double percentage = _percentage / 100.0;
-
-	// calculate new recirculation value
-	double value = m_default_v_recirc * percentage;  
-
-	logStatus(HERE, " new recirculation value " + std::to_string(value) );
-
-	// check for out of bound vacuum values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_A || value >= MAX_CHAN_A) {
-		logError(HERE, " recirculation value out of range ");
-		return false; // out of bound
-	}
-
-	// send the command
-	if (!setVacuumChannelA(value)) { 
-		return false;
-	}
-
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10));
-
-	// calculate new switch value
-	value = m_default_v_switch * percentage;  
-
-	logStatus(HERE, " new switch value " + std::to_string(value));
-
-	// check for out of bound vacuum values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_B || value >= MAX_CHAN_B) {
-		logError(HERE, " switch value out of range ");
-		return false; // out of bound
-	}
-
-	// send the command
-	if (!setVacuumChannelB(value)) {
-		return false;
-	}
-
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10));
-
-	// calculate new Poff value
-	value = m_default_poff * percentage;  
-
-	logStatus(HERE, " new poff value " + std::to_string(value));
-
-	// check for out of bound pressure values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_C || value >= MAX_CHAN_C) {
-		logError(HERE, " poff pressure value out of range ");
-		return false; // out of bound
-	}
-
-	// send the command
-	if (!setPressureChannelC(value)) { // increase C by _percentage%
-		return false;
-	}
-	
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10));
-
-	// calculate new Pon value
-	value = m_default_pon * percentage;  
-	logStatus(HERE,	" new pon value " + std::to_string(value));
-
-	// check for out of bound pressure values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_D || value >= MAX_CHAN_D) {
-		logError(HERE, " pon pressure value out of range ");
-		return false; // out of bound
-	}
-
-	// send the command
-	if (!setPressureChannelD(value)) { // increase D by _percentage%
-		return false;
+		logError(HERE, " flow speed value out of range ");
+		return readyFuture(false); // out of bound
 	}
 
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	// keep the current zone size
+	double zone_size = getZoneSizePerc();
+	if (zone_size < MIN_ZONE_SIZE_PERC || zone_size > MAX_ZONE_SIZE_PERC)
+		zone_size = 100.0;
 
-	return true;
+	return setOperatingPointAsync(zone_size, _percentage, _timeout_ms);
 }
 
 bool fluicell::PPC1api::changeFlowSpeedPercBy(const double _percentage) const
 {
+	// the commands are queued, the future is ready at once without a timeout
+	return changeFlowSpeedPercByAsync(_percentage, 0).get();
+}
+
+std::future<bool> fluicell::PPC1api::changeFlowSpeedPercByAsync(double _percentage, int _timeout_ms) const
+{
+	// all the values are taken from the same frame
+	const fluicell::PPC1dataStructures::PPC1_sample sample = getLastSample();
+
 
 	// check for out of bound values
 	if (std::abs(_percentage) > MAX_FLOW_SPEED_INCREMENT)
 	{
 		logError(HERE, " flow speed value out of range ");
-		return false; // out of bound
+		return readyFuture(false); // out of bound
 	}
 
 	// convert percentage
 	double percentage = _percentage / 100.0;
 
-	// calculate new recirculation value
-	double value = m_PPC1_data->channel_A->set_point + 
-		m_default_v_recirc * percentage;  // new recirc value
+	// calculate new values, all the channels change by the same percentage of the default 
+	double v_recirc = sample.channels[0].set_point + m_default_v_recirc * percentage;
+	double v_switch = sample.channels[1].set_point + m_default_v_switch * percentage;
+	double poff = sample.channels[2].set_point + m_default_poff * percentage;
+	double pon = sample.channels[3].set_point + m_default_pon * percentage;
 
-	logStatus(HERE,	" new recirculation value " + std::to_string(value));
+	logStatus(HERE,	" new recirculation value " + std::to_string(v_recirc) + 
+		" new switch value " + std::to_string(v_switch) +
+		" new poff value " + std::to_string(poff) +
+		" new pon value " + std::to_string(pon));
 
-	// check for out of bound vacuum values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_A || value >= MAX_CHAN_A) {
+	// check for out of bound values after the calculation before
+	// sending the commands to the PPC1
+	if (v_recirc <= MIN_CHAN_A || v_recirc >= MAX_CHAN_A) {
 		logError(HERE, " recirculation value out of range ");
-		return false; // out of bound
+		return readyFuture(false); // out of bound
 	}
-
-	// send the command
-	if ( !setVacuumChannelA(value)) { 
-		return false;
+	if (v_switch <= MIN_CHAN_B || v_switch >= MAX_CHAN_B) {
+		logError(HERE, " switch value out of range ");
+		return readyFuture(false); // out of bound
+	}
+	if (poff <= MIN_CHAN_C || poff >= MAX_CHAN_C) {
+		logError(HERE, " poff pressure value out of range ");
+		return readyFuture(false); // out of bound
+	}
+	if (pon <= MIN_CHAN_D || pon >= MAX_CHAN_D) {
+		logError(HERE, " pon pressure value out of range ");
+		return readyFuture(false); // out of bound
 	}
 
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10)); // wait 10msec
+	// send the commands in one write, the future completes when the PPC1 confirms them
+	fluicell::commandBatch batch;
+	batch.setVacuumChannelA(v_recirc);
+	batch.setVacuumChannelB(v_switch);
+	batch.setPressureChannelC(poff);
+	batch.setPressureChannelD(pon);
+	return sendBatchAsync(batch, _timeout_ms);
+}
 
-	//calculate new switch value
-	value = m_PPC1_data->channel_B->set_point + m_default_v_switch * percentage;  
-	logStatus(HERE, " new switch value " + std::to_string(value));
+double fluicell::PPC1api::getFlowSpeedPerc() const
+{
+	// all the values are taken from the same frame
+	const fluicell::PPC1dataStructures::PPC1_sample sample = getLastSample();
 
-	// check for out of bound vacuum values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_B || value >= MAX_CHAN_B) {
-		logError(HERE, " switch value out of range ");
-		return false; // out of bound
+	bool use_sensor_reading = false;
+	if (use_sensor_reading) {
+		return flowSpeedPerc(sample.channels[3].sensor_reading, sample.channels[2].sensor_reading,
+			sample.channels[1].sensor_reading, sample.channels[0].sensor_reading);
 	}
+	return flowSpeedPerc(sample.channels[3].set_point, sample.channels[2].set_point,
+		sample.channels[1].set_point, sample.channels[0].set_point);
+}
 
-	// send the command
-	if (!setVacuumChannelB(value)) { 
-		return false;
-	}
+double fluicell::PPC1api::flowSpeedPerc(double _pon, double _poff, 
+	double _v_switch, double _v_recirc) const
+{
+	double p1 = std::abs(100.0 * _v_recirc / m_default_v_recirc);
+	double p2 = std::abs(100.0 * _v_switch / m_default_v_switch);
+	double p3 = std::abs(100.0 * _poff / m_default_poff);
+	double p4 = std::abs(100.0 * _pon / m_default_pon);
+	double mean_percentage = (p1 + p2 + p3 + p4) / 4.0; // average 4 values
+	return mean_percentage;
+}
 
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10)); // wait 10msec
+void fluicell::PPC1api::operatingPointAt(double _x, double _s,
+	fluicell::PPC1dataStructures::operatingPoint &_point) const
+{
+	_point.pon = _s * _x * m_default_pon;
+	_point.poff = _s * m_default_poff;
+	_point.v_switch = _s * m_default_v_switch;
+	_point.v_recirc = _s * (2.0 - _x) * m_default_v_recirc;
+	_point.zone_size = zoneSizePerc(_point.pon, _point.poff, _point.v_switch, _point.v_recirc);
+	_point.flow_speed = flowSpeedPerc(_point.pon, _point.poff, _point.v_switch, _point.v_recirc);
+}
 
-	// calculate new Poff value
-	value = m_PPC1_data->channel_C->set_point + m_default_poff * percentage;  // new pressure poff value
-	logStatus(HERE, " new poff value " + std::to_string(value));
-	
-	// check for out of bound pressure values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_C || value >= MAX_CHAN_C) {
-		logError(HERE, " poff pressure value out of range ");
-		return false; // out of bound
+void fluicell::PPC1api::buildSolverGrid() const
+{
+	m_solver_tip_version = m_flow_coefficients.version();
+	m_solver_defaults[0] = m_default_pon;
+	m_solver_defaults[1] = m_default_poff;
+	m_solver_defaults[2] = m_default_v_switch;
+	m_solver_defaults[3] = m_default_v_recirc;
+
+	// x in (0, 2) and s covering the flow speed range with some margin
+	m_solver_grid.resize(m_solver_grid_size * m_solver_grid_size);
+	fluicell::PPC1dataStructures::operatingPoint point;
+	for (int i = 0; i < m_solver_grid_size; i++) {
+		const double x = 0.05 + 1.9 * i / (m_solver_grid_size - 1);
+		for (int j = 0; j < m_solver_grid_size; j++) {
+			const double s = 0.3 + 2.2 * j / (m_solver_grid_size - 1);
+			operatingPointAt(x, s, point);
+			m_solver_grid[i * m_solver_grid_size + j][0] = point.zone_size;
+			m_solver_grid[i * m_solver_grid_size + j][1] = point.flow_speed;
+		}
 	}
+}
 
-	// send the command
-	if (!setPressureChannelC(value)) { 
-		return false;
+bool fluicell::PPC1api::solveOperatingPoint(double _zone_size_perc, double _flow_speed_perc,
+	fluicell::PPC1dataStructures::operatingPoint &_point) const
+{
+	const int max_iterations = 20;
+	const double tolerance = 1e-6;  // in percentage
+	const double h = 1e-6;          // step for the derivatives
+
+	double x, s;
+	{
+		std::lock_guard<std::mutex> lock(m_solver_mutex);
+		if (m_solver_grid.empty() || 
+			m_solver_tip_version != m_flow_coefficients.version() ||
+			m_solver_defaults[0] != m_default_pon || m_solver_defaults[1] != m_default_poff ||
+			m_solver_defaults[2] != m_default_v_switch || m_solver_defaults[3] != m_default_v_recirc)
+			buildSolverGrid();
+
+		// closest grid point to the target
+		size_t best = 0;
+		double best_distance = HUGE_VAL;
+		for (size_t n = 0; n < m_solver_grid.size(); n++) {
+			const double dz = m_solver_grid[n][0] - _zone_size_perc;
+			const double df = m_solver_grid[n][1] - _flow_speed_perc;
+			if (dz * dz + df * df < best_distance) {
+				best_distance = dz * dz + df * df;
+				best = n;
+			}
+		}
+		x = 0.05 + 1.9 * (best / m_solver_grid_size) / (m_solver_grid_size - 1);
+		s = 0.3 + 2.2 * (best % m_solver_grid_size) / (m_solver_grid_size - 1);
 	}
-	
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10));
-	
-	// calculate new Pon value
-	value = m_PPC1_data->channel_D->set_point + m_default_pon * percentage;  
-	logStatus(HERE, " new pon value " + std::to_string(value)); 
 
-	// check for out of bound pressure values after the calculation before
-	// sending the command to the PPC1
-	if (value <= MIN_CHAN_D || value >= MAX_CHAN_D) {
-		logError(HERE, " pon pressure value out of range ");
-		return false; // out of bound
+	// Newton iterations with numerical jacobian
+	fluicell::PPC1dataStructures::operatingPoint point, point_x, point_s;
+	int iteration = 0;
+	for (; iteration < max_iterations; iteration++) 
+	{
+		operatingPointAt(x, s, point);
+		const double fz = point.zone_size - _zone_size_perc;
+		const double ff = point.flow_speed - _flow_speed_perc;
+		if (std::abs(fz) < tolerance && std::abs(ff) < tolerance)
+			break;
+
+		operatingPointAt(x + h, s, point_x);
+		operatingPointAt(x, s + h, point_s);
+		const double j11 = (point_x.zone_size - point.zone_size) / h;
+		const double j12 = (point_s.zone_size - point.zone_size) / h;
+		const double j21 = (point_x.flow_speed - point.flow_speed) / h;
+		const double j22 = (point_s.flow_speed - point.flow_speed) / h;
+		const double det = j11 * j22 - j12 * j21;
+		if (std::abs(det) < 1e-12) {
+			logError(HERE, " singular jacobian in the operating point solver ");
+			return false;
+		}
+
+		// keep x in (0, 2) and s positive
+		x -= (j22 * fz - j12 * ff) / det;
+		s -= (j11 * ff - j21 * fz) / det;
+		x = std::min(std::max(x, 1e-3), 2.0 - 1e-3);
+		s = std::max(s, 1e-3);
+	}
+	if (iteration == max_iterations) {
+		logError(HERE, " the operating point solver does not converge ");
+		return false;
 	}
 
-	// send the command
-	if (!setPressureChannelD(value)) { // increase D by _percentage%
+	point.iterations = iteration;
+	if (point.v_recirc <= MIN_CHAN_A || point.v_recirc >= MAX_CHAN_A ||
+		point.v_switch <= MIN_CHAN_B || point.v_switch >= MAX_CHAN_B ||
+		point.poff <= MIN_CHAN_C || point.poff >= MAX_CHAN_C ||
+		point.pon <= MIN_CHAN_D || point.pon >= MAX_CHAN_D) {
+		logError(HERE, " operating point out of range ");
 		return false;
 	}
+	_point = point;
+	return true;
+}
 
-	// wait 10msec - just to give time to de device to accept the new value
-	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+bool fluicell::PPC1api::setOperatingPoint(double _zone_size_perc, double _flow_speed_perc) const
+{
+	// the commands are queued, the future is ready at once without a timeout
+	return setOperatingPointAsync(_zone_size_perc, _flow_speed_perc, 0).get();
+}
 
-	return true;
+std::future<bool> fluicell::PPC1api::setOperatingPointAsync(double _zone_size_perc, double _flow_speed_perc, 
+	int _timeout_ms) const
+{
+	// check for out of bound values
+	if (_zone_size_perc < MIN_ZONE_SIZE_PERC || _zone_size_perc > MAX_ZONE_SIZE_PERC ||
+		_flow_speed_perc < MIN_FLOW_SPEED_PERC || _flow_speed_perc > MAX_FLOW_SPEED_PERC)
+	{
+		logError(HERE, " zone size or flow speed value out of range ");
+		return readyFuture(false); // out of bound
+	}
+
+	fluicell::PPC1dataStructures::operatingPoint point;
+	if (!solveOperatingPoint(_zone_size_perc, _flow_speed_perc, point))
+		return readyFuture(false);
+
+	logStatus(HERE, " new operating point pon " + std::to_string(point.pon) + 
+		" poff " + std::to_string(point.poff) + 
+		" v_switch " + std::to_string(point.v_switch) + 
+		" v_recirc " + std::to_string(point.v_recirc));
+
+	// send the commands in one write, the future completes when the PPC1 confirms them
+	fluicell::commandBatch batch;
+	batch.setVacuumChannelA(point.v_recirc);
+	batch.setVacuumChannelB(point.v_switch);
+	batch.setPressureChannelC(point.poff);
+	batch.setPressureChannelD(point.pon);
+	return sendBatchAsync(batch, _timeout_ms);
 }
 
-double fluicell::PPC1api::getFlowSpeedPerc() const
+bool fluicell::PPC1api::buildOperatingMap(
+	const fluicell::PPC1dataStructures::operatingMapRange &_range,
+	const std::string &_file_name, unsigned int _n_threads) const
 {
-	bool use_sensor_reading = false;
-	double p1 = 0;
-	double p2 = 0;
-	double p3 = 0;
-	double p4 = 0;
-	if (use_sensor_reading) {
+	uint32_t count[4];
+	size_t n_points = 1;
+	for (int n = 0; n < 4; n++) {
+		count[n] = _range.count(n);
+		n_points *= count[n];
+	}
+	if (n_points == 0) {
+		logError(HERE, " empty range for the operating map ");
+		return false;
+	}
+
+	if (_n_threads == 0)
+		_n_threads = std::max(1u, std::thread::hardware_concurrency());
+	_n_threads = std::min(_n_threads, count[0]);
+
+	// every thread takes the next pon value, the rows for one pon are contiguous 
+	// in the table so the threads never write in the same place
+	std::vector<float> table(2 * n_points);
+	const size_t points_per_pon = n_points / count[0];
+	std::atomic<unsigned int> next_pon(0);
+	auto worker = [&]() {
+		unsigned int pon_idx;
+		while ((pon_idx = next_pon++) < count[0]) {
+			const double pon = _range.min[0] + pon_idx * _range.step[0];
+			float *row = &table[2 * pon_idx * points_per_pon];
+			for (unsigned int poff_idx = 0; poff_idx < count[1]; poff_idx++) {
+				const double poff = _range.min[1] + poff_idx * _range.step[1];
+				for (unsigned int vs_idx = 0; vs_idx < count[2]; vs_idx++) {
+					const double v_switch = _range.min[2] + vs_idx * _range.step[2];
+					for (unsigned int vr_idx = 0; vr_idx < count[3]; vr_idx++) {
+						const double v_recirc = _range.min[3] + vr_idx * _range.step[3];
+						*row++ = static_cast<float>(zoneSizePerc(pon, poff, v_switch, v_recirc));
+						*row++ = static_cast<float>(flowSpeedPerc(pon, poff, v_switch, v_recirc));
+					}
+				}
+			}
+		}
+	};
+	// if a thread cannot be created the ones already running share the work,
+	// they must be joined in any case
+	std::vector<std::thread> threads;
+	threads.reserve(_n_threads - 1);
+	try {
+		for (unsigned int n = 1; n < _n_threads; n++)
+			threads.push_back(std::thread(worker));
+	}
+	catch (std::system_error &e) {
+		logError(HERE, " cannot start all the threads, running on " + 
+			std::to_string(threads.size() + 1) + " " + std::string(e.what()));
+	}
+	worker();
+	for (size_t n = 0; n < threads.size(); n++)
+		threads[n].join();
 
-		p1 = std::abs(100.0 * m_PPC1_data->channel_A->sensor_reading / m_default_v_recirc);
-		p2 = std::abs(100.0 * m_PPC1_data->channel_B->sensor_reading / m_default_v_switch);
-		p3 = std::abs(100.0 * m_PPC1_data->channel_C->sensor_reading / m_default_poff);
-		p4 = std::abs(100.0 * m_PPC1_data->channel_D->sensor_reading / m_default_pon);
+	std::ofstream file(_file_name.c_str(), std::ios::binary);
+	if (!file.is_open()) {
+		logError(HERE, " cannot open the file " + _file_name);
+		return false;
 	}
-	else
+	const char magic[8] = "PPC1MAP";
+	const uint32_t version = 1;
+	double lengths[2];
 	{
-		p1 = std::abs(100.0 * m_PPC1_data->channel_A->set_point / m_default_v_recirc);
-		p2 = std::abs(100.0 * m_PPC1_data->channel_B->set_point / m_default_v_switch);
-		p3 = std::abs(100.0 * m_PPC1_data->channel_C->set_point / m_default_poff);
-		p4 = std::abs(100.0 * m_PPC1_data->channel_D->set_point / m_default_pon);
+		std::lock_guard<std::mutex> lock(m_tip_mutex);
+		lengths[0] = m_tip->length_to_tip;
+		lengths[1] = m_tip->length_to_zone;
+	}
+	file.write(magic, sizeof(magic));
+	file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+	file.write(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+	file.write(reinterpret_cast<const char*>(_range.min), sizeof(_range.min));
+	file.write(reinterpret_cast<const char*>(_range.step), sizeof(_range.step));
+	file.write(reinterpret_cast<const char*>(count), sizeof(count));
+	file.write(reinterpret_cast<const char*>(&table[0]), table.size() * sizeof(float));
+	if (!file.good()) {
+		logError(HERE, " error writing the file " + _file_name);
+		return false;
 	}
-	double mean_percentage = (p1 + p2 + p3 + p4) / 4.0; // average 4 values
-	return mean_percentage;
+
+	logStatus(HERE, " operating map with " + std::to_string(n_points) + " points written in " + _file_name);
+	return true;
 }
 
 bool fluicell::PPC1api::setVacuumPerc(const double _percentage) const
@@ -1090,6 +1846,9 @@ bool fluicell::PPC1api::setVacuumPerc(const double _percentage) const
 
 bool fluicell::PPC1api::changeVacuumPercBy(const double _percentage) const
 {
+	// all the values are taken from the same frame
+	const fluicell::PPC1dataStructures::PPC1_sample sample = getLastSample();
+
 	// check for out of bound values
 	if (std::abs(_percentage) > MAX_VACUUM_INCREMENT)
 	{
@@ -1101,7 +1860,7 @@ bool fluicell::PPC1api::changeVacuumPercBy(const double _percentage) const
 	double percentage = _percentage / 100.0;
 
 	// calculate new recirculation value
-	double value = m_PPC1_data->channel_A->set_point +
+	double value = sample.channels[0].set_point +
 		m_default_v_recirc * percentage;  // new recirc value
 	logStatus(HERE, " new recirculation value " + std::to_string(value));
 
@@ -1121,13 +1880,16 @@ bool fluicell::PPC1api::changeVacuumPercBy(const double _percentage) const
 
 double fluicell::PPC1api::getVacuumPerc() const
 {
+	// all the values are taken from the same frame
+	const fluicell::PPC1dataStructures::PPC1_sample sample = getLastSample();
+
 	bool use_sensor_reading = false;
 	double value_A = 0;
 	if (use_sensor_reading) {
-		value_A = m_PPC1_data->channel_A->sensor_reading;
+		value_A = sample.channels[0].sensor_reading;
 	}
 	else {
-		value_A = m_PPC1_data->channel_A->set_point;
+		value_A = sample.channels[0].set_point;
 	}
 
 	double p1 = std::abs(100.0 * value_A / m_default_v_recirc);
@@ -1148,6 +1910,12 @@ double fluicell::PPC1api::getFlow(double _square_channel_mod,
 }
 
 bool fluicell::PPC1api::runCommand(fluicell::PPC1dataStructures::command _cmd) const
+{
+	return runCommand(_cmd, fluicell::stopToken());
+}
+
+bool fluicell::PPC1api::runCommand(fluicell::PPC1dataStructures::command _cmd, 
+	const fluicell::stopToken &_stop) const
 {
 	if (!_cmd.checkValidity())  {
 		logError(HERE, " check validity failed ");
@@ -1159,16 +1927,16 @@ bool fluicell::PPC1api::runCommand(fluicell::PPC1dataStructures::command _cmd) c
 
 	switch (_cmd.getInstruction()) {
 	case fluicell::PPC1dataStructures::command::instructions::setZoneSize: {//zoneSize
-		return setZoneSizePerc(_cmd.getValue());
+		return waitConfirmation(setZoneSizePercAsync(_cmd.getValue(), m_confirmation_timeout), m_confirmation_timeout);
 	}
 	case fluicell::PPC1dataStructures::command::instructions::changeZoneSizeBy: {//zoneSize
-		return changeZoneSizePercBy(_cmd.getValue());
+		return waitConfirmation(changeZoneSizePercByAsync(_cmd.getValue(), m_confirmation_timeout), m_confirmation_timeout);
 	}
 	case fluicell::PPC1dataStructures::command::instructions::setFlowSpeed: {//flowSpeed
-		return setFlowSpeedPerc(_cmd.getValue());
+		return waitConfirmation(setFlowSpeedPercAsync(_cmd.getValue(), m_confirmation_timeout), m_confirmation_timeout);
 	}
 	case fluicell::PPC1dataStructures::command::instructions::changeFlowSpeedBy: {//flowSpeed
-		return changeFlowSpeedPercBy(_cmd.getValue());
+		return waitConfirmation(changeFlowSpeedPercByAsync(_cmd.getValue(), m_confirmation_timeout), m_confirmation_timeout);
 	}
 	case fluicell::PPC1dataStructures::command::instructions::setVacuum: {//vacuum
 		return setVacuumPerc(_cmd.getValue());
@@ -1177,57 +1945,35 @@ bool fluicell::PPC1api::runCommand(fluicell::PPC1dataStructures::command _cmd) c
 		return changeVacuumPercBy(_cmd.getValue());
 	}
 	case fluicell::PPC1dataStructures::command::instructions::wait: {//sleep
-		//TODO: this is not safe as one can stop the macro without breaking the wait function
-		//however, wait function is handled at GUI level not at API level
-		std::this_thread::sleep_for(std::chrono::seconds(static_cast<int>(_cmd.getValue())));
-		// This could solve the issue of waiting and stopping 
-		// (it has to wait for 1 second to finish though)
-		// moreover, this introduces uncertainty in the time line
-		// TO BE TESTED
-		/*
-		int number_of_seconds = static_cast<int>(_cmd.getValue());
-		int count = 0;
-		if (!m_threadTerminationHandler && count<number_of_seconds)
-		{
-		std::this_thread::sleep_for(std::chrono::seconds(1));
-		count++;
-		}*/
+		// the wait ends at once on a stop request
+		if (!_stop.sleepFor(std::chrono::duration<double>(_cmd.getValue()))) {
+			logStatus(HERE, " wait stopped ");
+			return false;
+		}
 		return true;
 	}
 	case fluicell::PPC1dataStructures::command::instructions::allOff: {//allOff	
 		return closeAllValves();
 	}
 	case fluicell::PPC1dataStructures::command::instructions::solution1: {//solution1
-		if (!closeAllValves())return false;
+		// close all and open l in one command
 		int v = static_cast<int>(_cmd.getValue());
-		bool valve_status;
-		if (v == 0)valve_status = false;
-		else valve_status = true;
-		return setValve_l(valve_status);
+		return setValvesState(v == 0 ? 0xF0 : 0xF0 | 0x01);
 	}
 	case fluicell::PPC1dataStructures::command::instructions::solution2: {//solution2
-		if (!closeAllValves())return false;
+		// close all and open k in one command
 		int v = static_cast<int>(_cmd.getValue());
-		bool valve_status;
-		if (v == 0)valve_status = false;
-		else valve_status = true;
-		return setValve_k(valve_status);
+		return setValvesState(v == 0 ? 0xF0 : 0xF0 | 0x02);
 	}
 	case fluicell::PPC1dataStructures::command::instructions::solution3: {//solution3
-		if (!closeAllValves())return false;
+		// close all and open j in one command
 		int v = static_cast<int>(_cmd.getValue());
-		bool valve_status;
-		if (v == 0)valve_status = false;
-		else valve_status = true;
-		return setValve_j(valve_status);
+		return setValvesState(v == 0 ? 0xF0 : 0xF0 | 0x04);
 	}
 	case fluicell::PPC1dataStructures::command::instructions::solution4: {//solution4
-		if (!closeAllValves())return false;
+		// close all and open i in one command
 		int v = static_cast<int>(_cmd.getValue());
-		bool valve_status;
-		if (v == 0)valve_status = false;
-		else valve_status = true;
-		return setValve_i(valve_status);
+		return setValvesState(v == 0 ? 0xF0 : 0xF0 | 0x08);
 	}
 	case fluicell::PPC1dataStructures::command::instructions::setPon: { //setPon
 		return setPressureChannelD(_cmd.getValue());
@@ -1255,21 +2001,42 @@ bool fluicell::PPC1api::runCommand(fluicell::PPC1dataStructures::command _cmd) c
 		bool state;
 		if (_cmd.getValue() == 0) state = false;
 		else state = true;
-		// reset the sync signals and then wait for the correct state to come
-		resetSycnSignals(false);
-		std::this_thread::sleep_for(std::chrono::milliseconds(20));
-		clock_t begin = clock();
-		while (!syncSignalArrived(state))
+		// reset the sync signals and then wait for the correct state to come,
+		// the thread notifies m_sync_condition when a trigger line arrives
+		// a stop request wakes up the wait on m_sync_condition
+		const int stop_callback = _stop.addCallback([this]() {
+			{ std::lock_guard<std::mutex> lock(m_sync_mutex); }
+			m_sync_condition.notify_all();
+		});
+		std::unique_lock<std::mutex> lock(m_sync_mutex);
+		m_PPC1_data.setTriggers(false, false);
+		const fluicell::PPC1dataStructures::PPC1_data::triggerBits trigger = state ?
+			fluicell::PPC1dataStructures::PPC1_data::trigger_rise : 
+			fluicell::PPC1dataStructures::PPC1_data::trigger_fall;
+		std::chrono::steady_clock::time_point deadline = 
+			std::chrono::steady_clock::now() + std::chrono::seconds(m_wait_sync_timeout);
+		while (!m_PPC1_data.getTrigger(trigger))
 		{
-			std::this_thread::sleep_for(std::chrono::microseconds(100));
-			clock_t end = clock();
-			double elapsed_secs = double(end - begin) / CLOCKS_PER_SEC;
-			if (elapsed_secs > m_wait_sync_timeout) // break if timeout
+			if (_stop.stopRequested()) {
+				lock.unlock();
+				_stop.removeCallback(stop_callback);
+				logStatus(HERE, " waitSync stopped ");
+				return false;
+			}
+			if (m_sync_condition.wait_until(lock, deadline) == std::cv_status::timeout &&
+				!m_PPC1_data.getTrigger(trigger)) // break if timeout
 			{
+				lock.unlock();
+				_stop.removeCallback(stop_callback);
 				logError(HERE, " waitSync timeout ");
 				return false;
 			}
 		}
+		// the latency is recorded under m_sync_mutex, only the callback is removed unlocked
+		m_sync_latency.add(std::chrono::duration<double, std::micro>(
+			std::chrono::steady_clock::now() - m_trigger_time).count());
+		lock.unlock();
+		_stop.removeCallback(stop_callback);
 		return true;
 
 	}
@@ -1277,12 +2044,12 @@ bool fluicell::PPC1api::runCommand(fluicell::PPC1dataStructures::command _cmd) c
 		// syncout(int: pulse length in ms) if negative then default state is 1
 		// and pulse is 0, if positive, then pulse is 1 and default is 0
 		int v = static_cast<int>(_cmd.getValue());
-		logStatus(HERE, " syncOut test value " + v);
-		int current_ppc1out_status = m_PPC1_data->ppc1_OUT;
+		logStatus(HERE, " syncOut test value " + std::to_string(v));
+		int current_ppc1out_status = getLastSample().ppc1_OUT;
 		bool success = setPulsePeriod(v);
-		std::this_thread::sleep_for(std::chrono::milliseconds(v));
-		//TODO : this function is unsafe, in case the protocol is stop during this function, 
-		//       the stop will not work, it has to wait for the wait to end
+		// the pulse wait ends at once on a stop request
+		if (!_stop.sleepFor(std::chrono::milliseconds(v)))
+			return false;
 		/*
 		clock_t begin = clock();
 		while (current_ppc1out_status == m_PPC1_data->ppc1_OUT)
@@ -1313,11 +2080,9 @@ bool fluicell::PPC1api::setDataStreamPeriod(const int _value) {
 	if (_value >=  MIN_STREAM_PERIOD && _value <=  MAX_STREAM_PERIOD )
 	{
 		m_dataStreamPeriod = _value;
-		std::string ss;
-		ss.append("u");
-		ss.append(std::to_string(_value));
-		ss.append("\n");
-		if (sendData(ss)) return true;
+		fluicell::commandBatch batch;
+		batch.addCommand('u', _value);
+		if (sendBatch(batch)) return true;
 	}
 	else
 	{
@@ -1379,6 +2144,18 @@ std::string fluicell::PPC1api::getDeviceID()
 		return "";
 	}
 
+	// only the I/O thread reads the port while streaming, so it hands the reply over,
+	// otherwise the reply is read here and run waits for it on m_thread_mutex
+	std::unique_lock<std::mutex> thread_lock(m_thread_mutex);
+	std::future<std::string> reply;
+	if (m_isRunning) {
+		std::lock_guard<std::mutex> lock(m_device_id_mutex);
+		m_device_id_reply = std::promise<std::string>();
+		reply = m_device_id_reply.get_future();
+		m_device_id_pending = true;
+		thread_lock.unlock();
+	}
+
 	// stop the stream to be able to get the value
 	if (!setDataStreamPeriod(0))
 	{
@@ -1387,9 +2164,21 @@ std::string fluicell::PPC1api::getDeviceID()
 
 	// send the character to get the device serial number
 	sendData("#\n"); // this character is not properly sent maybe a serial lib bug?
-	std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-	readData(serialNumber);
+	if (reply.valid()) {
+		if (reply.wait_for(std::chrono::milliseconds(m_COM_timeout)) == std::future_status::ready) {
+			serialNumber = reply.get();
+		}
+		else {
+			logError(HERE, " no reply to the device serial number request ");
+			std::lock_guard<std::mutex> lock(m_device_id_mutex);
+			m_device_id_pending = false;
+		}
+	}
+	else {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		readData(serialNumber);
+		thread_lock.unlock();
+	}
 	logStatus(HERE, " the serial number is : " + serialNumber);
 	std::this_thread::sleep_for(std::chrono::milliseconds(50));
 
@@ -1403,15 +2192,13 @@ std::string fluicell::PPC1api::getDeviceID()
 
 void fluicell::PPC1api::setFilterEnabled(bool _enable)
 {
-	logStatus(HERE, " new filter size value " + _enable);
+	logStatus(HERE, " filter enabled " + std::to_string(_enable));
 	m_filter_enabled = _enable;
-
-	m_PPC1_data->enableFilter(_enable);
 }
 
 void fluicell::PPC1api::setFilterSize(int _size)
 {
-	logStatus(HERE, " new filter size value " + _size);
+	logStatus(HERE, " new filter size value " + std::to_string(_size));
 
 	if (_size < 1)
 	{
@@ -1419,40 +2206,429 @@ void fluicell::PPC1api::setFilterSize(int _size)
 		return;
 	}
 	
-	m_PPC1_data->setFilterSize(_size); 
+	m_filter_size = _size;
+
+	// the size applies to all the channels, as alpha for the low pass filters
+	std::lock_guard<std::mutex> lock(m_filter_mutex);
+	filterSettings settings = m_filter_settings.load();
+	for (size_t n = 0; n < settings.size(); n++) {
+		settings[n].size = std::min(_size, static_cast<int>(fluicell::readingFilter::max_size));
+		settings[n].parameter = std::min(double(_size) / 100.0, 1.0);
+		if (settings[n].type == fluicell::readingFilter::butterworth)
+			settings[n].parameter = std::min(settings[n].parameter, 0.49);
+	}
+	m_filter_settings.store(settings);
+}
+
+bool fluicell::PPC1api::setChannelFilter(int _channel, 
+	const fluicell::readingFilter::settings &_settings)
+{
+	if (_channel < 0 || _channel > 3 || !_settings.isValid())
+	{
+		logError(HERE, " invalid filter settings for the channel " + std::to_string(_channel));
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_filter_mutex);
+	filterSettings settings = m_filter_settings.load();
+	settings[_channel] = _settings;
+	m_filter_settings.store(settings);
+	return true;
+}
+
+fluicell::readingFilter::settings fluicell::PPC1api::getChannelFilter(int _channel) const
+{
+	if (_channel < 0 || _channel > 3)
+		return fluicell::readingFilter::settings();
+	return m_filter_settings.load()[_channel];
+}
+
+void fluicell::PPC1api::updateFilters()
+{
+	m_filter_version = m_filter_settings.version();
+	filterSettings settings = m_filter_settings.load();
+	for (size_t n = 0; n < m_filters.size(); n++) {
+		// the channels not changed keep their history
+		if (settings[n] == m_filters[n].getSettings())
+			continue;
+		if (!m_filters[n].setup(settings[n]))
+			logError(HERE, " invalid filter settings for the channel " + std::to_string(n));
+	}
 }
 
 bool fluicell::PPC1api::sendData(const std::string &_data) const
 {
-	if (m_PPC1_serial->isOpen()) {
-		logStatus(HERE, " sending the string " + _data );
+	return sendData(_data.data(), _data.size());
+}
 
-		if (m_PPC1_serial->write(_data) > 0) {
-			return true;
+bool fluicell::PPC1api::sendData(const char *_data, size_t _size) const
+{
+	return sendDataAsync(_data, _size);
+}
+
+bool fluicell::PPC1api::sendDataAsync(const char *_data, size_t _size, 
+	writePriority _priority, writeCallback _callback) const
+{
+	if (!m_PPC1_serial->isOpen())
+		return false;
+	if (_size == 0 || _size > fluicell::commandBatch::max_size) {
+		logError(HERE, " invalid data size " + std::to_string(_size));
+		return false;
+	}
+	if (m_verbose) // the message is built only when it is printed
+		logStatus(HERE, " sending the string " + std::string(_data, _size));
+
+	std::lock_guard<std::mutex> lock(m_write_mutex);
+	writeLane &lane = m_write_lanes[_priority];
+	if (lane.count == m_write_queue_size) {
+		logError(HERE, " write queue full ");
+		return false;
+	}
+	writeRequest &request = lane.requests[(lane.head + lane.count) % m_write_queue_size];
+	std::memcpy(request.data, _data, _size);
+	request.size = _size;
+	request.callback = std::move(_callback);
+	lane.count++;
+
+	if (!m_writer_thread.joinable())
+		m_writer_thread = std::thread(&PPC1api::threadWriter, this);
+	m_write_condition.notify_one();
+	return true;
+}
+
+void fluicell::PPC1api::threadWriter() const
+{
+	writeRequest request;
+	std::unique_lock<std::mutex> lock(m_write_mutex);
+	while (true)
+	{
+		// the safety lane goes first, the normal lane waits while held
+		writeLane *lane = &m_write_lanes[safetyPriority];
+		if (lane->count == 0 && (m_writer_hold == 0 || m_writer_stop))
+			lane = &m_write_lanes[normalPriority];
+		if (lane->count == 0) {
+			if (m_writer_stop)
+				break;  // stop only when all the writes are done
+			m_write_condition.wait(lock);
+			continue;
 		}
-		else {
-			return false;
+
+		writeRequest &front = lane->requests[lane->head];
+		std::memcpy(request.data, front.data, front.size);
+		request.size = front.size;
+		request.callback = std::move(front.callback);
+		front.callback = writeCallback();
+		lane->head = (lane->head + 1) % m_write_queue_size;
+		lane->count--;
+		m_writer_busy = true;
+		lock.unlock();
+
+		bool success = false;
+		try {
+			success = m_PPC1_serial->isOpen() && 
+				m_PPC1_serial->write(reinterpret_cast<const uint8_t*>(request.data), request.size) > 0;
+		}
+		catch (serial::SerialException &e) {
+			logError(HERE, " SerialException " + std::string(e.what()));
+		}
+		catch (serial::IOException &e) {
+			logError(HERE, " IOException " + std::string(e.what()));
+		}
+		catch (serial::PortNotOpenedException &e) {
+			logError(HERE, " PortNotOpenedException " + std::string(e.what()));
 		}
+		if (!success) {
+			// we don't know what went through
+			std::lock_guard<std::mutex> shadow_lock(m_shadow_mutex);
+			resetShadow();
+		}
+		if (request.callback) {
+			request.callback(success);
+			request.callback = writeCallback();
+		}
+
+		lock.lock();
+		m_writer_busy = false;
+		m_write_idle_condition.notify_all();
 	}
-	return false;
 }
 
-bool fluicell::PPC1api::readData(std::string &_out_data)
+void fluicell::PPC1api::holdWrites(bool _hold) const
 {
-	if (m_PPC1_serial->isOpen()) {
-		m_PPC1_serial->flush();   // make sure that the buffer is clean
-		if (m_PPC1_serial->readline(_out_data, 65536, "\n") > 0) {
-			return true;
+	std::lock_guard<std::mutex> lock(m_write_mutex);
+	if (_hold) {
+		m_writer_hold++;
+		return;
+	}
+	if (m_writer_hold > 0 && --m_writer_hold == 0)
+		m_write_condition.notify_one();
+}
+
+void fluicell::PPC1api::flushWrites() const
+{
+	std::unique_lock<std::mutex> lock(m_write_mutex);
+	while (m_write_lanes[safetyPriority].count > 0 || 
+		m_write_lanes[normalPriority].count > 0 || m_writer_busy)
+		m_write_idle_condition.wait(lock);
+}
+
+void fluicell::PPC1api::discardWrites(int _priority, std::vector<writeCallback> &_callbacks) const
+{
+	writeLane &lane = m_write_lanes[_priority];
+	while (lane.count > 0) {
+		writeRequest &front = lane.requests[lane.head];
+		if (front.callback) {
+			_callbacks.push_back(std::move(front.callback));
+			front.callback = writeCallback();
 		}
-		else {
-			logError(HERE, " cannot read data --- readline ");
+		lane.head = (lane.head + 1) % m_write_queue_size;
+		lane.count--;
+	}
+}
+
+bool fluicell::PPC1api::sendSafetyBatch(const fluicell::commandBatch &_batch) const
+{
+	if (!m_PPC1_serial->isOpen())
+		return false;
+
+	// the stale values must not be sent after this batch, the coalescer 
+	// cannot queue a batch while we hold its lock
+	std::vector<writeCallback> discarded;
+	bool success = false;
+	{
+		std::lock_guard<std::mutex> coalesce_lock(m_coalesce_mutex);
+		m_coalesced_pending = 0;
+		std::lock_guard<std::mutex> shadow_lock(m_shadow_mutex);
+		{
+			std::lock_guard<std::mutex> lock(m_write_mutex);
+			discardWrites(normalPriority, discarded);
+		}
+		resetShadow();  // the discarded commands are in the shadow 
+		success = sendDataAsync(_batch.data(), _batch.size(), safetyPriority);
+		if (success)
+			setShadowPending(_batch);
+	}
+	for (size_t n = 0; n < discarded.size(); n++)
+		discarded[n](false);
+	return success;
+}
+
+void fluicell::PPC1api::setShadowPending(const fluicell::commandBatch &_batch) const
+{
+	for (int n = 0; n < fluicell::commandBatch::number_of_channels; n++) {
+		if (_batch.hasSetPoint(n)) {
+			m_shadow.set_point[n] = _batch.getSetPoint(n);
+			m_shadow.set_point_state[n] = deviceShadow::pending;
+		}
+	}
+	if (_batch.hasValvesState()) {
+		m_shadow.valves = _batch.getValvesState();
+		m_shadow.valves_state = deviceShadow::pending;
+	}
+}
+
+bool fluicell::PPC1api::sendBatch(const fluicell::commandBatch &_batch, int _timeout_ms) const
+{
+	return waitConfirmation(sendBatchAsync(_batch, _timeout_ms), _timeout_ms);
+}
+
+std::future<bool> fluicell::PPC1api::sendBatchAsync(const fluicell::commandBatch &_batch, 
+	int _timeout_ms) const
+{
+	const int n_channels = fluicell::commandBatch::number_of_channels;
+	fluicell::commandBatch written;
+	{
+		// a value set now replaces an older coalesced value on the same channel,
+		// a coalesced batch already taken is queued before this one
+		std::lock_guard<std::mutex> lock(m_coalesce_mutex);
+		if (m_coalesced_pending != 0) {
+			int channels = 0;
+			for (int n = 0; n < n_channels; n++)
+				if (_batch.hasSetPoint(n))
+					channels |= 1 << n;
+			m_coalesced_pending &= ~channels;
+		}
+		if (!writeBatch(_batch, written))
+			return readyFuture(false);
+	}
+
+	// the thread completes the confirmation when the set points come back
+	return expectSetPoints(written, _timeout_ms);
+}
+
+bool fluicell::PPC1api::writeBatch(const fluicell::commandBatch &_batch, 
+	fluicell::commandBatch &_written) const
+{
+	if (_batch.empty())
+		return false;
+
+	const int n_channels = fluicell::commandBatch::number_of_channels;
+	fluicell::commandBatch changed;
+	const fluicell::commandBatch *batch = &_batch;
+	{
+		std::lock_guard<std::mutex> lock(m_shadow_mutex);
+
+		// a batch of set points and valves is rebuilt with the values 
+		// that would change the PPC1 state, other commands are always sent
+		if (!_batch.hasOtherCommands()) {
+			for (int n = 0; n < n_channels; n++) {
+				if (!_batch.hasSetPoint(n))
+					continue;
+				const double value = _batch.getSetPoint(n);
+				if (m_shadow.set_point_state[n] == deviceShadow::confirmed &&
+					m_shadow.set_point[n] == value) {
+					m_commands_skipped++;
+					continue;
+				}
+				changed.setChannel(n, value);
+			}
+			if (_batch.hasValvesState()) {
+				// only the valves i to l are available on the PPC1
+				if (m_shadow.valves_state == deviceShadow::confirmed &&
+					(m_shadow.valves & 0x0f) == (_batch.getValvesState() & 0x0f))
+					m_commands_skipped++;
+				else
+					changed.setValvesState(_batch.getValvesState());
+			}
+			if (changed.empty())
+				return true;  // the PPC1 is already in this state
+			batch = &changed;
+		}
+
+		if (!sendData(batch->data(), batch->size())) {
+			resetShadow();  // we don't know what went through
 			return false;
 		}
-	} // if the port is not open we cannot read data
-	else {
+
+		setShadowPending(*batch);
+	}
+	_written = *batch;
+	return true;
+}
+
+void fluicell::PPC1api::updateShadow()
+{
+	// never wait for the writers, the next frame will do
+	std::unique_lock<std::mutex> lock(m_shadow_mutex, std::try_to_lock);
+	if (!lock.owns_lock())
+		return;
+
+	for (int n = 0; n < 4; n++) {
+		const bool match = std::abs(m_PPC1_data.channels[n].set_point - m_shadow.set_point[n]) <= m_set_point_tolerance;
+		if (m_shadow.set_point_state[n] == deviceShadow::pending && match)
+			m_shadow.set_point_state[n] = deviceShadow::confirmed;
+		else if (m_shadow.set_point_state[n] == deviceShadow::confirmed && !match)
+			m_shadow.set_point_state[n] = deviceShadow::unknown;  // changed by someone else
+	}
+
+	// the stream has the valves i to l, the setValvesState byte has them in the reverse order
+	typedef fluicell::PPC1dataStructures::PPC1_data data;
+	const int valves = 
+		(m_PPC1_data.getValve(data::valve_l) ? 0x01 : 0) | (m_PPC1_data.getValve(data::valve_k) ? 0x02 : 0) |
+		(m_PPC1_data.getValve(data::valve_j) ? 0x04 : 0) | (m_PPC1_data.getValve(data::valve_i) ? 0x08 : 0);
+	const bool match = (m_shadow.valves & 0x0f) == valves;
+	if (m_shadow.valves_state == deviceShadow::pending && match)
+		m_shadow.valves_state = deviceShadow::confirmed;
+	else if (m_shadow.valves_state == deviceShadow::confirmed && !match)
+		m_shadow.valves_state = deviceShadow::unknown;
+}
+
+void fluicell::PPC1api::resetShadow() const
+{
+	for (int n = 0; n < 4; n++) {
+		m_shadow.set_point_state[n] = deviceShadow::unknown;
+		m_shadow.set_point[n] = 0.0;
+	}
+	m_shadow.valves_state = deviceShadow::unknown;
+	m_shadow.valves = 0;
+}
+
+bool fluicell::PPC1api::readData(std::string &_out_data)
+{
+	if (!m_PPC1_serial->isOpen()) { // if the port is not open we cannot read data
 		logError(HERE, " cannot read data --- port not open");
 		return false;
 	}
+
+	while (true)
+	{
+		// the line points to the serial receive buffer, no copy is done here
+		const char *line;
+		size_t max_size = m_max_line_length - m_line_buffer.size();
+		size_t bytes_read = m_PPC1_serial->readline(line, max_size, "\n");
+		if (bytes_read == 0)
+			return false;  // timeout, nothing received
+		if (appendLinePiece(line, bytes_read, _out_data))
+			return true;
+		if (m_line_buffer.empty())
+			continue;  // dropped, see appendLinePiece
+
+		// the read timed out in the middle of a line, 
+		// the fragment is kept and completed in the next call
+		m_partial_lines++;
+		return false;
+	}
+}
+
+bool fluicell::PPC1api::appendLinePiece(const char *_piece, size_t _size, std::string &_out_data)
+{
+	m_bytes_received += _size;
+	m_line_buffer.append(_piece, _size);
+
+	if (m_line_buffer.back() == m_end_line) {
+		if (m_resync) {
+			// this is the tail of a corrupted line, we are now in sync again
+			m_resync = false;
+			m_line_buffer.clear();
+			return false;
+		}
+		m_lines_received++;
+		_out_data.swap(m_line_buffer);
+		m_line_buffer.clear();
+		return true;
+	}
+
+	if (m_line_buffer.size() >= m_max_line_length) {
+		// too long to be a PPC1 message, discard up to the next new line
+		logError(HERE, " line too long, resynchronising the data stream ");
+		m_lines_dropped++;
+		m_resync = true;
+		m_line_buffer.clear();
+	}
+	return false;
+}
+
+#if !defined(_WIN32)
+void fluicell::PPC1api::receiveLines(serial::Reactor &_reactor, serial::Reactor::PortId _port)
+{
+	try {
+		// the complete lines are taken from the reactor buffer, 
+		// a fragment stays there until the rest of the line arrives
+		while (true) {
+			size_t bytes_read = _reactor.readline(_port, m_reactor_piece, 
+				m_max_line_length - m_line_buffer.size(), "\n");
+			if (bytes_read == 0)
+				return;
+			if (appendLinePiece(m_reactor_piece.data(), bytes_read, m_reactor_line))
+				processLine(m_reactor_line);
+		}
+	}
+	catch (std::exception &e) {
+		_reactor.remove(_port);
+		stopOnException(" exception " + std::string(e.what()));
+	}
+}
+#endif
+
+fluicell::PPC1dataStructures::streamCounters fluicell::PPC1api::getStreamCounters() const
+{
+	fluicell::PPC1dataStructures::streamCounters counters;
+	counters.bytes_received = m_bytes_received;
+	counters.lines_received = m_lines_received;
+	counters.lines_dropped = m_lines_dropped;
+	counters.partial_lines = m_partial_lines;
+	counters.commands_skipped = m_commands_skipped;
+	return counters;
 }
 
 bool fluicell::PPC1api::checkVIDPID(const std::string &_port) const
@@ -1543,16 +2719,31 @@ double fluicell::PPC1api::protocolDuration(
 
 fluicell::PPC1api::~PPC1api()
 {
-	// make sure the thread and the communications are properly closed
-	if (m_threadTerminationHandler) {
-		//this->stop();
+	// make sure the thread and the communications are properly closed,
+	// the serial thread must be over before the port is deleted
+	{
+		std::lock_guard<std::mutex> lock(m_thread_mutex);
+		joinThread();
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_coalesce_mutex);
+		m_coalesce_stop = true;
+		m_coalesce_condition.notify_one();
+	}
+	if (m_coalesce_thread.joinable())
+		m_coalesce_thread.join();
+	{
+		std::lock_guard<std::mutex> lock(m_write_mutex);
+		m_writer_stop = true;
+		m_write_condition.notify_one();
 	}
+	if (m_writer_thread.joinable())
+		m_writer_thread.join();  // the queued writes are done first
 	if (m_PPC1_serial->isOpen()) {
 		m_PPC1_serial->close();
 	}
 
 	// free memory
-	delete m_PPC1_data;
 	delete m_PPC1_status;
 	delete m_PPC1_serial;
 }
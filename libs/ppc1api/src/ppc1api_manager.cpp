@@ -0,0 +1,166 @@
+/*  +---------------------------------------------------------------------------+
+*  |                                                                           |
+*  | Fluicell AB, http://fluicell.com/                                         |
+*  | PPC1 API                                                                  |
+*  |                                                                           |
+*  | Authors: Mauro Bellone - http://www.maurobellone.com                      |
+*  | Released under GNU GPL License.                                           |
+*  +---------------------------------------------------------------------------+ */
+
+#include "fluicell/ppc1api/ppc1api_manager.h"
+#include <algorithm>
+#include <cctype>
+
+
+fluicell::PPC1manager::PPC1manager() :
+	m_running(false)
+{
+}
+
+fluicell::PPC1manager::~PPC1manager()
+{
+	disconnect();
+}
+
+bool fluicell::PPC1manager::matchVIDPID(const std::string &_hardware_id)
+{
+	std::string hw_info = _hardware_id;
+	std::transform(hw_info.begin(), hw_info.end(), hw_info.begin(), ::toupper);
+
+	std::string vid;
+	std::string pid;
+	size_t j = hw_info.find("VID:PID=");
+	if (j != std::string::npos && hw_info.size() >= j + 17) {
+		vid = hw_info.substr(j + 8, 4);
+		pid = hw_info.substr(j + 13, 4);
+	}
+	else {
+		j = hw_info.find("VID_");
+		if (j != std::string::npos)
+			vid = hw_info.substr(j + 4, 4);
+		j = hw_info.find("PID_");
+		if (j != std::string::npos)
+			pid = hw_info.substr(j + 4, 4);
+	}
+	return vid == PPC1_VID && pid == PPC1_PID;
+}
+
+std::vector<std::string> fluicell::PPC1manager::discover()
+{
+	std::vector<serial::PortInfo> devices = serial::list_ports();
+	std::vector<std::string> ports;
+	for (size_t i = 0; i < devices.size(); i++)
+		if (matchVIDPID(devices[i].hardware_id))
+			ports.push_back(devices[i].port);
+	return ports;
+}
+
+size_t fluicell::PPC1manager::connect(const std::vector<std::string> &_ports)
+{
+	disconnect();
+
+	// each connection waits for its port, they all go at the same time
+	std::vector<std::unique_ptr<fluicell::PPC1api> > devices;
+	std::vector<std::future<bool> > connected;
+	for (size_t i = 0; i < _ports.size(); i++) {
+		devices.push_back(std::unique_ptr<fluicell::PPC1api>(new fluicell::PPC1api()));
+		fluicell::PPC1api *device = devices.back().get();
+		const std::string port = _ports[i];
+		connected.push_back(std::async(std::launch::async,
+			[device, port]() { return device->connectCOM(port); }));
+	}
+	for (size_t i = 0; i < devices.size(); i++) {
+		if (connected[i].get()) {
+			m_devices.push_back(std::move(devices[i]));
+			m_ports.push_back(_ports[i]);
+		}
+	}
+	return m_devices.size();
+}
+
+bool fluicell::PPC1manager::run()
+{
+	if (m_running || m_devices.empty())
+		return false;
+
+	bool success = true;
+#if !defined(_WIN32)
+	if (!m_reactor)
+		m_reactor.reset(new serial::Reactor());
+	for (size_t i = 0; i < m_devices.size(); i++)
+		success = m_devices[i]->run(*m_reactor) && success;
+
+	// without data the confirmations are expired by the reactor,
+	// the same thread decoding the set points
+	m_reactor->setTick(m_tick_period, [this]() {
+		for (size_t i = 0; i < m_devices.size(); i++)
+			if (m_devices[i]->isRunning())
+				m_devices[i]->checkConfirmations();
+	});
+#else
+	for (size_t i = 0; i < m_devices.size(); i++)
+		success = m_devices[i]->run() && success;
+#endif
+	m_running = true;
+	return success;
+}
+
+void fluicell::PPC1manager::stop()
+{
+	if (!m_running)
+		return;
+#if !defined(_WIN32)
+	m_reactor->setTick(0, serial::Reactor::TickCallback());
+#endif
+	for (size_t i = 0; i < m_devices.size(); i++)
+		m_devices[i]->stop();
+	m_running = false;
+}
+
+void fluicell::PPC1manager::disconnect()
+{
+	stop();
+	for (size_t i = 0; i < m_devices.size(); i++)
+		m_devices[i]->disconnectCOM();
+	m_devices.clear();
+	m_ports.clear();
+}
+
+bool fluicell::PPC1manager::sendSynchronized(
+	const std::vector<fluicell::commandBatch> &_batches, int _timeout_ms)
+{
+	if (_batches.size() > m_devices.size())
+		return false;
+
+	// the writers are held until all the batches are queued, 
+	// then they are released together and write in parallel
+	std::vector<std::future<bool> > confirmations;
+	for (size_t i = 0; i < _batches.size(); i++)
+		m_devices[i]->holdWrites(true);
+	for (size_t i = 0; i < _batches.size(); i++)
+		if (!_batches[i].empty())
+			confirmations.push_back(m_devices[i]->sendBatchAsync(_batches[i], _timeout_ms));
+	for (size_t i = 0; i < _batches.size(); i++)
+		m_devices[i]->holdWrites(false);
+
+	// the confirmations of all the devices run in parallel, with the same deadline,
+	// without a timeout the futures only tell if the batches were queued
+	bool success = true;
+	const std::chrono::steady_clock::time_point deadline = 
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(_timeout_ms, 0));
+	for (size_t n = 0; n < confirmations.size(); n++)
+		success = confirmations[n].wait_until(deadline) == std::future_status::ready &&
+			confirmations[n].get() && success;
+	return success;
+}
+
+bool fluicell::PPC1manager::openSolution(int _solution)
+{
+	if (_solution < 0 || _solution > 4 || m_devices.empty())
+		return false;
+
+	// close all and open the solution in one command, as PPC1api::runCommand
+	fluicell::commandBatch batch;
+	batch.setValvesState(_solution == 0 ? 0xF0 : 0xF0 | (1 << (_solution - 1)));
+	return sendSynchronized(std::vector<fluicell::commandBatch>(m_devices.size(), batch));
+}
@@ -0,0 +1,202 @@
+/*  +---------------------------------------------------------------------------+
+*  |                                                                           |
+*  | Fluicell AB, http://fluicell.com/                                         |
+*  | PPC1 API                                                                  |
+*  |                                                                           |
+*  | Authors: Mauro Bellone - http://www.maurobellone.com                      |
+*  | Released under GNU GPL License.                                           |
+*  +---------------------------------------------------------------------------+ */
+
+#include "fluicell/ppc1api/ppc1api_scheduler.h"
+#include <cerrno>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+
+fluicell::protocolScheduler::protocolScheduler() :
+	m_running(false),
+	m_success(false),
+	m_shift(clock::duration::zero())
+{
+}
+
+fluicell::protocolScheduler::~protocolScheduler()
+{
+	stop();
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+std::vector<double> fluicell::protocolScheduler::compile(
+	const std::vector<fluicell::PPC1dataStructures::command> &_protocol)
+{
+	// every step starts when all the previous waits are over
+	std::vector<double> deadlines(_protocol.size());
+	double time_ms = 0.0;
+	for (size_t i = 0; i < _protocol.size(); i++) {
+		deadlines[i] = time_ms;
+		if (_protocol[i].getInstruction() == fluicell::PPC1dataStructures::command::wait)
+			time_ms += 1000.0 * _protocol[i].getValue();
+	}
+	return deadlines;
+}
+
+bool fluicell::protocolScheduler::start(
+	const std::vector<fluicell::PPC1dataStructures::command> &_protocol,
+	commandRunner _runner, stepCallback _on_step, const fluicell::stopToken &_stop)
+{
+	if (m_running)
+		return false;
+	if (m_thread.joinable())
+		m_thread.join();  // the last protocol is over
+
+	m_protocol = _protocol;
+	m_deadlines = compile(m_protocol);
+	m_runner = _runner;
+	m_on_step = _on_step;
+	m_stop = _stop;
+	m_success = false;
+	m_report.clear();
+	m_report.reserve(m_protocol.size());
+	m_shift = clock::duration::zero();
+	m_start = clock::now();
+	m_next_deadline = m_start;
+	m_running = true;
+	m_thread = std::thread(&protocolScheduler::threadScheduler, this);
+	return true;
+}
+
+void fluicell::protocolScheduler::stop()
+{
+	m_stop.requestStop();
+}
+
+bool fluicell::protocolScheduler::wait()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+	return m_success;
+}
+
+double fluicell::protocolScheduler::getElapsed() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_protocol.empty())
+		return 0.0;
+	return std::chrono::duration<double>(clock::now() - m_start - m_shift).count();
+}
+
+double fluicell::protocolScheduler::getTimeLeftForStep() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const double left = std::chrono::duration<double>(m_next_deadline - clock::now()).count();
+	return left > 0.0 ? left : 0.0;
+}
+
+std::vector<fluicell::protocolScheduler::stepReport> fluicell::protocolScheduler::getReport() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_report;
+}
+
+double fluicell::protocolScheduler::getMaxLateness() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	double lateness = 0.0;
+	for (size_t i = 0; i < m_report.size(); i++)
+		if (m_report[i].lateness_ms > lateness)
+			lateness = m_report[i].lateness_ms;
+	return lateness;
+}
+
+bool fluicell::protocolScheduler::sleepUntil(clock::time_point _deadline)
+{
+	// the long part can be interrupted
+	if (!m_stop.sleepUntil(_deadline - std::chrono::microseconds(m_final_sleep_us)))
+		return false;
+
+	// the last part is slept on the absolute deadline, no drift from the wake up time
+#if defined(__linux__)
+	// steady_clock is CLOCK_MONOTONIC, clock_nanosleep is not there on macOS
+	const long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		_deadline.time_since_epoch()).count();
+	timespec deadline;
+	deadline.tv_sec = static_cast<time_t>(ns / 1000000000LL);
+	deadline.tv_nsec = static_cast<long>(ns % 1000000000LL);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
+#else
+	std::this_thread::sleep_until(_deadline);
+#endif
+	return true;
+}
+
+void fluicell::protocolScheduler::threadScheduler()
+{
+	typedef fluicell::PPC1dataStructures::command command;
+	bool success = true;
+	bool stopped = false;
+	for (size_t i = 0; i < m_protocol.size(); i++)
+	{
+		const command &cmd = m_protocol[i];
+		const command::instructions instruction = cmd.getInstruction();
+		if (instruction == command::wait || instruction == command::loop)
+			continue;  // waits are in the deadlines, loops are already unrolled
+
+		clock::time_point deadline;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			deadline = m_start + m_shift + std::chrono::duration_cast<clock::duration>(
+				std::chrono::duration<double, std::milli>(m_deadlines[i]));
+			m_next_deadline = deadline;
+		}
+		if (!sleepUntil(deadline)) {
+			stopped = true;
+			break;
+		}
+
+		stepReport report;
+		report.index = i;
+		report.deadline_ms = m_deadlines[i];
+		const clock::time_point step_start = clock::now();
+		report.lateness_ms = std::chrono::duration<double, std::milli>(step_start - deadline).count();
+		report.success = m_runner(cmd);
+		success = success && report.success;
+
+		// the time taken by the user or by the sync signal moves the rest of the protocol
+		if (instruction == command::ask_msg || instruction == command::waitSync) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_shift += clock::now() - step_start;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_report.push_back(report);
+		}
+		stopped = m_stop.stopRequested();
+		if (m_on_step)
+			m_on_step(report);
+
+		if (stopped)
+			break;
+	}
+
+	// the last wait is part of the protocol too
+	if (!stopped && !m_protocol.empty()) {
+		const command &last = m_protocol.back();
+		if (last.getInstruction() == command::wait) {
+			clock::time_point end;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				end = m_start + m_shift + std::chrono::duration_cast<clock::duration>(
+					std::chrono::duration<double, std::milli>(m_deadlines.back() + 1000.0 * last.getValue()));
+				m_next_deadline = end;
+			}
+			stopped = !sleepUntil(end);
+		}
+	}
+
+	m_success = success && !stopped;
+	m_running = false;
+}